@@ -0,0 +1,12 @@
+#ifndef COLLISION_H
+#define COLLISION_H
+
+#include <vmath.h>
+
+/**
+ * Returns whether the spheres are colliding.
+ * @param movevec The relative velocity vector.
+ */
+int isSphereCollision(VECTOR pos0, VECTOR pos1, float radius0, float radius1, VECTOR movevec);
+
+#endif
@@ -0,0 +1,99 @@
+#include "culling.h"
+#include <stdlib.h>
+#include <assert.h>
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+
+void sphereArrayInit(struct SphereArray *spheres) {
+	spheres->x = spheres->y = spheres->z = spheres->radius = 0;
+	spheres->count = spheres->capacity = 0;
+}
+
+void sphereArrayDestroy(struct SphereArray *spheres) {
+	free(spheres->x);
+	free(spheres->y);
+	free(spheres->z);
+	free(spheres->radius);
+}
+
+void sphereArrayResize(struct SphereArray *spheres, unsigned int count) {
+	if (count > spheres->capacity) {
+		unsigned int capacity = spheres->capacity ? spheres->capacity : 64;
+		while (capacity < count) capacity *= 2;
+		float *x = realloc(spheres->x, sizeof *x * capacity),
+			  *y = realloc(spheres->y, sizeof *y * capacity),
+			  *z = realloc(spheres->z, sizeof *z * capacity),
+			  *radius = realloc(spheres->radius, sizeof *radius * capacity);
+		assert(x && y && z && radius && "Failed to reallocate array.");
+		spheres->x = x;
+		spheres->y = y;
+		spheres->z = z;
+		spheres->radius = radius;
+		spheres->capacity = capacity;
+	}
+	spheres->count = count;
+}
+
+void cullSpheres(const struct SphereArray *spheres, struct Plane (*frustums)[6], int numViews, unsigned char *visibility) {
+	assert(numViews <= MAX_CULL_VIEWS && "Too many views.");
+	// Unpack the planes once for broadcasting
+	ALIGN(16) float planes[MAX_CULL_VIEWS][6][4];
+	for (int v = 0; v < numViews; ++v) {
+		for (int p = 0; p < 6; ++p) {
+			VectorGet(planes[v][p], frustums[v][p].normal);
+			planes[v][p][3] = frustums[v][p].distance;
+		}
+	}
+
+	unsigned int i = 0;
+#if defined(__AVX__)
+	for (; i + 8 <= spheres->count; i += 8) {
+		const __m256 x = _mm256_loadu_ps(spheres->x + i), y = _mm256_loadu_ps(spheres->y + i), z = _mm256_loadu_ps(spheres->z + i),
+			  negRadius = _mm256_sub_ps(_mm256_setzero_ps(), _mm256_loadu_ps(spheres->radius + i));
+		for (int j = 0; j < 8; ++j) visibility[i + j] = 0;
+		for (int v = 0; v < numViews; ++v) {
+			__m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+			for (int p = 0; p < 6; ++p) {
+				const float *plane = planes[v][p];
+				__m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(plane[0]), x), _mm256_mul_ps(_mm256_set1_ps(plane[1]), y)),
+						_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(plane[2]), z), _mm256_set1_ps(plane[3])));
+				inside = _mm256_and_ps(inside, _mm256_cmp_ps(distance, negRadius, _CMP_GE_OQ));
+			}
+			int bits = _mm256_movemask_ps(inside);
+			for (int j = 0; j < 8; ++j) visibility[i + j] |= ((bits >> j) & 1) << v;
+		}
+	}
+#elif defined(__SSE__)
+	for (; i + 4 <= spheres->count; i += 4) {
+		const __m128 x = _mm_loadu_ps(spheres->x + i), y = _mm_loadu_ps(spheres->y + i), z = _mm_loadu_ps(spheres->z + i),
+			  negRadius = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(spheres->radius + i));
+		for (int j = 0; j < 4; ++j) visibility[i + j] = 0;
+		for (int v = 0; v < numViews; ++v) {
+			__m128 inside = _mm_cmpeq_ps(x, x); // All ones unless the center is NaN
+			for (int p = 0; p < 6; ++p) {
+				const float *plane = planes[v][p];
+				__m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(plane[0]), x), _mm_mul_ps(_mm_set1_ps(plane[1]), y)),
+						_mm_add_ps(_mm_mul_ps(_mm_set1_ps(plane[2]), z), _mm_set1_ps(plane[3])));
+				inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, negRadius));
+			}
+			int bits = _mm_movemask_ps(inside);
+			for (int j = 0; j < 4; ++j) visibility[i + j] |= ((bits >> j) & 1) << v;
+		}
+	}
+#endif
+	for (; i < spheres->count; ++i) {
+		visibility[i] = 0;
+		for (int v = 0; v < numViews; ++v) {
+			int inside = 1;
+			for (int p = 0; p < 6 && inside; ++p) {
+				const float *plane = planes[v][p];
+				float distance = plane[0] * spheres->x[i] + plane[1] * spheres->y[i] + plane[2] * spheres->z[i] + plane[3];
+				inside = distance >= -spheres->radius[i];
+			}
+			visibility[i] |= inside << v;
+		}
+	}
+}
@@ -0,0 +1,36 @@
+#ifndef CULLING_H
+#define CULLING_H
+
+#include <vmath.h>
+
+/** The maximum number of views culled against at once, one bit each in the visibility masks. */
+#define MAX_CULL_VIEWS 8
+
+struct Plane {
+	VECTOR normal;
+	/** The distance to the origin. */
+	float distance;
+};
+
+/** Bounding spheres stored as separate streams, so that several can be tested per SIMD instruction. */
+struct SphereArray {
+	float *x, *y, *z, *radius;
+	unsigned int count, capacity;
+};
+
+void sphereArrayInit(struct SphereArray *spheres);
+
+void sphereArrayDestroy(struct SphereArray *spheres);
+
+/** Sets the number of spheres, growing the streams if needed. The contents are left undefined. */
+void sphereArrayResize(struct SphereArray *spheres, unsigned int count);
+
+/**
+ * Tests every sphere against the frustums of all views in one pass.
+ * @param frustums The six planes of each view, with normals pointing inwards.
+ * @param numViews The number of views, at most MAX_CULL_VIEWS.
+ * @param visibility Receives a mask for each sphere with bit \c v set if it intersects view \c v.
+ */
+void cullSpheres(const struct SphereArray *spheres, struct Plane (*frustums)[6], int numViews, unsigned char *visibility);
+
+#endif
@@ -1,20 +1,320 @@
 #include "entity.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <assert.h>
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+
+/** Alignment of the component arrays; enough for aligned AVX loads. */
+#define COMPONENT_ALIGNMENT 32
+
+/**
+ * Resizes an aligned array, keeping the first \p size bytes.
+ * Component arrays are processed with SIMD, which plain realloc does not guarantee alignment for.
+ */
+static void *resizeAligned(void *ptr, size_t size, size_t newSize) {
+	void *mem = malloc(newSize + COMPONENT_ALIGNMENT - 1 + sizeof(void *));
+	assert(mem && "Failed to allocate memory.");
+	void *newPtr = (void *) (((uintptr_t) mem + COMPONENT_ALIGNMENT - 1 + sizeof(void *)) & ~(uintptr_t) (COMPONENT_ALIGNMENT - 1));
+	((void **) newPtr)[-1] = mem;
+	if (ptr) {
+		memcpy(newPtr, ptr, size);
+		free(((void **) ptr)[-1]);
+	}
+	return newPtr;
+}
+
+static void freeAligned(void *ptr) {
+	if (ptr) free(((void **) ptr)[-1]);
+}
+
+static void resetTransforms(struct EntityManager *manager, unsigned int start, unsigned int end) {
+	for (unsigned int i = start; i < end; ++i) {
+		manager->transforms[i] = (struct TransformComponent) { { 0.0f, 0.0f, 0.0f, 1.0f }, { 1.0f, 1.0f, 1.0f } };
+	}
+}
+
+static void entityManagerGrow(struct EntityManager *manager, unsigned int capacity) {
+	unsigned int oldCapacity = manager->capacity;
+	assert(capacity - 1 <= ENTITY_INDEX_MASK && "Too many entities.");
+#define RESIZE(array) manager->array = resizeAligned(manager->array, \
+		sizeof *manager->array * oldCapacity, sizeof *manager->array * capacity)
+	RESIZE(freeIndices);
+	RESIZE(generations);
+	RESIZE(entityMasks);
+	RESIZE(positions.x);
+	RESIZE(positions.y);
+	RESIZE(positions.z);
+	RESIZE(prevPositions.x);
+	RESIZE(prevPositions.y);
+	RESIZE(prevPositions.z);
+	RESIZE(models);
+	RESIZE(velocities.x);
+	RESIZE(velocities.y);
+	RESIZE(velocities.z);
+	RESIZE(colliders);
+	RESIZE(transforms);
+#undef RESIZE
+	for (int i = 0; i < manager->numQueries; ++i) {
+		struct EntityQuery *query = manager->queries + i;
+		unsigned int *entities = realloc(query->entities, sizeof *query->entities * capacity),
+					 *sparse = realloc(query->sparse, sizeof *query->sparse * capacity);
+		assert(entities && sparse && "Failed to reallocate array.");
+		query->entities = entities;
+		query->sparse = sparse;
+	}
+	memset(manager->generations + oldCapacity, 0, (capacity - oldCapacity) * sizeof *manager->generations);
+	memset(manager->entityMasks + oldCapacity, 0, (capacity - oldCapacity) * sizeof *manager->entityMasks);
+	// Keep the unused slots finite and at rest since they are integrated too
+	float *streams[] = { manager->positions.x, manager->positions.y, manager->positions.z,
+		manager->prevPositions.x, manager->prevPositions.y, manager->prevPositions.z,
+		manager->velocities.x, manager->velocities.y, manager->velocities.z };
+	for (int i = 0; i < sizeof streams / sizeof *streams; ++i) memset(streams[i] + oldCapacity, 0, (capacity - oldCapacity) * sizeof(float));
+	resetTransforms(manager, oldCapacity, capacity);
+	manager->capacity = capacity;
+}
 
 void entityManagerInit(struct EntityManager *manager) {
-	manager->nextEntityIndex = 0;
-	memset(manager->entityMasks, 0, sizeof manager->entityMasks);
+	memset(manager, 0, sizeof *manager);
+	entityManagerGrow(manager, INITIAL_ENTITY_CAPACITY);
+}
+
+void entityManagerDestroy(struct EntityManager *manager) {
+	freeAligned(manager->freeIndices);
+	freeAligned(manager->generations);
+	freeAligned(manager->entityMasks);
+	freeAligned(manager->positions.x);
+	freeAligned(manager->positions.y);
+	freeAligned(manager->positions.z);
+	freeAligned(manager->prevPositions.x);
+	freeAligned(manager->prevPositions.y);
+	freeAligned(manager->prevPositions.z);
+	freeAligned(manager->models);
+	freeAligned(manager->velocities.x);
+	freeAligned(manager->velocities.y);
+	freeAligned(manager->velocities.z);
+	freeAligned(manager->colliders);
+	freeAligned(manager->transforms);
+	for (int i = 0; i < manager->numQueries; ++i) {
+		free(manager->queries[i].entities);
+		free(manager->queries[i].sparse);
+	}
 }
 
 Entity entityManagerSpawn(struct EntityManager *manager) {
-	// TODO reuse entity indices
-	return manager->nextEntityIndex++;
+	unsigned int index;
+	if (manager->numFreeIndices > 0) {
+		index = manager->freeIndices[--manager->numFreeIndices];
+	} else {
+		if (manager->nextEntityIndex == manager->capacity) entityManagerGrow(manager, 2 * manager->capacity);
+		index = manager->nextEntityIndex++;
+	}
+	manager->entityMasks[index] = 0;
+	return manager->generations[index] << ENTITY_INDEX_BITS | index;
 }
 
 void entityManagerClear(struct EntityManager *manager) {
+	for (unsigned int i = 0; i < manager->nextEntityIndex; ++i) {
+		manager->generations[i] = (manager->generations[i] + 1) & ENTITY_GENERATION_MASK;
+	}
 	memset(manager->entityMasks, 0, manager->nextEntityIndex * sizeof *manager->entityMasks);
+	memset(manager->velocities.x, 0, manager->nextEntityIndex * sizeof(float));
+	memset(manager->velocities.y, 0, manager->nextEntityIndex * sizeof(float));
+	memset(manager->velocities.z, 0, manager->nextEntityIndex * sizeof(float));
+	resetTransforms(manager, 0, manager->nextEntityIndex);
 	manager->nextEntityIndex = 0;
+	manager->numFreeIndices = 0;
+	for (int i = 0; i < manager->numQueries; ++i) manager->queries[i].count = 0;
 }
 
 void entityManagerKill(struct EntityManager *manager, Entity entity) {
-	// TODO
+	if (!entityManagerIsAlive(manager, entity)) return;
+	unsigned int index = entityIndex(entity);
+	entityManagerSetMask(manager, entity, 0);
+	manager->generations[index] = (manager->generations[index] + 1) & ENTITY_GENERATION_MASK;
+	manager->freeIndices[manager->numFreeIndices++] = index;
+}
+
+int entityManagerIsAlive(struct EntityManager *manager, Entity entity) {
+	unsigned int index = entityIndex(entity);
+	return index < manager->nextEntityIndex && manager->generations[index] == entityGeneration(entity);
+}
+
+static void queryInsert(struct EntityQuery *query, unsigned int index) {
+	query->sparse[index] = query->count;
+	query->entities[query->count++] = index;
+}
+
+static void queryRemove(struct EntityQuery *query, unsigned int index) {
+	// Move the last member into the hole to keep the entities packed
+	unsigned int position = query->sparse[index], last = query->entities[--query->count];
+	query->entities[position] = last;
+	query->sparse[last] = position;
+}
+
+void entityManagerSetMask(struct EntityManager *manager, Entity entity, unsigned int mask) {
+	assert(entityManagerIsAlive(manager, entity) && "Stale entity handle.");
+	unsigned int index = entityIndex(entity), oldMask = manager->entityMasks[index];
+	for (int i = 0; i < manager->numQueries; ++i) {
+		struct EntityQuery *query = manager->queries + i;
+		int wasMember = (oldMask & query->mask) == query->mask, isMember = (mask & query->mask) == query->mask;
+		if (isMember && !wasMember) queryInsert(query, index);
+		else if (wasMember && !isMember) queryRemove(query, index);
+	}
+	manager->entityMasks[index] = mask;
+	if (!(mask & VELOCITY_COMPONENT_MASK)) {
+		manager->velocities.x[index] = manager->velocities.y[index] = manager->velocities.z[index] = 0.0f;
+	}
+	if (!(mask & TRANSFORM_COMPONENT_MASK)) resetTransforms(manager, index, index + 1);
+}
+
+const struct EntityQuery *entityManagerQuery(struct EntityManager *manager, unsigned int mask) {
+	assert(mask && "Cannot query the empty mask.");
+	for (int i = 0; i < manager->numQueries; ++i) {
+		if (manager->queries[i].mask == mask) return manager->queries + i;
+	}
+
+	assert(manager->numQueries < MAX_ENTITY_QUERIES && "Too many queries.");
+	struct EntityQuery *query = manager->queries + manager->numQueries++;
+	query->mask = mask;
+	query->count = 0;
+	query->entities = malloc(sizeof *query->entities * manager->capacity);
+	query->sparse = malloc(sizeof *query->sparse * manager->capacity);
+	assert(query->entities && query->sparse && "Failed to allocate memory.");
+	for (unsigned int i = 0; i < manager->nextEntityIndex; ++i) {
+		if ((manager->entityMasks[i] & mask) == mask) queryInsert(query, i);
+	}
+	return query;
+}
+
+/** Computes p += dt * v over \p count floats, where count is a multiple of the batch size. */
+static void integrateStream(float *restrict p, const float *restrict v, unsigned int count, float dt) {
+#if defined(__AVX__)
+	const __m256 dt8 = _mm256_set1_ps(dt);
+	for (unsigned int i = 0; i < count; i += 8) {
+		_mm256_store_ps(p + i, _mm256_add_ps(_mm256_load_ps(p + i), _mm256_mul_ps(dt8, _mm256_load_ps(v + i))));
+	}
+#elif defined(__SSE__)
+	const __m128 dt4 = _mm_set1_ps(dt);
+	for (unsigned int i = 0; i < count; i += 4) {
+		_mm_store_ps(p + i, _mm_add_ps(_mm_load_ps(p + i), _mm_mul_ps(dt4, _mm_load_ps(v + i))));
+	}
+#else
+	for (unsigned int i = 0; i < count; ++i) p[i] += dt * v[i];
+#endif
+}
+
+void entityManagerSavePositions(struct EntityManager *manager) {
+	size_t size = manager->nextEntityIndex * sizeof(float);
+	memcpy(manager->prevPositions.x, manager->positions.x, size);
+	memcpy(manager->prevPositions.y, manager->positions.y, size);
+	memcpy(manager->prevPositions.z, manager->positions.z, size);
+}
+
+unsigned int entityManagerNumBatches(struct EntityManager *manager) {
+	// The padding slots of the last batch are at rest so updating them is harmless
+	return (manager->nextEntityIndex + INTEGRATE_BATCH_SIZE - 1) / INTEGRATE_BATCH_SIZE;
+}
+
+void entityManagerIntegrate(struct EntityManager *manager, unsigned int firstBatch, unsigned int lastBatch, float dt) {
+	assert(lastBatch * INTEGRATE_BATCH_SIZE <= manager->capacity);
+	unsigned int start = firstBatch * INTEGRATE_BATCH_SIZE, count = (lastBatch - firstBatch) * INTEGRATE_BATCH_SIZE;
+	integrateStream(manager->positions.x + start, manager->velocities.x + start, count, dt);
+	integrateStream(manager->positions.y + start, manager->velocities.y + start, count, dt);
+	integrateStream(manager->positions.z + start, manager->velocities.z + start, count, dt);
+}
+
+/** Writes the matrix translating by (x, y, z) after rotating and scaling by \p t. */
+static void computeWorldMatrix(float *m, float x, float y, float z, const struct TransformComponent *t) {
+	const float qx = t->rotation[0], qy = t->rotation[1], qz = t->rotation[2], qw = t->rotation[3],
+		  sx = t->scale[0], sy = t->scale[1], sz = t->scale[2];
+	m[0] = (1.0f - 2.0f * (qy * qy + qz * qz)) * sx;
+	m[1] = 2.0f * (qx * qy + qw * qz) * sx;
+	m[2] = 2.0f * (qx * qz - qw * qy) * sx;
+	m[3] = 0.0f;
+	m[4] = 2.0f * (qx * qy - qw * qz) * sy;
+	m[5] = (1.0f - 2.0f * (qx * qx + qz * qz)) * sy;
+	m[6] = 2.0f * (qy * qz + qw * qx) * sy;
+	m[7] = 0.0f;
+	m[8] = 2.0f * (qx * qz + qw * qy) * sz;
+	m[9] = 2.0f * (qy * qz - qw * qx) * sz;
+	m[10] = (1.0f - 2.0f * (qx * qx + qy * qy)) * sz;
+	m[11] = 0.0f;
+	m[12] = x;
+	m[13] = y;
+	m[14] = z;
+	m[15] = 1.0f;
+}
+
+#if defined(__SSE__)
+/** Transposes the four rows, holding one column of four matrices, into the matrices. */
+static void storeColumns(float *m, int column, __m128 r0, __m128 r1, __m128 r2, __m128 r3) {
+	_MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+	_mm_storeu_ps(m + 4 * column, r0);
+	_mm_storeu_ps(m + 16 + 4 * column, r1);
+	_mm_storeu_ps(m + 32 + 4 * column, r2);
+	_mm_storeu_ps(m + 48 + 4 * column, r3);
+}
+#endif
+
+void entityManagerComputeWorldMatrices(struct EntityManager *manager, const struct EntityQuery *query, float alpha, float *matrices) {
+	const struct Vector3Array *prev = &manager->prevPositions, *curr = &manager->positions;
+	unsigned int k = 0;
+#if defined(__SSE__)
+	// Four entities at a time, with each lane of a register holding the same element of a different entity
+	const __m128 alpha4 = _mm_set1_ps(alpha), one = _mm_set1_ps(1.0f), two = _mm_set1_ps(2.0f), zero = _mm_setzero_ps();
+	for (; k + 4 <= query->count; k += 4) {
+		ALIGN(16) float lanes[13][4];
+		for (int l = 0; l < 4; ++l) {
+			unsigned int i = query->entities[k + l];
+			const struct TransformComponent *t = manager->transforms + i;
+			lanes[0][l] = prev->x[i];
+			lanes[1][l] = prev->y[i];
+			lanes[2][l] = prev->z[i];
+			lanes[3][l] = curr->x[i];
+			lanes[4][l] = curr->y[i];
+			lanes[5][l] = curr->z[i];
+			for (int c = 0; c < 4; ++c) lanes[6 + c][l] = t->rotation[c];
+			for (int c = 0; c < 3; ++c) lanes[10 + c][l] = t->scale[c];
+		}
+		__m128 px = _mm_load_ps(lanes[0]), py = _mm_load_ps(lanes[1]), pz = _mm_load_ps(lanes[2]);
+		px = _mm_add_ps(px, _mm_mul_ps(alpha4, _mm_sub_ps(_mm_load_ps(lanes[3]), px)));
+		py = _mm_add_ps(py, _mm_mul_ps(alpha4, _mm_sub_ps(_mm_load_ps(lanes[4]), py)));
+		pz = _mm_add_ps(pz, _mm_mul_ps(alpha4, _mm_sub_ps(_mm_load_ps(lanes[5]), pz)));
+		const __m128 qx = _mm_load_ps(lanes[6]), qy = _mm_load_ps(lanes[7]), qz = _mm_load_ps(lanes[8]), qw = _mm_load_ps(lanes[9]),
+			  sx = _mm_load_ps(lanes[10]), sy = _mm_load_ps(lanes[11]), sz = _mm_load_ps(lanes[12]);
+		const __m128 xx = _mm_mul_ps(qx, qx), yy = _mm_mul_ps(qy, qy), zz = _mm_mul_ps(qz, qz),
+			  xy = _mm_mul_ps(qx, qy), xz = _mm_mul_ps(qx, qz), yz = _mm_mul_ps(qy, qz),
+			  wx = _mm_mul_ps(qw, qx), wy = _mm_mul_ps(qw, qy), wz = _mm_mul_ps(qw, qz);
+
+		float *m = matrices + 16 * k;
+		storeColumns(m, 0,
+				_mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(yy, zz))), sx),
+				_mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(xy, wz)), sx),
+				_mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(xz, wy)), sx),
+				zero);
+		storeColumns(m, 1,
+				_mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(xy, wz)), sy),
+				_mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, zz))), sy),
+				_mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(yz, wx)), sy),
+				zero);
+		storeColumns(m, 2,
+				_mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(xz, wy)), sz),
+				_mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(yz, wx)), sz),
+				_mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, yy))), sz),
+				zero);
+		storeColumns(m, 3, px, py, pz, one);
+	}
+#endif
+	for (; k < query->count; ++k) {
+		unsigned int i = query->entities[k];
+		computeWorldMatrix(matrices + 16 * k,
+				prev->x[i] + alpha * (curr->x[i] - prev->x[i]),
+				prev->y[i] + alpha * (curr->y[i] - prev->y[i]),
+				prev->z[i] + alpha * (curr->z[i] - prev->z[i]),
+				manager->transforms + i);
+	}
 }
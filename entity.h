@@ -3,10 +3,22 @@
 
 #include <string.h>
 #include <vmath.h>
-#include "model.h"
 
-#define MAX_ENTITIES 128
+/** The number of entity slots allocated up front; the arrays grow beyond this on demand. */
+#define INITIAL_ENTITY_CAPACITY 128
+#define ENTITY_INDEX_BITS 20
+#define ENTITY_INDEX_MASK ((1u << ENTITY_INDEX_BITS) - 1)
+#define ENTITY_GENERATION_MASK ((1u << (32 - ENTITY_INDEX_BITS)) - 1)
+/** The number of slots integrated at once. The capacity is always a multiple of this. */
+#define INTEGRATE_BATCH_SIZE 8
+/** The maximum number of distinct component masks that can be queried. */
+#define MAX_ENTITY_QUERIES 8
 
+/**
+ * Handle to an entity.
+ * The low bits index the component arrays and the high bits hold the
+ * generation of the slot, so that handles to killed entities can be detected.
+ */
 typedef unsigned int Entity;
 
 enum {
@@ -15,12 +27,21 @@ enum {
 	VELOCITY_COMPONENT_MASK = 0x4,
 	COLLIDER_COMPONENT_MASK = 0x8,
 	ENEMY_COMPONENT_MASK = 0x10,
+	TRANSFORM_COMPONENT_MASK = 0x20,
+	/** Tags entities that never move, so that their shadows can be cached. */
+	STATIC_COMPONENT_MASK = 0x40,
 };
 
-struct PositionComponent {
-	VECTOR position;
+/**
+ * Per-entity 3D vectors stored as separate x, y and z streams,
+ * so that systems can process several entities per SIMD instruction.
+ */
+struct Vector3Array {
+	float *x, *y, *z;
 };
 
+struct Model;
+
 struct ModelComponent {
 	struct Model *model;
 };
@@ -29,21 +50,145 @@ struct ColliderComponent {
 	float radius;
 };
 
+/**
+ * Orientation and size of an entity, applied before translating it to its position.
+ * Non-uniform scales are not accounted for in the shading normals.
+ */
+struct TransformComponent {
+	/** Unit quaternion (x, y, z, w). */
+	float rotation[4];
+	float scale[3];
+};
+
+/**
+ * Sparse set of the entities whose masks contain all bits of a component mask.
+ * Iterating over \c entities only touches matching entities, regardless of capacity.
+ */
+struct EntityQuery {
+	unsigned int mask;
+	unsigned int count;
+	/** Packed slot indices of the matching entities. */
+	unsigned int *entities;
+	/** Maps a slot index to its position in \c entities. Only meaningful for members. */
+	unsigned int *sparse;
+};
+
 struct EntityManager {
+	/** The number of allocated slots. */
+	unsigned int capacity;
+	/** One past the highest slot index ever handed out. */
 	unsigned int nextEntityIndex;
-	unsigned int entityMasks[MAX_ENTITIES];
-	struct PositionComponent positions[MAX_ENTITIES];
-	struct ModelComponent models[MAX_ENTITIES];
-	VECTOR velocities[MAX_ENTITIES];
-	struct ColliderComponent colliders[MAX_ENTITIES];
+	/** Stack of killed slot indices available for reuse. */
+	unsigned int *freeIndices;
+	unsigned int numFreeIndices;
+	unsigned int *generations;
+	unsigned int *entityMasks;
+	struct Vector3Array positions;
+	/** The positions before the last simulation step, for interpolating between steps when rendering. */
+	struct Vector3Array prevPositions;
+	struct ModelComponent *models;
+	/** Zero for all slots without a velocity component, so integration need not check masks. */
+	struct Vector3Array velocities;
+	struct ColliderComponent *colliders;
+	/** The identity transform for all slots without a transform component. */
+	struct TransformComponent *transforms;
+	int numQueries;
+	struct EntityQuery queries[MAX_ENTITY_QUERIES];
 };
 
+/** Returns the index of the entity's slot in the component arrays. */
+static inline unsigned int entityIndex(Entity entity) {
+	return entity & ENTITY_INDEX_MASK;
+}
+
+static inline unsigned int entityGeneration(Entity entity) {
+	return entity >> ENTITY_INDEX_BITS;
+}
+
+static inline VECTOR entityManagerGetPosition(struct EntityManager *manager, unsigned int index) {
+	return VectorSet(manager->positions.x[index], manager->positions.y[index], manager->positions.z[index], 1.0f);
+}
+
+/**
+ * Returns the position a fraction \p alpha of the way from the previous to the current simulation step.
+ */
+static inline VECTOR entityManagerGetInterpolatedPosition(struct EntityManager *manager, unsigned int index, float alpha) {
+	const struct Vector3Array *prev = &manager->prevPositions, *curr = &manager->positions;
+	return VectorSet(prev->x[index] + alpha * (curr->x[index] - prev->x[index]),
+			prev->y[index] + alpha * (curr->y[index] - prev->y[index]),
+			prev->z[index] + alpha * (curr->z[index] - prev->z[index]), 1.0f);
+}
+
+/** Moves the entity without interpolating from its old position. */
+static inline void entityManagerSetPosition(struct EntityManager *manager, unsigned int index, VECTOR position) {
+	ALIGN(16) float vv[4];
+	VectorGet(vv, position);
+	manager->positions.x[index] = manager->prevPositions.x[index] = vv[0];
+	manager->positions.y[index] = manager->prevPositions.y[index] = vv[1];
+	manager->positions.z[index] = manager->prevPositions.z[index] = vv[2];
+}
+
+static inline VECTOR entityManagerGetVelocity(struct EntityManager *manager, unsigned int index) {
+	return VectorSet(manager->velocities.x[index], manager->velocities.y[index], manager->velocities.z[index], 0.0f);
+}
+
+static inline void entityManagerSetVelocity(struct EntityManager *manager, unsigned int index, VECTOR velocity) {
+	ALIGN(16) float vv[4];
+	VectorGet(vv, velocity);
+	manager->velocities.x[index] = vv[0];
+	manager->velocities.y[index] = vv[1];
+	manager->velocities.z[index] = vv[2];
+}
+
 void entityManagerInit(struct EntityManager *manager);
 
+void entityManagerDestroy(struct EntityManager *manager);
+
+/**
+ * Spawns a new entity without any components.
+ * May grow the component arrays, invalidating pointers into them.
+ */
 Entity entityManagerSpawn(struct EntityManager *manager);
 
+/** Kills all entities, invalidating every outstanding handle. */
 void entityManagerClear(struct EntityManager *manager);
 
 void entityManagerKill(struct EntityManager *manager, Entity entity);
 
+/** Returns whether the handle refers to an entity that has not been killed. */
+int entityManagerIsAlive(struct EntityManager *manager, Entity entity);
+
+/**
+ * Sets the component mask of the entity, keeping the queries up to date.
+ * Masks must only be changed through this function.
+ */
+void entityManagerSetMask(struct EntityManager *manager, Entity entity, unsigned int mask);
+
+/**
+ * Returns the set of entities having all the components in \p mask.
+ * The first call for a mask registers the query; afterwards it is maintained incrementally.
+ * Removing entities while iterating moves the last member into the removed spot,
+ * so iterate backwards when killing entities.
+ */
+const struct EntityQuery *entityManagerQuery(struct EntityManager *manager, unsigned int mask);
+
+/** Remembers the current positions as those before the next simulation step. */
+void entityManagerSavePositions(struct EntityManager *manager);
+
+/** Returns the number of integration batches covering all spawned slots. */
+unsigned int entityManagerNumBatches(struct EntityManager *manager);
+
+/**
+ * Advances the positions of the slots in batches [firstBatch, lastBatch) by their velocities.
+ * Processes whole SIMD batches of slots without consulting the masks.
+ */
+void entityManagerIntegrate(struct EntityManager *manager, unsigned int firstBatch, unsigned int lastBatch, float dt);
+
+/**
+ * Computes the world matrices of the entities in the query from their transforms and
+ * positions interpolated a fraction \p alpha of the way from the previous simulation step.
+ * @param matrices Receives 16 floats per entity, in query order and in the layout of MatrixGet.
+ */
+void entityManagerComputeWorldMatrices(struct EntityManager *manager, const struct EntityQuery *query, float alpha, float *matrices);
+
 #endif
@@ -9,6 +9,7 @@
 #include "image.h"
 #include "label.h"
 #include "glUtil.h"
+#include "systems.h"
 
 #define MOUSE_SENSITIVITY 0.006f
 #define MOVEMENT_SPEED .02f
@@ -24,55 +25,50 @@ static void onDie(struct GameState *gameState) {
 	widgetRequestFocus(context, context->root);
 }
 
-static void processEnemies(struct GameState *gameState, float dt) {
-	struct EntityManager *manager = &gameState->manager;
-	VECTOR playerPos = manager->positions[gameState->player].position;
-	const unsigned mask = POSITION_COMPONENT_MASK | VELOCITY_COMPONENT_MASK | ENEMY_COMPONENT_MASK;
-	for (int i = 0; i < MAX_ENTITIES; ++i) {
-		if ((manager->entityMasks[i] & mask) == mask) {
-			VECTOR pos = manager->positions[i].position;
-			VECTOR toward = VectorSubtract(playerPos, pos);
-			if ((VectorEqual(toward, VectorReplicate(0.0f)) & 0x7) == 0x7) {
-				manager->velocities[i] = VectorReplicate(0.0f);
-			} else {
-				manager->velocities[i] = VectorDivide(Vector4Normalize(toward), VectorReplicate(100.0f));
-			}
-		}
-	}
+static void setPlayerHit(void *data) {
+	SDL_AtomicSet(data, 1);
 }
 
-static void processVelocities(struct GameState *gameState, float dt) {
+/**
+ * Runs the gameplay systems as parallel jobs.
+ * Enemies steer before collisions are tested, and both happen before the positions are integrated.
+ * Collisions are found by keeping the colliders in a uniform grid and testing the player against its neighbours only.
+ */
+static void runSystems(struct GameState *gameState, float dt) {
 	struct EntityManager *manager = &gameState->manager;
-	const unsigned mask = POSITION_COMPONENT_MASK | VELOCITY_COMPONENT_MASK;
-	for (int i = 0; i < MAX_ENTITIES; ++i) {
-		if ((manager->entityMasks[i] & mask) == mask) {
-			manager->positions[i].position = VectorAdd(manager->positions[i].position,
-					VectorMultiply(VectorReplicate(dt), manager->velocities[i]));
-		}
+	struct SystemContext context;
+	systemContextInit(&context, manager, &gameState->broadphase, gameState->player, dt);
+	SDL_atomic_t playerHit;
+	SDL_AtomicSet(&playerHit, 0);
+	context.onPlayerHit = setPlayerHit;
+	context.data = &playerHit;
+
+	struct Job enemyJob, broadphaseJob, collisionJob, velocityJob;
+	jobInit(&enemyJob, processEnemies, &context, 0, context.enemies->count, 256);
+	jobInit(&velocityJob, processVelocities, &context, 0, entityManagerNumBatches(manager), 128);
+	int testCollisions = !gameState->playerData.dead && (manager->entityMasks[context.player] & COLLIDER_SYSTEM_MASK) == COLLIDER_SYSTEM_MASK;
+	if (testCollisions) {
+		// The broadphase accounts for the velocities, so it has to wait for the enemies to steer
+		jobInit(&broadphaseJob, buildBroadphase, &context, 0, 1, 1);
+		jobInit(&collisionJob, processCollisions, &context, 0, 1, 1);
+		jobAddDependency(&broadphaseJob, &enemyJob);
+		jobAddDependency(&collisionJob, &broadphaseJob);
+		jobAddDependency(&velocityJob, &collisionJob);
+	} else {
+		jobAddDependency(&velocityJob, &enemyJob);
 	}
-}
 
-static void processCollisions(struct GameState *gameState, float dt) {
-	struct EntityManager *manager = &gameState->manager;
-	const unsigned mask = POSITION_COMPONENT_MASK | VELOCITY_COMPONENT_MASK | COLLIDER_COMPONENT_MASK;
-	for (int i = 0; i < MAX_ENTITIES && i == gameState->player; ++i) {
-		if ((manager->entityMasks[i] & mask) == mask) {
-			VECTOR pos0 = manager->positions[i].position, velocity0 = manager->velocities[i];
-			float radius0 = manager->colliders[i].radius;
-
-			for (int j = i + 1; j < MAX_ENTITIES; ++j) {
-				if ((manager->entityMasks[j] & mask) == mask) {
-					VECTOR pos1 = manager->positions[j].position, velocity1 = manager->velocities[j];
-					float radius1 = manager->colliders[j].radius;
-
-					VECTOR movevec = VectorMultiply(VectorReplicate(dt), VectorSubtract(velocity0, velocity1));
-					if (isSphereCollision(pos0, pos1, radius0, radius1, movevec)) {
-						printf("hello collisions %f\n", dt);
-						onDie(gameState);
-					}
-				}
-			}
-		}
+	jobSystemSubmit(&gameState->jobSystem, &enemyJob);
+	if (testCollisions) {
+		jobSystemSubmit(&gameState->jobSystem, &broadphaseJob);
+		jobSystemSubmit(&gameState->jobSystem, &collisionJob);
+	}
+	jobSystemSubmit(&gameState->jobSystem, &velocityJob);
+	jobSystemWait(&gameState->jobSystem, &velocityJob);
+
+	if (SDL_AtomicGet(&playerHit)) {
+		printf("hello collisions %f\n", dt);
+		onDie(gameState);
 	}
 }
 
@@ -87,10 +83,27 @@ static float calcDyingEffectFactor(float timer) {
 	return cubicBezier(0.0f, 0.07f, 0.59f, 1.0f, t);
 }
 
+/** Interpolates between two angles in [-pi, pi] along the shorter arc. */
+static float interpolateAngle(float a, float b, float alpha) {
+	float delta = b - a;
+	if (delta > M_PI) delta -= 2 * M_PI;
+	else if (delta < -M_PI) delta += 2 * M_PI;
+	return a + alpha * delta;
+}
+
 static void gameStateUpdate(struct State *state, float dt) {
 	struct GameState *gameState = (struct GameState *) state;
 	struct EntityManager *manager = &gameState->manager;
-	const Uint8 *keys = SDL_GetKeyboardState(NULL);
+
+	inputFrameSample(&gameState->pendingInput);
+	struct InputFrame input = inputTraceNext(gameState->inputTrace, &gameState->pendingInput);
+	gameState->pendingInput.numKeyDowns = 0;
+	// Key presses are handled between steps so that they replay at the same point in the simulation
+	for (int i = 0; i < input.numKeyDowns; ++i) guiKeyDown(&gameState->context, input.keyDowns[i]);
+
+	// Keep the state before this step around for rendering in between steps
+	entityManagerSavePositions(manager);
+	gameState->prevYaw = gameState->yaw;
 
 	float timeScale = 1.0f;
 	if (gameState->playerData.dead) {
@@ -100,14 +113,12 @@ static void gameStateUpdate(struct State *state, float dt) {
 	dt *= timeScale;
 
 	if (gameState->noclip) {
-		int x, y;
-		Uint32 button = SDL_GetRelativeMouseState(&x, &y);
-		gameState->yaw -= x * MOUSE_SENSITIVITY;
-		gameState->pitch -= y * MOUSE_SENSITIVITY;
+		gameState->yaw -= input.mouseX * MOUSE_SENSITIVITY;
+		gameState->pitch -= input.mouseY * MOUSE_SENSITIVITY;
 	} else {
 		// Handle turning
-		if (keys[SDL_SCANCODE_A] ^ keys[SDL_SCANCODE_D]) {
-			gameState->playerData.turn += keys[SDL_SCANCODE_A] ? -dt : dt;
+		if (!(input.buttons & INPUT_LEFT) ^ !(input.buttons & INPUT_RIGHT)) {
+			gameState->playerData.turn += input.buttons & INPUT_LEFT ? -dt : dt;
 		} else {
 			if (fabs(gameState->playerData.turn) < TURNING_TIME / 3.0f) {
 				if (gameState->playerData.turn < -dt) gameState->playerData.turn += dt;
@@ -131,34 +142,32 @@ static void gameStateUpdate(struct State *state, float dt) {
 
 	if (gameState->noclip) {
 		VECTOR displacement = VectorReplicate(0.0f);
-		if (keys[SDL_SCANCODE_W]) displacement = VectorAdd(displacement, forward);
-		if (keys[SDL_SCANCODE_A]) displacement = VectorSubtract(displacement, right);
-		if (keys[SDL_SCANCODE_S]) displacement = VectorSubtract(displacement, forward);
-		if (keys[SDL_SCANCODE_D]) displacement = VectorAdd(displacement, right);
-		if (keys[SDL_SCANCODE_SPACE]) displacement = VectorAdd(displacement, VectorSet(0, MOVEMENT_SPEED, 0, 0));
-		if (keys[SDL_SCANCODE_LSHIFT]) displacement = VectorSubtract(displacement, VectorSet(0, MOVEMENT_SPEED, 0, 0));
+		if (input.buttons & INPUT_FORWARD) displacement = VectorAdd(displacement, forward);
+		if (input.buttons & INPUT_LEFT) displacement = VectorSubtract(displacement, right);
+		if (input.buttons & INPUT_BACKWARD) displacement = VectorSubtract(displacement, forward);
+		if (input.buttons & INPUT_RIGHT) displacement = VectorAdd(displacement, right);
+		if (input.buttons & INPUT_UP) displacement = VectorAdd(displacement, VectorSet(0, MOVEMENT_SPEED, 0, 0));
+		if (input.buttons & INPUT_DOWN) displacement = VectorSubtract(displacement, VectorSet(0, MOVEMENT_SPEED, 0, 0));
 		gameState->position = VectorAdd(gameState->position, VectorMultiply(VectorReplicate(dt), displacement));
 	} else {
-		manager->velocities[gameState->player] = forward;
+		entityManagerSetVelocity(manager, entityIndex(gameState->player), forward);
 	}
 
-	processEnemies(gameState, dt);
-	if (!gameState->playerData.dead) {
-		processCollisions(gameState, dt);
-	}
-	processVelocities(gameState, dt);
+	runSystems(gameState, dt);
 }
 
-static void gameStateDraw(struct State *state, float dt) {
+static void gameStateDraw(struct State *state, float dt, float alpha) {
 	struct GameState *gameState = (struct GameState *) state;
 	struct SpriteBatch *batch = gameState->batch;
 	struct EntityManager *manager = &gameState->manager;
 
+	gpuProfilerBeginFrame(&gameState->profiler);
+	rendererSetInterpolation(&gameState->renderer, alpha);
 	if (gameState->noclip) {
 		rendererDraw(&gameState->renderer, gameState->position, gameState->yaw, gameState->pitch, 0.0f, dt);
 	} else {
-		VECTOR position = VectorAdd(manager->positions[gameState->player].position, VectorSet(0.0f, 1.4f, 0.0f, 0.0f));
-		float yaw = gameState->yaw;
+		VECTOR position = VectorAdd(entityManagerGetInterpolatedPosition(manager, entityIndex(gameState->player), alpha), VectorSet(0.0f, 1.4f, 0.0f, 0.0f));
+		float yaw = interpolateAngle(gameState->prevYaw, gameState->yaw, alpha);
 		float pitch = 0;
 		float roll = M_PI / 9 * getTurningFactor(gameState->playerData.turn);
 		if (gameState->playerData.dead) {
@@ -176,11 +185,15 @@ static void gameStateDraw(struct State *state, float dt) {
 	}
 
 	// Draw GUI
+	gpuProfilerBegin(&gameState->profiler, "gui");
 	spriteBatchBegin(batch);
 	struct GuiContext *context = &gameState->context;
 	widgetValidate(context->root, 800, 600);
 	widgetDraw(context->root, batch);
+	if (gameState->showProfiler) gpuProfilerOverlayDraw(&gameState->profilerOverlay, &gameState->profiler, batch, 10, 10);
 	spriteBatchEnd(batch);
+	gpuProfilerEnd(&gameState->profiler);
+	gpuProfilerEndFrame(&gameState->profiler);
 }
 
 static void gameStateResize(struct State *state, int width, int height) {
@@ -194,8 +207,12 @@ static void mouseUp(struct State *state, int button, int x, int y) {}
 
 static void keyDown(struct State *state, SDL_Scancode scancode) {
 	struct GameState *gameState = (struct GameState *) state;
-	struct GuiContext *context = &gameState->context;
-	guiKeyDown(context, scancode);
+	// Not part of the recorded input, so that toggling it does not change a replay
+	if (scancode == SDL_SCANCODE_F3) {
+		gameState->showProfiler = !gameState->showProfiler;
+		return;
+	}
+	inputFrameAddKeyDown(&gameState->pendingInput, scancode);
 }
 
 static void keyUp(struct State *state, SDL_Scancode scancode) {}
@@ -211,7 +228,7 @@ static void initInGameUI(struct InGameUI *ui, struct Font *font) {
 static void initGame(struct GameState *gameState) {
 	struct EntityManager *manager = &gameState->manager;
 
-	gameState->yaw = 0;
+	gameState->yaw = gameState->prevYaw = 0;
 	gameState->pitch = 0;
 
 	gameState->playerData.turn = 0.0f;
@@ -220,23 +237,26 @@ static void initGame(struct GameState *gameState) {
 
 	entityManagerClear(manager);
 	gameState->player = entityManagerSpawn(manager);
-	manager->entityMasks[gameState->player] = POSITION_COMPONENT_MASK | VELOCITY_COMPONENT_MASK | COLLIDER_COMPONENT_MASK;
-	manager->positions[gameState->player].position = VectorSet(0.0f, 0.0f, 0.0f, 1.0f);
-	manager->velocities[gameState->player] = VectorReplicate(0.0f);
-	manager->colliders[gameState->player].radius = 0.2f;
-
-	Entity ground = entityManagerSpawn(manager);
-	manager->entityMasks[ground] = POSITION_COMPONENT_MASK | MODEL_COMPONENT_MASK;
-	manager->positions[ground].position = VectorSet(0.0f, 0.0f, 0.0f, 1.0f);
+	unsigned int player = entityIndex(gameState->player);
+	entityManagerSetMask(manager, gameState->player, POSITION_COMPONENT_MASK | VELOCITY_COMPONENT_MASK | COLLIDER_COMPONENT_MASK);
+	entityManagerSetPosition(manager, player, VectorSet(0.0f, 0.0f, 0.0f, 1.0f));
+	entityManagerSetVelocity(manager, player, VectorReplicate(0.0f));
+	manager->colliders[player].radius = 0.2f;
+
+	Entity groundEntity = entityManagerSpawn(manager);
+	entityManagerSetMask(manager, groundEntity, POSITION_COMPONENT_MASK | MODEL_COMPONENT_MASK | STATIC_COMPONENT_MASK);
+	unsigned int ground = entityIndex(groundEntity);
+	entityManagerSetPosition(manager, ground, VectorSet(0.0f, 0.0f, 0.0f, 1.0f));
 	manager->models[ground].model = gameState->groundModel;
 
 	const float range = 400.0f;
 	for (int i = 0; i < 35; ++i) {
-		Entity enemy = entityManagerSpawn(manager);
-		manager->entityMasks[enemy] = POSITION_COMPONENT_MASK | MODEL_COMPONENT_MASK | VELOCITY_COMPONENT_MASK | COLLIDER_COMPONENT_MASK | ENEMY_COMPONENT_MASK;
-		manager->positions[enemy].position = VectorSet(range * randomFloat() - range / 2, 0.0f, range * randomFloat() - range / 2, 1.0f);
+		Entity enemyEntity = entityManagerSpawn(manager);
+		entityManagerSetMask(manager, enemyEntity, POSITION_COMPONENT_MASK | MODEL_COMPONENT_MASK | VELOCITY_COMPONENT_MASK | COLLIDER_COMPONENT_MASK | ENEMY_COMPONENT_MASK);
+		unsigned int enemy = entityIndex(enemyEntity);
+		entityManagerSetPosition(manager, enemy, VectorSet(range * randomFloat() - range / 2, 0.0f, range * randomFloat() - range / 2, 1.0f));
 		manager->models[enemy].model = gameState->objModel;
-		manager->velocities[enemy] = VectorReplicate(0.0f);
+		entityManagerSetVelocity(manager, enemy, VectorReplicate(0.0f));
 		manager->colliders[enemy].radius = 0.5f;
 	}
 
@@ -259,7 +279,7 @@ static void initGameOverUI(struct GameState *gameState, struct GameOverUI *ui, s
 	widgetAddListener(label, (struct Listener) { "keyDown", onGameOverKeyDown, gameState, 0 });
 }
 
-void gameStateInitialize(struct GameState *gameState, struct SpriteBatch *batch, struct Font *font) {
+void gameStateInitialize(struct GameState *gameState, struct SpriteBatch *batch, struct Font *font, struct InputTrace *inputTrace) {
 	struct State *state = (struct State *) gameState;
 	struct EntityManager *manager = &gameState->manager;
 	state->update = gameStateUpdate;
@@ -271,16 +291,24 @@ void gameStateInitialize(struct GameState *gameState, struct SpriteBatch *batch,
 	state->keyUp = keyUp;
 	gameState->batch = batch;
 	gameState->font = font;
+	gameState->inputTrace = inputTrace;
+	gameState->pendingInput.numKeyDowns = 0;
 	entityManagerInit(manager);
+	jobSystemInit(&gameState->jobSystem, SDL_GetCPUCount());
+	spatialHashInit(&gameState->broadphase);
 	struct Renderer *renderer = &gameState->renderer;
 	rendererInit(renderer, manager, 800, 600);
+	gpuProfilerInit(&gameState->profiler);
+	gpuProfilerOverlayInit(&gameState->profilerOverlay, font);
+	gameState->showProfiler = 0;
+	rendererSetProfiler(renderer, &gameState->profiler);
 
 	gameState->position = VectorSet(0, 0, 0, 1);
-	gameState->objModel = loadModelFromObj("assets/pyramid.obj");
+	gameState->objModel = loadModelFromObj(&renderer->geometry, "assets/pyramid.obj");
 	if (!gameState->objModel) {
 		printf("Failed to load model.\n");
 	}
-	gameState->groundModel = loadModelFromObj("assets/ground.obj");
+	gameState->groundModel = loadModelFromObj(&renderer->geometry, "assets/ground.obj");
 	if (!gameState->groundModel) {
 		printf("Failed to load ground model.\n");
 	}
@@ -321,6 +349,11 @@ void gameStateInitialize(struct GameState *gameState, struct SpriteBatch *batch,
 
 void gameStateDestroy(struct GameState *gameState) {
 	rendererDestroy(&gameState->renderer);
+	gpuProfilerDestroy(&gameState->profiler);
+	gpuProfilerOverlayDestroy(&gameState->profilerOverlay);
+	entityManagerDestroy(&gameState->manager);
+	jobSystemDestroy(&gameState->jobSystem);
+	spatialHashDestroy(&gameState->broadphase);
 	destroyModel(gameState->objModel);
 
 	widgetDestroy(gameState->flexLayout);
@@ -4,11 +4,15 @@
 #include "state.h"
 #include "spriteBatch.h"
 #include "entity.h"
+#include "jobSystem.h"
+#include "spatialHash.h"
 #include "renderer.h"
 #include "model.h"
 #include "font.h"
 #include "widget.h"
 #include "label.h"
+#include "inputTrace.h"
+#include "gpuProfiler.h"
 
 struct PlayerData {
 	float turn;
@@ -28,11 +32,22 @@ typedef struct GameState {
 	struct State state;
 	struct SpriteBatch *batch;
 	struct Font *font;
+	struct InputTrace *inputTrace;
+	/** Input gathered since the last simulation step. */
+	struct InputFrame pendingInput;
 	struct EntityManager manager;
+	struct JobSystem jobSystem;
+	struct SpatialHash broadphase;
 	struct Renderer renderer;
+	struct GpuProfiler profiler;
+	struct GpuProfilerOverlay profilerOverlay;
+	/** Whether the GPU timings are drawn over the game, toggled with F3. */
+	int showProfiler;
 
 	VECTOR position;
 	float yaw, pitch;
+	/** The yaw before the last simulation step. */
+	float prevYaw;
 	struct Model *objModel;
 	struct Model *groundModel;
 
@@ -50,7 +65,10 @@ typedef struct GameState {
 	Entity player;
 } GameState;
 
-void gameStateInitialize(struct GameState *gameState, struct SpriteBatch *batch, struct Font *font);
+/**
+ * @param inputTrace Records or supplies the input of each simulation step.
+ */
+void gameStateInitialize(struct GameState *gameState, struct SpriteBatch *batch, struct Font *font, struct InputTrace *inputTrace);
 
 void gameStateDestroy(struct GameState *gameState);
 
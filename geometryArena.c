@@ -0,0 +1,96 @@
+#include "geometryArena.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+
+static int isPackedNormalSupported() {
+#ifdef __EMSCRIPTEN__
+	return 0; // WebGL 1 has no packed vertex formats
+#else
+	return GLEW_VERSION_3_3 || GLEW_ARB_vertex_type_2_10_10_10_rev;
+#endif
+}
+
+void geometryArenaInit(struct GeometryArena *arena) {
+	// Positions are padded to four components, as attributes are fetched fastest when aligned to four bytes
+	arena->position = (struct VertexAttribFormat) { 4, GL_UNSIGNED_SHORT, GL_TRUE, 0 };
+	arena->normal = isPackedNormalSupported() ? (struct VertexAttribFormat) { 4, GL_INT_2_10_10_10_REV, GL_TRUE, 4 * sizeof(uint16_t) }
+		: (struct VertexAttribFormat) { 4, GL_BYTE, GL_TRUE, 4 * sizeof(uint16_t) };
+	arena->stride = 4 * sizeof(uint16_t) + sizeof(uint32_t);
+	arena->texcoord = (struct VertexAttribFormat) { 2, GL_UNSIGNED_SHORT, GL_TRUE, 0 };
+	arena->texcoordStride = 2 * sizeof(uint16_t);
+
+	GLuint buffers[3];
+	glGenBuffers(3, buffers);
+	arena->vertexBuffer = buffers[0];
+	arena->texcoordBuffer = buffers[1];
+	arena->indexBuffer = buffers[2];
+	arena->vertices = arena->texcoords = arena->indices = 0;
+	arena->numVertices = arena->vertexCapacity = 0;
+	arena->indexSize = arena->indexCapacity = 0;
+	arena->dirty = 0;
+	arena->numModels = 0;
+}
+
+void geometryArenaDestroy(struct GeometryArena *arena) {
+	GLuint buffers[] = { arena->vertexBuffer, arena->texcoordBuffer, arena->indexBuffer };
+	glDeleteBuffers(3, buffers);
+	free(arena->vertices);
+	free(arena->texcoords);
+	free(arena->indices);
+}
+
+GLint geometryArenaAddVertices(struct GeometryArena *arena, unsigned int count, unsigned char **vertices, unsigned char **texcoords) {
+	if (arena->numVertices + count > arena->vertexCapacity) {
+		unsigned int capacity = arena->vertexCapacity ? arena->vertexCapacity : 4096;
+		while (capacity < arena->numVertices + count) capacity *= 2;
+		unsigned char *newVertices = realloc(arena->vertices, arena->stride * capacity),
+					  *newTexcoords = realloc(arena->texcoords, arena->texcoordStride * capacity);
+		assert(newVertices && newTexcoords && "Failed to reallocate array.");
+		arena->vertices = newVertices;
+		arena->texcoords = newTexcoords;
+		arena->vertexCapacity = capacity;
+	}
+	GLint baseVertex = arena->numVertices;
+	*vertices = arena->vertices + arena->stride * baseVertex;
+	*texcoords = arena->texcoords + arena->texcoordStride * baseVertex;
+	memset(*vertices, 0, arena->stride * count);
+	memset(*texcoords, 0, arena->texcoordStride * count);
+	arena->numVertices += count;
+	arena->dirty = 1;
+	return baseVertex;
+}
+
+unsigned int geometryArenaAddIndices(struct GeometryArena *arena, const void *indices, unsigned int count, GLenum type) {
+	size_t size = indexTypeSize(type);
+	// Align to the index size, so that the position of the first index is whole
+	size_t offset = (arena->indexSize + size - 1) / size * size;
+	if (offset + size * count > arena->indexCapacity) {
+		size_t capacity = arena->indexCapacity ? arena->indexCapacity : 16384;
+		while (capacity < offset + size * count) capacity *= 2;
+		unsigned char *newIndices = realloc(arena->indices, capacity);
+		assert(newIndices && "Failed to reallocate array.");
+		arena->indices = newIndices;
+		arena->indexCapacity = capacity;
+	}
+	memcpy(arena->indices + offset, indices, size * count);
+	arena->indexSize = offset + size * count;
+	arena->dirty = 1;
+	return offset / size;
+}
+
+void geometryArenaUpload(struct GeometryArena *arena) {
+	if (!arena->dirty) return;
+	glBindBuffer(GL_ARRAY_BUFFER, arena->vertexBuffer);
+	glBufferData(GL_ARRAY_BUFFER, arena->stride * arena->numVertices, arena->vertices, GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, arena->texcoordBuffer);
+	glBufferData(GL_ARRAY_BUFFER, arena->texcoordStride * arena->numVertices, arena->texcoords, GL_STATIC_DRAW);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, arena->indexBuffer);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, arena->indexSize, arena->indices, GL_STATIC_DRAW);
+	arena->dirty = 0;
+}
+
+size_t indexTypeSize(GLenum type) {
+	return type == GL_UNSIGNED_SHORT ? sizeof(uint16_t) : sizeof(uint32_t);
+}
@@ -0,0 +1,63 @@
+#ifndef GEOMETRY_ARENA_H
+#define GEOMETRY_ARENA_H
+
+#include <stddef.h>
+#include <GL/glew.h>
+
+/** The layout of an attribute within interleaved vertices. */
+struct VertexAttribFormat {
+	/** The number of components. */
+	GLint size;
+	GLenum type;
+	GLboolean normalized;
+	size_t offset;
+};
+
+/**
+ * One vertex and one index buffer shared by all static meshes, so that drawing different meshes
+ * needs no rebinding of buffers or respecifying of attributes.
+ *
+ * The vertices of all meshes have the same layout, compressed as described by ::loadModelFromObj.
+ * Texture coordinates live in a separate buffer with the same vertex numbering,
+ * since no pass drawing geometry fetches them.
+ * Meshes are appended to a copy in memory, which is uploaded as a whole when it changes; they are never removed.
+ */
+struct GeometryArena {
+	GLuint vertexBuffer, texcoordBuffer, indexBuffer;
+	GLsizei stride, texcoordStride;
+	struct VertexAttribFormat position, normal, texcoord;
+	unsigned char *vertices, *texcoords, *indices;
+	unsigned int numVertices, vertexCapacity;
+	/** The size in bytes of the index data. */
+	size_t indexSize, indexCapacity;
+	/** Whether there is data not yet uploaded. */
+	int dirty;
+	/** The number of models added, which numbers them in the order they were loaded. */
+	unsigned int numModels;
+};
+
+void geometryArenaInit(struct GeometryArena *arena);
+
+void geometryArenaDestroy(struct GeometryArena *arena);
+
+/**
+ * Allocates vertices for a mesh, whose indices are relative to the returned base vertex.
+ * @param vertices Receives where to write the interleaved vertices.
+ * @param texcoords Receives where to write the texture coordinates.
+ */
+GLint geometryArenaAddVertices(struct GeometryArena *arena, unsigned int count, unsigned char **vertices, unsigned char **texcoords);
+
+/**
+ * Appends the indices of a mesh.
+ * @param type GL_UNSIGNED_SHORT or GL_UNSIGNED_INT.
+ * @return The position of the first index, counted in indices of that type from the start of the buffer.
+ */
+unsigned int geometryArenaAddIndices(struct GeometryArena *arena, const void *indices, unsigned int count, GLenum type);
+
+/** Uploads the meshes added since the last upload. */
+void geometryArenaUpload(struct GeometryArena *arena);
+
+/** Returns the size in bytes of an index of the type. */
+size_t indexTypeSize(GLenum type);
+
+#endif
@@ -1,6 +1,7 @@
 #include "glUtil.h"
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <stdarg.h>
 #include <assert.h>
 
@@ -77,6 +78,21 @@ GLuint createShader(GLenum type, int count, ...) {
 	return shader;
 }
 
+/** The names of the attributes given fixed locations, binding names a program lacks being harmless. */
+static const struct {
+	const GLchar *name;
+	GLuint location;
+} attribBindings[] = {
+	{ "position", ATTRIB_POSITION },
+	{ "normal", ATTRIB_NORMAL },
+	{ "model", ATTRIB_MODEL },
+	{ "positionScale", ATTRIB_POSITION_SCALE },
+	{ "positionBias", ATTRIB_POSITION_BIAS },
+	{ "vertex", ATTRIB_VERTEX },
+	{ "tex_coord", ATTRIB_TEX_COORD },
+	{ "color", ATTRIB_COLOR }
+};
+
 GLuint createProgram(int count, ...) {
 	GLuint program = glCreateProgram();
 	if (!program) {
@@ -92,6 +108,9 @@ GLuint createProgram(int count, ...) {
 		glAttachShader(program, shader);
 	}
 	va_end(args);
+	for (size_t i = 0; i < sizeof attribBindings / sizeof *attribBindings; ++i) {
+		glBindAttribLocation(program, attribBindings[i].location, attribBindings[i].name);
+	}
 
 	glLinkProgram(program); // Link the program
 
@@ -126,6 +145,300 @@ GLuint createProgramVertFrag(const GLchar *vertexShaderSource, const GLchar *fra
 			createShader(GL_FRAGMENT_SHADER, 1, fragmentShaderSource), 0);
 }
 
+/** Returns the size in bytes of one element of a uniform of the specified type. */
+static size_t uniformTypeSize(GLenum type) {
+	switch (type) {
+		case GL_FLOAT: case GL_INT: case GL_BOOL: case GL_SAMPLER_2D: case GL_SAMPLER_CUBE: return 4;
+		case GL_FLOAT_VEC2: case GL_INT_VEC2: case GL_BOOL_VEC2: return 8;
+		case GL_FLOAT_VEC3: case GL_INT_VEC3: case GL_BOOL_VEC3: return 12;
+		case GL_FLOAT_VEC4: case GL_INT_VEC4: case GL_BOOL_VEC4: case GL_FLOAT_MAT2: return 16;
+		case GL_FLOAT_MAT3: return 36;
+		case GL_FLOAT_MAT4: return 64;
+		default: return 64; // Large enough for any other type
+	}
+}
+
+/** Copies the name into the table, cutting off the subscript that arrays are reported with. */
+static void copyShaderName(char *dest, const GLchar *name) {
+	size_t length = strcspn(name, "[");
+	assert(length < MAX_SHADER_NAME_LENGTH && "Shader variable name is too long.");
+	memcpy(dest, name, length);
+	dest[length] = '\0';
+}
+
+int shaderProgramInit(struct ShaderProgram *program, GLuint id) {
+	program->id = id;
+	program->numUniforms = program->numAttribs = 0;
+	program->uniforms = 0;
+	program->attribs = 0;
+	program->values = 0;
+	program->numBlocks = 0;
+	if (!id) return 1;
+
+	GLint numUniforms, numAttribs, maxLength, maxAttribLength;
+	glGetProgramiv(id, GL_ACTIVE_UNIFORMS, &numUniforms);
+	glGetProgramiv(id, GL_ACTIVE_ATTRIBUTES, &numAttribs);
+	glGetProgramiv(id, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+	glGetProgramiv(id, GL_ACTIVE_ATTRIBUTE_MAX_LENGTH, &maxAttribLength);
+	if (maxAttribLength > maxLength) maxLength = maxAttribLength;
+	GLchar name[maxLength + 1];
+	program->uniforms = malloc(sizeof *program->uniforms * (numUniforms + 1));
+	program->attribs = malloc(sizeof *program->attribs * (numAttribs + 1));
+	assert(program->uniforms && program->attribs && "Failed to allocate memory.");
+
+	size_t valuesSize = 0;
+	for (GLint i = 0; i < numUniforms; ++i) {
+		struct ShaderUniform *uniform = program->uniforms + program->numUniforms;
+		glGetActiveUniform(id, i, maxLength + 1, NULL, &uniform->size, &uniform->type, name);
+		// Skip built-in uniforms, which have no location
+		if ((uniform->location = glGetUniformLocation(id, name)) == -1) continue;
+		copyShaderName(uniform->name, name);
+		uniform->hasValue = 0;
+		valuesSize += uniformTypeSize(uniform->type) * uniform->size;
+		++program->numUniforms;
+	}
+	// Point each uniform at its slot of the value storage
+	program->values = malloc(valuesSize + 1);
+	assert(program->values && "Failed to allocate memory.");
+	size_t offset = 0;
+	for (int i = 0; i < program->numUniforms; ++i) {
+		struct ShaderUniform *uniform = program->uniforms + i;
+		uniform->value = program->values + offset;
+		offset += uniformTypeSize(uniform->type) * uniform->size;
+	}
+
+	for (GLint i = 0; i < numAttribs; ++i) {
+		struct ShaderAttrib *attrib = program->attribs + program->numAttribs;
+		glGetActiveAttrib(id, i, maxLength + 1, NULL, &attrib->size, &attrib->type, name);
+		if ((attrib->location = glGetAttribLocation(id, name)) == -1) continue;
+		copyShaderName(attrib->name, name);
+		++program->numAttribs;
+	}
+	return 0;
+}
+
+void shaderProgramDestroy(struct ShaderProgram *program) {
+	glDeleteProgram(program->id);
+	free(program->uniforms);
+	free(program->attribs);
+	free(program->values);
+	for (int i = 0; i < program->numBlocks; ++i) free(program->blocks[i].members);
+}
+
+struct ShaderUniform *shaderProgramUniform(struct ShaderProgram *program, const char *name) {
+	for (int i = 0; i < program->numUniforms; ++i) {
+		if (strcmp(program->uniforms[i].name, name) == 0) return program->uniforms + i;
+	}
+	return 0;
+}
+
+GLint shaderProgramAttrib(const struct ShaderProgram *program, const char *name) {
+	for (int i = 0; i < program->numAttribs; ++i) {
+		if (strcmp(program->attribs[i].name, name) == 0) return program->attribs[i].location;
+	}
+	return -1;
+}
+
+/**
+ * Stores the value in the cache of the uniform.
+ * Returns zero if the uniform is null or already has the value, in which case nothing needs to be uploaded.
+ */
+static int shaderUniformUpdate(struct ShaderUniform *uniform, GLenum type, GLsizei count, const void *values) {
+	if (!uniform) return 0;
+	assert((uniform->type == type
+				|| (type == GL_INT && (uniform->type == GL_SAMPLER_2D || uniform->type == GL_SAMPLER_CUBE || uniform->type == GL_BOOL)))
+			&& "Uniform set with the wrong type.");
+	assert(count <= uniform->size && "Too many values for the uniform.");
+	size_t size = uniformTypeSize(uniform->type) * count;
+	if (uniform->hasValue && memcmp(uniform->value, values, size) == 0) return 0;
+	memcpy(uniform->value, values, size);
+	// Only the whole array is known if it was all set
+	uniform->hasValue = count == uniform->size;
+	return 1;
+}
+
+void shaderUniform1i(struct ShaderUniform *uniform, GLint value) {
+	if (shaderUniformUpdate(uniform, GL_INT, 1, &value)) glUniform1i(uniform->location, value);
+}
+
+void shaderUniform1iv(struct ShaderUniform *uniform, GLsizei count, const GLint *values) {
+	if (shaderUniformUpdate(uniform, GL_INT, count, values)) glUniform1iv(uniform->location, count, values);
+}
+
+void shaderUniform1f(struct ShaderUniform *uniform, GLfloat value) {
+	if (shaderUniformUpdate(uniform, GL_FLOAT, 1, &value)) glUniform1f(uniform->location, value);
+}
+
+void shaderUniform1fv(struct ShaderUniform *uniform, GLsizei count, const GLfloat *values) {
+	if (shaderUniformUpdate(uniform, GL_FLOAT, count, values)) glUniform1fv(uniform->location, count, values);
+}
+
+void shaderUniform2f(struct ShaderUniform *uniform, GLfloat x, GLfloat y) {
+	const GLfloat values[] = { x, y };
+	if (shaderUniformUpdate(uniform, GL_FLOAT_VEC2, 1, values)) glUniform2fv(uniform->location, 1, values);
+}
+
+void shaderUniform3fv(struct ShaderUniform *uniform, GLsizei count, const GLfloat *values) {
+	if (shaderUniformUpdate(uniform, GL_FLOAT_VEC3, count, values)) glUniform3fv(uniform->location, count, values);
+}
+
+void shaderUniform4fv(struct ShaderUniform *uniform, GLsizei count, const GLfloat *values) {
+	if (shaderUniformUpdate(uniform, GL_FLOAT_VEC4, count, values)) glUniform4fv(uniform->location, count, values);
+}
+
+void shaderUniformMatrix4fv(struct ShaderUniform *uniform, GLsizei count, const GLfloat *values) {
+	if (shaderUniformUpdate(uniform, GL_FLOAT_MAT4, count, values)) glUniformMatrix4fv(uniform->location, count, GL_FALSE, values);
+}
+
+/** Uploads values of any type through the cache of the uniform. */
+static void shaderUniformSet(struct ShaderUniform *uniform, GLenum type, GLsizei count, const void *values) {
+	switch (type) {
+		case GL_INT: shaderUniform1iv(uniform, count, values); break;
+		case GL_FLOAT: shaderUniform1fv(uniform, count, values); break;
+		case GL_FLOAT_VEC2:
+			if (shaderUniformUpdate(uniform, type, count, values)) glUniform2fv(uniform->location, count, values);
+			break;
+		case GL_FLOAT_VEC3: shaderUniform3fv(uniform, count, values); break;
+		case GL_FLOAT_VEC4: shaderUniform4fv(uniform, count, values); break;
+		case GL_FLOAT_MAT4: shaderUniformMatrix4fv(uniform, count, values); break;
+		default: assert(0 && "Unsupported uniform block member type.");
+	}
+}
+
+void uniformBlockInit(struct UniformBlock *block, const char *name, GLuint binding,
+		const struct UniformBlockMember *members, int numMembers, size_t size, int buffered) {
+	block->name = name;
+	block->binding = binding;
+	block->members = members;
+	block->numMembers = numMembers;
+	block->size = size;
+	block->data = calloc(1, size);
+	assert(block->data && "Failed to allocate memory.");
+	block->buffer = 0;
+	if (buffered) {
+		glGenBuffers(1, &block->buffer);
+		glBindBuffer(GL_UNIFORM_BUFFER, block->buffer);
+		glBufferData(GL_UNIFORM_BUFFER, size, block->data, GL_DYNAMIC_DRAW);
+		// The binding point is context state, so binding once serves all programs
+		glBindBufferBase(GL_UNIFORM_BUFFER, binding, block->buffer);
+	}
+}
+
+void uniformBlockDestroy(struct UniformBlock *block) {
+	if (block->buffer) glDeleteBuffers(1, &block->buffer);
+	free(block->data);
+}
+
+void uniformBlockUpdate(struct UniformBlock *block, const void *data) {
+	if (memcmp(block->data, data, block->size) == 0) return;
+	memcpy(block->data, data, block->size);
+	if (block->buffer) {
+		glBindBuffer(GL_UNIFORM_BUFFER, block->buffer);
+		glBufferSubData(GL_UNIFORM_BUFFER, 0, block->size, block->data);
+	}
+}
+
+void shaderProgramBindBlock(struct ShaderProgram *program, const struct UniformBlock *block) {
+	if (block->buffer) {
+		GLuint index = glGetUniformBlockIndex(program->id, block->name);
+		if (index != GL_INVALID_INDEX) glUniformBlockBinding(program->id, index, block->binding);
+		return;
+	}
+	// Resolve the members now, so that applying the block does not search the uniforms by name
+	assert(program->numBlocks < MAX_PROGRAM_BLOCKS && "Too many uniform blocks bound to program.");
+	struct ShaderBlockUniforms *uniforms = program->blocks + program->numBlocks++;
+	uniforms->block = block;
+	uniforms->members = malloc(sizeof *uniforms->members * (block->numMembers + 1));
+	assert(uniforms->members && "Failed to allocate memory.");
+	for (int i = 0; i < block->numMembers; ++i) uniforms->members[i] = shaderProgramUniform(program, block->members[i].name);
+}
+
+void shaderProgramApplyBlock(struct ShaderProgram *program, const struct UniformBlock *block) {
+	if (block->buffer) return;
+	struct ShaderBlockUniforms *uniforms = program->blocks;
+	while (uniforms < program->blocks + program->numBlocks && uniforms->block != block) ++uniforms;
+	assert(uniforms < program->blocks + program->numBlocks && "Uniform block not bound to program.");
+	for (int i = 0; i < block->numMembers; ++i) {
+		const struct UniformBlockMember *member = block->members + i;
+		struct ShaderUniform *uniform = uniforms->members[i];
+		if (!uniform) continue;
+		const unsigned char *values = (const unsigned char *) block->data + member->offset;
+		// std140 pads array elements to 16 bytes, while glUniform expects them packed
+		size_t size = uniformTypeSize(member->type), stride = (size + 15) & ~(size_t) 15;
+		if (member->count > 1 && stride != size) {
+			unsigned char packed[size * member->count];
+			for (GLsizei j = 0; j < member->count; ++j) memcpy(packed + size * j, values + stride * j, size);
+			shaderUniformSet(uniform, member->type, member->count, packed);
+		} else {
+			shaderUniformSet(uniform, member->type, member->count, values);
+		}
+	}
+}
+
+static int isVertexArraySupported() {
+#ifdef __EMSCRIPTEN__
+	return 0; // WebGL 1 only has them as an extension
+#else
+	return GLEW_VERSION_3_0 || GLEW_ARB_vertex_array_object;
+#endif
+}
+
+static void specifyAttrib(const struct VertexArrayAttrib *attrib) {
+	glBindBuffer(GL_ARRAY_BUFFER, attrib->buffer);
+	glEnableVertexAttribArray(attrib->index);
+	glVertexAttribPointer(attrib->index, attrib->size, attrib->type, attrib->normalized, attrib->stride, BUFFER_OFFSET(attrib->offset));
+	// The divisor needs instancing, so leave it alone for attributes without one
+	if (attrib->divisor) glVertexAttribDivisor(attrib->index, attrib->divisor);
+}
+
+void vertexArrayInit(struct VertexArray *array, GLuint elementBuffer) {
+	array->id = 0;
+	array->elementBuffer = elementBuffer;
+	array->numAttribs = 0;
+	if (isVertexArraySupported()) {
+		glGenVertexArrays(1, &array->id);
+		glBindVertexArray(array->id);
+	}
+	// Recorded by the object, or bound again whenever the array is
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementBuffer);
+}
+
+void vertexArrayDestroy(struct VertexArray *array) {
+	if (array->id) glDeleteVertexArrays(1, &array->id);
+}
+
+void vertexArrayAttrib(struct VertexArray *array, GLuint index, GLuint buffer, GLint size, GLenum type,
+		GLboolean normalized, GLsizei stride, size_t offset, GLuint divisor) {
+	int i = 0;
+	while (i < array->numAttribs && array->attribs[i].index != index) ++i;
+	if (i == array->numAttribs) {
+		assert(array->numAttribs < MAX_VERTEX_ARRAY_ATTRIBS && "Too many attributes in vertex array.");
+		++array->numAttribs;
+	}
+	array->attribs[i] = (struct VertexArrayAttrib) { index, buffer, size, type, normalized, stride, offset, divisor };
+	specifyAttrib(array->attribs + i);
+}
+
+void vertexArrayBind(const struct VertexArray *array) {
+	if (array->id) {
+		glBindVertexArray(array->id);
+		return;
+	}
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, array->elementBuffer);
+	for (int i = 0; i < array->numAttribs; ++i) specifyAttrib(array->attribs + i);
+}
+
+void vertexArrayUnbind(const struct VertexArray *array) {
+	if (array->id) {
+		glBindVertexArray(0);
+		return;
+	}
+	for (int i = 0; i < array->numAttribs; ++i) {
+		if (array->attribs[i].divisor) glVertexAttribDivisor(array->attribs[i].index, 0);
+		glDisableVertexAttribArray(array->attribs[i].index);
+	}
+}
+
 float randomFloat() {
 	return (float) rand() / RAND_MAX;
 }
@@ -136,36 +449,6 @@ float cubicBezier(float p0, float p1, float p2, float p3, float t) {
 	return s * s * s * p0 + 3 * s * s * t * p1 + 3 * s * t * t * p2 + t * t * t * p3;
 }
 
-/**
- * Returns whether the spheres are colliding.
- * @param movevec The relative velocity vector.
- */
-int isSphereCollision(VECTOR pos0, VECTOR pos1, float radius0, float radius1, VECTOR movevec) {
-	// The vector from the center of the moving sphere to the center of the stationary
-	VECTOR c = VectorSubtract(pos1, pos0);
-	float radiiSum = radius0 + radius1;
-
-	// Early escape test
-	if (Vector3Length(movevec) < Vector3Length(c) - radiiSum) return 0;
-
-	// Normalize movevec; check for zero vector
-	VECTOR n = (VectorEqual(movevec, VectorReplicate(0.0f)) & 0x7) == 0x7 ? movevec : Vector4Normalize(movevec);
-	float d = Vector3Dot(n, c);
-	// Make sure the spheres are moving towards each other
-	if (d < 0) return 0;
-
-	float f = Vector3Dot(c, c) - d * d;
-	float radiiSumSquared = radiiSum * radiiSum;
-	if (f >= radiiSumSquared) return 0;
-
-	float t = radiiSumSquared - f;
-	if (t < 0) return 0;
-
-	float distance = d - sqrt(t);
-	float mag = Vector3Length(movevec);
-	return mag >= distance;
-}
-
 void printVector(VECTOR v) {
 	ALIGN(16) float vv[4];
 	VectorGet(vv, v);
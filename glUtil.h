@@ -28,9 +28,29 @@ float lerp(float a, float b, float f);
  */
 GLuint createShader(GLenum type, int count, ...);
 
+/**
+ * The locations ::createProgram binds attributes to by name before linking,
+ * so that a vertex array specified once works with every program reading it.
+ * Names of different groups share locations, as no program declares attributes of two groups.
+ */
+enum AttribLocation {
+	// Models and fullscreen quads
+	ATTRIB_POSITION = 0,
+	ATTRIB_NORMAL = 1,
+	/** The model matrix of instances, taking one location per column. */
+	ATTRIB_MODEL = 2,
+	ATTRIB_POSITION_SCALE = 6,
+	ATTRIB_POSITION_BIAS = 7,
+	// Sprites
+	ATTRIB_VERTEX = 0,
+	ATTRIB_TEX_COORD = 1,
+	ATTRIB_COLOR = 2
+};
+
 /**
  * Creates and links a program.
  * Takes in pairs of shader objects and unsigned shader flags.
+ * Attributes are bound to the locations of ::AttribLocation.
  */
 GLuint createProgram(int count, ...);
 
@@ -39,6 +59,183 @@ GLuint createProgram(int count, ...);
  */
 GLuint createProgramVertFrag(const GLchar *vertexShaderSource, const GLchar *fragmentShaderSource);
 
+/** The maximum length of uniform and attribute names, including the terminator. */
+#define MAX_SHADER_NAME_LENGTH 64
+
+/**
+ * An active uniform of a program, reflected when the program is linked.
+ * Serves as a typed handle that remembers the last uploaded value.
+ */
+struct ShaderUniform {
+	/** The name, without the subscript of arrays. */
+	char name[MAX_SHADER_NAME_LENGTH];
+	GLint location;
+	GLenum type;
+	/** The number of array elements, or one. */
+	GLint size;
+	/** The value last uploaded through the handle, valid if \c hasValue is set. */
+	void *value;
+	int hasValue;
+};
+
+/** An active attribute of a program. */
+struct ShaderAttrib {
+	char name[MAX_SHADER_NAME_LENGTH];
+	GLint location;
+	GLenum type;
+	GLint size;
+};
+
+#define MAX_PROGRAM_BLOCKS 4
+
+struct UniformBlock;
+
+/** The uniforms of a program that the members of an unbuffered block are set through. */
+struct ShaderBlockUniforms {
+	const struct UniformBlock *block;
+	/** The handle of each member, or null if the program does not use it. */
+	struct ShaderUniform **members;
+};
+
+/** A linked program along with tables of its active uniforms and attributes. */
+struct ShaderProgram {
+	GLuint id;
+	int numUniforms, numAttribs;
+	struct ShaderUniform *uniforms;
+	struct ShaderAttrib *attribs;
+	/** Storage for the cached values of all uniforms. */
+	unsigned char *values;
+	struct ShaderBlockUniforms blocks[MAX_PROGRAM_BLOCKS];
+	int numBlocks;
+};
+
+/**
+ * Reflects the active uniforms and attributes of a linked program, taking ownership of it.
+ * @param id The program object, or zero if creating it failed.
+ * @return Zero on success.
+ */
+int shaderProgramInit(struct ShaderProgram *program, GLuint id);
+
+/** Deletes the program object and frees the tables. */
+void shaderProgramDestroy(struct ShaderProgram *program);
+
+/**
+ * Returns the handle of the active uniform with the specified name,
+ * or null if there is none, for which the setters do nothing.
+ */
+struct ShaderUniform *shaderProgramUniform(struct ShaderProgram *program, const char *name);
+
+/** Returns the location of the active attribute with the specified name, or -1 if there is none. */
+GLint shaderProgramAttrib(const struct ShaderProgram *program, const char *name);
+
+/*
+ * Typed setters of uniform values, which skip the upload if the value is unchanged.
+ * The program of the uniform has to be in use.
+ */
+void shaderUniform1i(struct ShaderUniform *uniform, GLint value);
+void shaderUniform1iv(struct ShaderUniform *uniform, GLsizei count, const GLint *values);
+void shaderUniform1f(struct ShaderUniform *uniform, GLfloat value);
+void shaderUniform1fv(struct ShaderUniform *uniform, GLsizei count, const GLfloat *values);
+void shaderUniform2f(struct ShaderUniform *uniform, GLfloat x, GLfloat y);
+void shaderUniform3fv(struct ShaderUniform *uniform, GLsizei count, const GLfloat *values);
+void shaderUniform4fv(struct ShaderUniform *uniform, GLsizei count, const GLfloat *values);
+void shaderUniformMatrix4fv(struct ShaderUniform *uniform, GLsizei count, const GLfloat *values);
+
+/** A member of a uniform block, for setting it as a plain uniform where blocks are unsupported. */
+struct UniformBlockMember {
+	const char *name;
+	GLenum type;
+	/** The number of array elements, or one. */
+	GLsizei count;
+	/** The offset in the std140 layout of the block. */
+	size_t offset;
+};
+
+/**
+ * A block of uniforms in std140 layout shared by several programs.
+ * When uniform buffer objects are supported it is backed by a buffer bound to a fixed binding point,
+ * so updating it once reaches every program. Otherwise the members are plain uniforms of each program.
+ */
+struct UniformBlock {
+	const char *name;
+	GLuint binding, buffer;
+	const struct UniformBlockMember *members;
+	int numMembers;
+	size_t size;
+	/** The current contents in std140 layout. */
+	void *data;
+};
+
+/**
+ * @param buffered Whether to back the block with a uniform buffer object.
+ */
+void uniformBlockInit(struct UniformBlock *block, const char *name, GLuint binding,
+		const struct UniformBlockMember *members, int numMembers, size_t size, int buffered);
+
+void uniformBlockDestroy(struct UniformBlock *block);
+
+/** Replaces the contents of the block, uploading them to the buffer if they changed. */
+void uniformBlockUpdate(struct UniformBlock *block, const void *data);
+
+/**
+ * Points the block of that name in the program at the binding point of the block,
+ * or looks up the uniforms of its members if it is not backed by a buffer. Call once after linking.
+ */
+void shaderProgramBindBlock(struct ShaderProgram *program, const struct UniformBlock *block);
+
+/**
+ * Sets the members of the block as uniforms of the program in use, if the block is not backed by a buffer.
+ * Unchanged members are skipped. The block has to have been bound to the program.
+ */
+void shaderProgramApplyBlock(struct ShaderProgram *program, const struct UniformBlock *block);
+
+#define MAX_VERTEX_ARRAY_ATTRIBS 8
+
+/** Where an attribute of a vertex array fetches its data. */
+struct VertexArrayAttrib {
+	GLuint index, buffer;
+	GLint size;
+	GLenum type;
+	GLboolean normalized;
+	GLsizei stride;
+	size_t offset;
+	/** The attribute advances once per this many instances, or per vertex if zero. */
+	GLuint divisor;
+};
+
+/**
+ * The attribute and element buffer state of a kind of draw, specified once when it is created.
+ * Backed by a vertex array object where supported. Otherwise the state is recorded,
+ * and specified on the context whenever the array is bound.
+ */
+struct VertexArray {
+	/** The vertex array object, or zero if unsupported. */
+	GLuint id;
+	GLuint elementBuffer;
+	struct VertexArrayAttrib attribs[MAX_VERTEX_ARRAY_ATTRIBS];
+	int numAttribs;
+};
+
+/**
+ * Creates a vertex array without attributes and binds it.
+ * @param elementBuffer The buffer indices are read from, or zero.
+ */
+void vertexArrayInit(struct VertexArray *array, GLuint elementBuffer);
+
+void vertexArrayDestroy(struct VertexArray *array);
+
+/**
+ * Enables an attribute and points it at data in a buffer, replacing its previous source.
+ * The array has to be bound. Leaves the buffer bound to GL_ARRAY_BUFFER.
+ */
+void vertexArrayAttrib(struct VertexArray *array, GLuint index, GLuint buffer, GLint size, GLenum type,
+		GLboolean normalized, GLsizei stride, size_t offset, GLuint divisor);
+
+void vertexArrayBind(const struct VertexArray *array);
+
+/** Unbinds the array, which disables its attributes again if it is not backed by an object. */
+void vertexArrayUnbind(const struct VertexArray *array);
+
 /**
  * Returns a random float between 0 and 1.
  */
@@ -46,8 +243,6 @@ float randomFloat();
 
 float cubicBezier(float p0, float p1, float p2, float p3, float t);
 
-int isSphereCollision(VECTOR pos0, VECTOR pos1, float radius0, float radius1, VECTOR movevec);
-
 void printVector(VECTOR v);
 
 void printMatrix(MATRIX m);
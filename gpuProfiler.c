@@ -0,0 +1,227 @@
+#include "gpuProfiler.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+/** The width lines of the overlay are laid out in, wide enough that they never break. */
+#define OVERLAY_LINE_WIDTH 1024
+/** The number of frames between refreshes of the overlay text. */
+#define OVERLAY_REFRESH_FRAMES 30
+
+static int isTimerQuerySupported() {
+#ifdef __EMSCRIPTEN__
+	return 0; // WebGL 1 only has timer queries through an extension that browsers disable
+#else
+	return GLEW_VERSION_3_3 || GLEW_ARB_timer_query;
+#endif
+}
+
+void gpuProfilerInit(struct GpuProfiler *profiler) {
+	profiler->supported = isTimerQuerySupported();
+	for (int i = 0; i < GPU_PROFILER_FRAMES; ++i) {
+		struct GpuProfilerFrame *frame = profiler->frames + i;
+		if (profiler->supported) glGenQueries(GPU_PROFILER_MAX_SCOPES, frame->queries);
+		frame->numQueries = 0;
+		frame->pending = 0;
+	}
+	profiler->frameIndex = 0;
+	profiler->activeScope = -1;
+	profiler->numScopes = 0;
+	profiler->total = (struct GpuProfilerScope) { "total" };
+	profiler->droppedFrames = 0;
+	profiler->skippedScopes = 0;
+	profiler->frameTotals = 0;
+	profiler->firstTotalFrame = 0;
+	profiler->numFrameTotals = 0;
+}
+
+void gpuProfilerDestroy(struct GpuProfiler *profiler) {
+	if (!profiler->supported) return;
+	for (int i = 0; i < GPU_PROFILER_FRAMES; ++i) glDeleteQueries(GPU_PROFILER_MAX_SCOPES, profiler->frames[i].queries);
+}
+
+static void addSample(struct GpuProfilerScope *scope, float milliseconds) {
+	scope->samples[scope->nextSample] = milliseconds;
+	scope->nextSample = (scope->nextSample + 1) % GPU_PROFILER_HISTORY;
+	if (scope->numSamples < GPU_PROFILER_HISTORY) ++scope->numSamples;
+}
+
+/** Reads the results of a frame if they are all available, returning whether they were. */
+static int collectFrame(struct GpuProfiler *profiler, struct GpuProfilerFrame *frame) {
+	// Queries finish in order, so the last one being available means all are
+	GLuint available = 1;
+	if (frame->numQueries) glGetQueryObjectuiv(frame->queries[frame->numQueries - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+	if (!available) return 0;
+
+	float total = 0.0f;
+	for (int i = 0; i < frame->numQueries; ++i) {
+		GLuint64 elapsed;
+		glGetQueryObjectui64v(frame->queries[i], GL_QUERY_RESULT, &elapsed);
+		float milliseconds = elapsed / 1e6f;
+		addSample(profiler->scopes + frame->scopes[i], milliseconds);
+		total += milliseconds;
+	}
+	if (frame->numQueries) addSample(&profiler->total, total);
+	unsigned int totalIndex = frame->number - profiler->firstTotalFrame;
+	if (profiler->frameTotals && totalIndex < (unsigned int) profiler->numFrameTotals) profiler->frameTotals[totalIndex] = total;
+	frame->pending = 0;
+	return 1;
+}
+
+void gpuProfilerBeginFrame(struct GpuProfiler *profiler) {
+	if (!profiler->supported) return;
+	// Visit the frames oldest first, so that samples are added in order
+	for (int i = 0; i < GPU_PROFILER_FRAMES; ++i) {
+		struct GpuProfilerFrame *frame = profiler->frames + (profiler->frameIndex + i) % GPU_PROFILER_FRAMES;
+		if (frame->pending && !collectFrame(profiler, frame)) break;
+	}
+
+	struct GpuProfilerFrame *frame = profiler->frames + profiler->frameIndex % GPU_PROFILER_FRAMES;
+	if (frame->pending) {
+		// Rather than waiting for the GPU, reuse the queries and lose their results
+		++profiler->droppedFrames;
+		frame->pending = 0;
+	}
+	frame->numQueries = 0;
+	frame->number = profiler->frameIndex;
+}
+
+void gpuProfilerEndFrame(struct GpuProfiler *profiler) {
+	if (!profiler->supported) return;
+	assert(profiler->activeScope == -1 && "GPU profiler scope not ended.");
+	profiler->frames[profiler->frameIndex++ % GPU_PROFILER_FRAMES].pending = 1;
+}
+
+static int findScope(struct GpuProfiler *profiler, const char *name) {
+	for (int i = 0; i < profiler->numScopes; ++i) {
+		if (profiler->scopes[i].name == name || strcmp(profiler->scopes[i].name, name) == 0) return i;
+	}
+	if (profiler->numScopes == GPU_PROFILER_MAX_SCOPES) return -1;
+	profiler->scopes[profiler->numScopes] = (struct GpuProfilerScope) { name };
+	return profiler->numScopes++;
+}
+
+void gpuProfilerBegin(struct GpuProfiler *profiler, const char *name) {
+	if (!profiler || !profiler->supported) return;
+	assert(profiler->activeScope == -1 && "GPU profiler scopes cannot be nested.");
+	struct GpuProfilerFrame *frame = profiler->frames + profiler->frameIndex % GPU_PROFILER_FRAMES;
+	int scope = findScope(profiler, name);
+	if (scope == -1 || frame->numQueries == GPU_PROFILER_MAX_SCOPES) {
+		if (profiler->skippedScopes++ == 0) fprintf(stderr, "Too many GPU profiler scopes, not timing %s or later ones.\n", name);
+		return;
+	}
+	frame->scopes[frame->numQueries] = scope;
+	glBeginQuery(GL_TIME_ELAPSED, frame->queries[frame->numQueries]);
+	profiler->activeScope = scope;
+}
+
+void gpuProfilerEnd(struct GpuProfiler *profiler) {
+	if (!profiler || profiler->activeScope == -1) return;
+	glEndQuery(GL_TIME_ELAPSED);
+	++profiler->frames[profiler->frameIndex % GPU_PROFILER_FRAMES].numQueries;
+	profiler->activeScope = -1;
+}
+
+void gpuProfilerRecordTotals(struct GpuProfiler *profiler, float *totals, int count) {
+	for (int i = 0; i < count; ++i) totals[i] = -1.0f;
+	profiler->frameTotals = totals;
+	profiler->firstTotalFrame = profiler->frameIndex;
+	profiler->numFrameTotals = count;
+}
+
+static int compareFloats(const void *a, const void *b) {
+	float x = *(const float *) a, y = *(const float *) b;
+	return (x > y) - (x < y);
+}
+
+void gpuProfilerComputeStats(float *sorted, int n, struct GpuProfilerStats *stats) {
+	stats->numSamples = n;
+	if (n == 0) {
+		stats->average = stats->median = stats->p95 = stats->p99 = stats->max = 0.0f;
+		return;
+	}
+	float sum = 0.0f;
+	qsort(sorted, n, sizeof *sorted, compareFloats);
+	for (int i = 0; i < n; ++i) sum += sorted[i];
+	// Nearest-rank percentiles
+	stats->average = sum / n;
+	stats->median = sorted[(n - 1) / 2];
+	stats->p95 = sorted[(95 * n + 99) / 100 - 1];
+	stats->p99 = sorted[(99 * n + 99) / 100 - 1];
+	stats->max = sorted[n - 1];
+}
+
+void gpuProfilerGetStats(const struct GpuProfilerScope *scope, struct GpuProfilerStats *stats) {
+	float samples[GPU_PROFILER_HISTORY];
+	memcpy(samples, scope->samples, sizeof *samples * scope->numSamples);
+	gpuProfilerComputeStats(samples, scope->numSamples, stats);
+}
+
+static void writeScope(FILE *file, const struct GpuProfilerScope *scope) {
+	struct GpuProfilerStats stats;
+	gpuProfilerGetStats(scope, &stats);
+	fprintf(file, "%s,%d,%.4f,%.4f,%.4f,%.4f,%.4f\n", scope->name, stats.numSamples,
+			stats.average, stats.median, stats.p95, stats.p99, stats.max);
+}
+
+int gpuProfilerWriteCsv(const struct GpuProfiler *profiler, const char *filename) {
+	FILE *file = fopen(filename, "w");
+	if (!file) {
+		fprintf(stderr, "Failed to open %s for writing.\n", filename);
+		return -1;
+	}
+	fprintf(file, "pass,samples,average_ms,median_ms,p95_ms,p99_ms,max_ms\n");
+	for (int i = 0; i < profiler->numScopes; ++i) writeScope(file, profiler->scopes + i);
+	writeScope(file, &profiler->total);
+	return fclose(file) == 0 ? 0 : -1;
+}
+
+void gpuProfilerOverlayInit(struct GpuProfilerOverlay *overlay, struct Font *font) {
+	overlay->font = font;
+	for (int i = 0; i < GPU_PROFILER_MAX_SCOPES + 2; ++i) {
+		layoutInit(overlay->lines + i, font);
+		layoutSetWidth(overlay->lines + i, OVERLAY_LINE_WIDTH);
+	}
+	overlay->numLines = 0;
+	overlay->refreshCountdown = 0;
+}
+
+void gpuProfilerOverlayDestroy(struct GpuProfilerOverlay *overlay) {
+	for (int i = 0; i < GPU_PROFILER_MAX_SCOPES + 2; ++i) layoutDestroy(overlay->lines + i);
+}
+
+static void formatScope(char *text, size_t size, const struct GpuProfilerScope *scope) {
+	struct GpuProfilerStats stats;
+	gpuProfilerGetStats(scope, &stats);
+	snprintf(text, size, "%s: %.2f / %.2f / %.2f", scope->name, stats.average, stats.p95, stats.p99);
+}
+
+static void refreshOverlay(struct GpuProfilerOverlay *overlay, const struct GpuProfiler *profiler) {
+	const size_t size = sizeof overlay->text[0];
+	int n = 0;
+	if (!profiler->supported) {
+		snprintf(overlay->text[n++], size, "GPU timer queries unsupported");
+	} else {
+		snprintf(overlay->text[n++], size, "GPU ms, average / p95 / p99 (%u frames dropped)", profiler->droppedFrames);
+		for (int i = 0; i < profiler->numScopes; ++i) formatScope(overlay->text[n++], size, profiler->scopes + i);
+		formatScope(overlay->text[n++], size, &profiler->total);
+	}
+	for (int i = 0; i < n; ++i) {
+		layoutSetText(overlay->lines + i, overlay->text[i], -1);
+		layoutLayout(overlay->lines + i);
+	}
+	overlay->numLines = n;
+}
+
+void gpuProfilerOverlayDraw(struct GpuProfilerOverlay *overlay, const struct GpuProfiler *profiler,
+		struct SpriteBatch *batch, float x, float y) {
+	if (overlay->refreshCountdown-- <= 0) {
+		refreshOverlay(overlay, profiler);
+		overlay->refreshCountdown = OVERLAY_REFRESH_FRAMES;
+	}
+	const int lineSpacing = overlay->font->lineSpacing;
+	struct Color background = { 0.0f, 0.0f, 0.0f, 0.6f };
+	spriteBatchDrawColor(batch, background, x, y, 420, overlay->numLines * lineSpacing);
+	for (int i = 0; i < overlay->numLines; ++i) spriteBatchDrawLayout(batch, overlay->lines + i, white, x, y + i * lineSpacing);
+}
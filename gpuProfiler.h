@@ -0,0 +1,127 @@
+#ifndef GPU_PROFILER_H
+#define GPU_PROFILER_H
+
+#include <GL/glew.h>
+#include "font.h"
+#include "spriteBatch.h"
+#include "linebreak.h"
+
+#define GPU_PROFILER_MAX_SCOPES 32
+/**
+ * The number of frames of queries in flight.
+ * Results are read once this many frames later, by when the GPU has normally finished them.
+ */
+#define GPU_PROFILER_FRAMES 3
+/** The number of frames the statistics of each scope are computed over. */
+#define GPU_PROFILER_HISTORY 128
+
+/** The timings of a scope in milliseconds over the recent frames it ran in. */
+struct GpuProfilerStats {
+	int numSamples;
+	float average, median, p95, p99, max;
+};
+
+/** A named span of GPU work, with the times it took in recent frames. */
+struct GpuProfilerScope {
+	const char *name;
+	/** Ring of the last times in milliseconds. */
+	float samples[GPU_PROFILER_HISTORY];
+	int numSamples, nextSample;
+};
+
+/** The queries issued during one frame, waiting for their results. */
+struct GpuProfilerFrame {
+	GLuint queries[GPU_PROFILER_MAX_SCOPES];
+	/** The scope each query timed. */
+	int scopes[GPU_PROFILER_MAX_SCOPES];
+	int numQueries;
+	int pending;
+	/** The number of the frame the queries were issued in, counting from zero. */
+	unsigned int number;
+};
+
+/**
+ * Times scopes of GPU work with GL_TIME_ELAPSED queries.
+ *
+ * The queries of each frame go to a ring of frames, and are only read once their results are available,
+ * so that profiling never waits on the GPU. A frame whose results are still not available
+ * when its queries are reused is dropped.
+ */
+struct GpuProfiler {
+	/** Whether timer queries are supported, otherwise all calls do nothing. */
+	int supported;
+	struct GpuProfilerFrame frames[GPU_PROFILER_FRAMES];
+	unsigned int frameIndex;
+	/** The scope being timed, or -1. Timer queries cannot be nested. */
+	int activeScope;
+	struct GpuProfilerScope scopes[GPU_PROFILER_MAX_SCOPES];
+	int numScopes;
+	/** The sum of all scopes of each frame. */
+	struct GpuProfilerScope total;
+	unsigned int droppedFrames;
+	/** The number of times a scope went untimed for lack of queries or scopes, to warn only once. */
+	unsigned int skippedScopes;
+	/** Where the total of each frame from \c firstTotalFrame is also stored, or null. */
+	float *frameTotals;
+	unsigned int firstTotalFrame;
+	int numFrameTotals;
+};
+
+/** Draws the statistics of a profiler as text, one line per scope. */
+struct GpuProfilerOverlay {
+	struct Font *font;
+	/** Lines are laid out separately, since a layout holds a limited number of lines. */
+	struct Layout lines[GPU_PROFILER_MAX_SCOPES + 2];
+	char text[GPU_PROFILER_MAX_SCOPES + 2][96];
+	int numLines;
+	/** Frames left until the text is refreshed, as shaping it every frame is expensive. */
+	int refreshCountdown;
+};
+
+void gpuProfilerInit(struct GpuProfiler *profiler);
+
+void gpuProfilerDestroy(struct GpuProfiler *profiler);
+
+/** Collects the results that have become available and starts issuing the queries of the next frame. */
+void gpuProfilerBeginFrame(struct GpuProfiler *profiler);
+
+/** Finishes issuing the queries of the frame. */
+void gpuProfilerEndFrame(struct GpuProfiler *profiler);
+
+/**
+ * Starts timing the GPU commands of a scope, until the matching ::gpuProfilerEnd.
+ * Does nothing if the profiler is null.
+ * @param name The name identifying the scope, which has to stay valid as long as the profiler.
+ */
+void gpuProfilerBegin(struct GpuProfiler *profiler, const char *name);
+
+void gpuProfilerEnd(struct GpuProfiler *profiler);
+
+/**
+ * Stores the total time of each of the next \p count frames begun in \p totals as their results are collected,
+ * unlike the history of the total which only keeps the last frames. Frames whose results are dropped stay negative.
+ * The array has to stay valid until the results are collected, or until this is called again with a null array.
+ */
+void gpuProfilerRecordTotals(struct GpuProfiler *profiler, float *totals, int count);
+
+/** Computes the statistics of an array of times, sorting it in place. */
+void gpuProfilerComputeStats(float *samples, int count, struct GpuProfilerStats *stats);
+
+/** Computes the statistics of a scope over its recorded samples. */
+void gpuProfilerGetStats(const struct GpuProfilerScope *scope, struct GpuProfilerStats *stats);
+
+/**
+ * Writes the statistics of all scopes as comma-separated values, with a header line.
+ * @return Zero on success.
+ */
+int gpuProfilerWriteCsv(const struct GpuProfiler *profiler, const char *filename);
+
+void gpuProfilerOverlayInit(struct GpuProfilerOverlay *overlay, struct Font *font);
+
+void gpuProfilerOverlayDestroy(struct GpuProfilerOverlay *overlay);
+
+/** Draws the statistics with the top left corner at the given position. The batch has to be drawing. */
+void gpuProfilerOverlayDraw(struct GpuProfilerOverlay *overlay, const struct GpuProfiler *profiler,
+		struct SpriteBatch *batch, float x, float y);
+
+#endif
@@ -0,0 +1,101 @@
+#include "headless.h"
+#include <stdio.h>
+#include <string.h>
+#ifdef USE_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+#ifdef USE_EGL
+/** Gets a display that needs no display server, falling back to the default one. */
+static EGLDisplay getDisplay() {
+	const char *extensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+	PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC) eglGetProcAddress("eglGetPlatformDisplayEXT");
+	if (extensions && strstr(extensions, "EGL_MESA_platform_surfaceless") && getPlatformDisplay) {
+		EGLDisplay display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+		if (display != EGL_NO_DISPLAY) return display;
+	}
+	return eglGetDisplay(EGL_DEFAULT_DISPLAY);
+}
+
+int headlessContextInit(struct HeadlessContext *context, int width, int height) {
+	context->width = width;
+	context->height = height;
+	context->framebuffer = context->colorRenderbuffer = context->depthRenderbuffer = 0;
+	EGLDisplay display = getDisplay();
+	EGLint major, minor;
+	if (display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor)) {
+		fprintf(stderr, "Failed to initialize EGL display: 0x%x\n", eglGetError());
+		return -1;
+	}
+	context->display = display;
+	const char *extensions = eglQueryString(display, EGL_EXTENSIONS);
+	if (!extensions || !strstr(extensions, "EGL_KHR_surfaceless_context")) {
+		fprintf(stderr, "EGL does not support contexts without surfaces.\n");
+		eglTerminate(display);
+		return -1;
+	}
+
+	// The framebuffer is an object of its own, so the config needs no surface type
+	const EGLint configAttribs[] = {
+		EGL_SURFACE_TYPE, 0,
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+		EGL_NONE
+	};
+	EGLConfig config;
+	EGLint numConfigs;
+	if (!eglBindAPI(EGL_OPENGL_API) || !eglChooseConfig(display, configAttribs, &config, 1, &numConfigs) || numConfigs == 0) {
+		fprintf(stderr, "No suitable EGL config: 0x%x\n", eglGetError());
+		eglTerminate(display);
+		return -1;
+	}
+	// Default attributes give a compatibility profile, which the shaders of the renderer need
+	EGLContext eglContext = eglCreateContext(display, config, EGL_NO_CONTEXT, NULL);
+	if (eglContext == EGL_NO_CONTEXT || !eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, eglContext)) {
+		fprintf(stderr, "Failed to create EGL context: 0x%x\n", eglGetError());
+		if (eglContext != EGL_NO_CONTEXT) eglDestroyContext(display, eglContext);
+		eglTerminate(display);
+		return -1;
+	}
+	context->context = eglContext;
+	printf("Created headless context %d.%d: %s\n", major, minor, eglQueryString(display, EGL_VENDOR));
+	return 0;
+}
+
+void headlessContextDestroy(struct HeadlessContext *context) {
+	glDeleteFramebuffers(1, &context->framebuffer);
+	glDeleteRenderbuffers(1, &context->colorRenderbuffer);
+	glDeleteRenderbuffers(1, &context->depthRenderbuffer);
+	eglMakeCurrent(context->display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+	eglDestroyContext(context->display, context->context);
+	eglTerminate(context->display);
+}
+#else
+int headlessContextInit(struct HeadlessContext *context, int width, int height) {
+	fprintf(stderr, "Headless mode needs EGL, which was not found when building.\n");
+	return -1;
+}
+
+void headlessContextDestroy(struct HeadlessContext *context) {}
+#endif
+
+int headlessContextCreateFramebuffer(struct HeadlessContext *context) {
+	glGenRenderbuffers(1, &context->colorRenderbuffer);
+	glBindRenderbuffer(GL_RENDERBUFFER, context->colorRenderbuffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, context->width, context->height);
+	glGenRenderbuffers(1, &context->depthRenderbuffer);
+	glBindRenderbuffer(GL_RENDERBUFFER, context->depthRenderbuffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, context->width, context->height);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+	glGenFramebuffers(1, &context->framebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, context->framebuffer);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, context->colorRenderbuffer);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, context->depthRenderbuffer);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+		fprintf(stderr, "Error creating headless framebuffer.\n");
+		return -1;
+	}
+	glViewport(0, 0, context->width, context->height);
+	return 0;
+}
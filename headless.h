@@ -0,0 +1,32 @@
+#ifndef HEADLESS_H
+#define HEADLESS_H
+
+#include <GL/glew.h>
+
+/**
+ * An OpenGL context without a window, rendering to a framebuffer object.
+ *
+ * The context is created through EGL on the surfaceless platform where available,
+ * so that it works without a display server, such as with the llvmpipe software rasterizer of Mesa.
+ */
+struct HeadlessContext {
+	void *display, *context;
+	int width, height;
+	GLuint framebuffer, colorRenderbuffer, depthRenderbuffer;
+};
+
+/**
+ * Creates the context and makes it current.
+ * @return Zero on success.
+ */
+int headlessContextInit(struct HeadlessContext *context, int width, int height);
+
+/**
+ * Creates the framebuffer standing in for the window. Call once the GL functions are loaded.
+ * @return Zero on success.
+ */
+int headlessContextCreateFramebuffer(struct HeadlessContext *context);
+
+void headlessContextDestroy(struct HeadlessContext *context);
+
+#endif
@@ -0,0 +1,143 @@
+#include "inputTrace.h"
+#include <string.h>
+
+#define INPUT_TRACE_MAGIC "FPSI"
+#define INPUT_TRACE_VERSION 1
+
+static void writeUint16(FILE *f, Uint16 value) {
+	fputc(value & 0xFF, f);
+	fputc(value >> 8, f);
+}
+
+static void writeUint32(FILE *f, Uint32 value) {
+	writeUint16(f, value & 0xFFFF);
+	writeUint16(f, value >> 16);
+}
+
+/** Returns zero if the end of the file was reached. */
+static int readUint8(FILE *f, Uint8 *value) {
+	int c = fgetc(f);
+	if (c == EOF) return 0;
+	*value = c;
+	return 1;
+}
+
+static int readUint16(FILE *f, Uint16 *value) {
+	Uint8 lo, hi;
+	if (!readUint8(f, &lo) || !readUint8(f, &hi)) return 0;
+	*value = lo | hi << 8;
+	return 1;
+}
+
+static int readUint32(FILE *f, Uint32 *value) {
+	Uint16 lo, hi;
+	if (!readUint16(f, &lo) || !readUint16(f, &hi)) return 0;
+	*value = lo | (Uint32) hi << 16;
+	return 1;
+}
+
+void inputTraceInitLive(struct InputTrace *trace, unsigned int seed) {
+	trace->mode = INPUT_LIVE;
+	trace->file = 0;
+	trace->seed = seed;
+	trace->numFrames = 0;
+	trace->finished = 0;
+}
+
+int inputTraceOpen(struct InputTrace *trace, enum InputMode mode, const char *filename, unsigned int seed) {
+	inputTraceInitLive(trace, seed);
+	if (mode == INPUT_LIVE) return 0;
+	if (!(trace->file = fopen(filename, mode == INPUT_RECORD ? "wb" : "rb"))) {
+		fprintf(stderr, "Failed to open input trace %s.\n", filename);
+		return -1;
+	}
+	trace->mode = mode;
+
+	if (mode == INPUT_RECORD) {
+		fwrite(INPUT_TRACE_MAGIC, 4, 1, trace->file);
+		fputc(INPUT_TRACE_VERSION, trace->file);
+		writeUint32(trace->file, seed);
+	} else {
+		char magic[4];
+		Uint8 version;
+		Uint32 recordedSeed;
+		if (fread(magic, 4, 1, trace->file) != 1 || memcmp(magic, INPUT_TRACE_MAGIC, 4) != 0
+				|| !readUint8(trace->file, &version) || version != INPUT_TRACE_VERSION
+				|| !readUint32(trace->file, &recordedSeed)) {
+			fprintf(stderr, "Invalid input trace %s.\n", filename);
+			inputTraceClose(trace);
+			return -1;
+		}
+		trace->seed = recordedSeed;
+	}
+	return 0;
+}
+
+void inputTraceClose(struct InputTrace *trace) {
+	if (trace->file) fclose(trace->file);
+	trace->file = 0;
+	trace->mode = INPUT_LIVE;
+}
+
+void inputFrameAddKeyDown(struct InputFrame *frame, SDL_Scancode scancode) {
+	if (frame->numKeyDowns < MAX_INPUT_KEY_DOWNS) frame->keyDowns[frame->numKeyDowns++] = scancode;
+}
+
+void inputFrameSample(struct InputFrame *frame) {
+	const Uint8 *keys = SDL_GetKeyboardState(NULL);
+	frame->buttons = (keys[SDL_SCANCODE_W] ? INPUT_FORWARD : 0)
+		| (keys[SDL_SCANCODE_S] ? INPUT_BACKWARD : 0)
+		| (keys[SDL_SCANCODE_A] ? INPUT_LEFT : 0)
+		| (keys[SDL_SCANCODE_D] ? INPUT_RIGHT : 0)
+		| (keys[SDL_SCANCODE_SPACE] ? INPUT_UP : 0)
+		| (keys[SDL_SCANCODE_LSHIFT] ? INPUT_DOWN : 0);
+	int x, y;
+	SDL_GetRelativeMouseState(&x, &y);
+	frame->mouseX = x;
+	frame->mouseY = y;
+}
+
+/** Reads the next frame. Returns zero at the end of the trace. */
+static int readFrame(FILE *f, struct InputFrame *frame) {
+	Uint16 mouseX, mouseY;
+	if (!readUint8(f, &frame->buttons) || !readUint16(f, &mouseX) || !readUint16(f, &mouseY)
+			|| !readUint8(f, &frame->numKeyDowns) || frame->numKeyDowns > MAX_INPUT_KEY_DOWNS) return 0;
+	frame->mouseX = (Sint16) mouseX;
+	frame->mouseY = (Sint16) mouseY;
+	for (int i = 0; i < frame->numKeyDowns; ++i) {
+		Uint16 scancode;
+		if (!readUint16(f, &scancode)) return 0;
+		frame->keyDowns[i] = scancode;
+	}
+	return 1;
+}
+
+static void writeFrame(FILE *f, const struct InputFrame *frame) {
+	fputc(frame->buttons, f);
+	writeUint16(f, (Uint16) frame->mouseX);
+	writeUint16(f, (Uint16) frame->mouseY);
+	fputc(frame->numKeyDowns, f);
+	for (int i = 0; i < frame->numKeyDowns; ++i) writeUint16(f, frame->keyDowns[i]);
+}
+
+struct InputFrame inputTraceNext(struct InputTrace *trace, const struct InputFrame *live) {
+	struct InputFrame frame = *live;
+	switch (trace->mode) {
+		case INPUT_RECORD:
+			writeFrame(trace->file, &frame);
+			break;
+		case INPUT_REPLAY:
+			if (!readFrame(trace->file, &frame)) {
+				printf("Input trace finished after %u steps.\n", trace->numFrames);
+				inputTraceClose(trace);
+				trace->finished = 1;
+				memset(&frame, 0, sizeof frame);
+				return frame;
+			}
+			break;
+		default:
+			break;
+	}
+	++trace->numFrames;
+	return frame;
+}
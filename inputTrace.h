@@ -0,0 +1,74 @@
+#ifndef INPUT_TRACE_H
+#define INPUT_TRACE_H
+
+#include <stdio.h>
+#include <SDL.h>
+
+/** The maximum number of key presses recorded per simulation step; further ones are dropped. */
+#define MAX_INPUT_KEY_DOWNS 4
+
+enum InputButton {
+	INPUT_FORWARD = 0x1,
+	INPUT_BACKWARD = 0x2,
+	INPUT_LEFT = 0x4,
+	INPUT_RIGHT = 0x8,
+	INPUT_UP = 0x10,
+	INPUT_DOWN = 0x20
+};
+
+/** The input consumed by one simulation step. */
+struct InputFrame {
+	/** Bitmask of the held buttons. */
+	Uint8 buttons;
+	/** Relative mouse motion since the previous step. */
+	Sint16 mouseX, mouseY;
+	Uint8 numKeyDowns;
+	/** Keys pressed since the previous step, in order. */
+	SDL_Scancode keyDowns[MAX_INPUT_KEY_DOWNS];
+};
+
+enum InputMode {
+	INPUT_LIVE,
+	INPUT_RECORD,
+	INPUT_REPLAY
+};
+
+/**
+ * Binary trace of the input of every simulation step, along with the random seed of the session,
+ * so that a run can be reproduced exactly.
+ */
+struct InputTrace {
+	enum InputMode mode;
+	FILE *file;
+	unsigned int seed;
+	/** The number of steps recorded or replayed so far. */
+	unsigned int numFrames;
+	/** Set once a replay has run out of frames. */
+	int finished;
+};
+
+/**
+ * Opens a trace for recording or replaying.
+ * When recording, \p seed is stored in the file; when replaying it is replaced by the recorded seed.
+ * @return Zero on success.
+ */
+int inputTraceOpen(struct InputTrace *trace, enum InputMode mode, const char *filename, unsigned int seed);
+
+/** Initializes a trace that neither records nor replays. */
+void inputTraceInitLive(struct InputTrace *trace, unsigned int seed);
+
+void inputTraceClose(struct InputTrace *trace);
+
+/** Adds the key press to the frame unless it is full. */
+void inputFrameAddKeyDown(struct InputFrame *frame, SDL_Scancode scancode);
+
+/** Fills in the held buttons and mouse motion from the current SDL state. */
+void inputFrameSample(struct InputFrame *frame);
+
+/**
+ * Returns the input of the next simulation step.
+ * Replays read it from the trace, otherwise \p live is used and written out when recording.
+ */
+struct InputFrame inputTraceNext(struct InputTrace *trace, const struct InputFrame *live);
+
+#endif
@@ -0,0 +1,166 @@
+#include "jobSystem.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+
+static void runRange(struct JobSystem *system, struct JobWorker *worker, struct JobRange range);
+
+static int queuePush(struct JobSystem *system, struct JobQueue *queue, struct JobRange range) {
+	SDL_AtomicLock(&queue->lock);
+	int full = queue->bottom - queue->top == JOB_QUEUE_SIZE;
+	if (!full) queue->ranges[queue->bottom++ % JOB_QUEUE_SIZE] = range;
+	SDL_AtomicUnlock(&queue->lock);
+	if (full) return 0;
+
+	SDL_AtomicAdd(&system->numQueued, 1);
+	SDL_LockMutex(system->mutex);
+	SDL_CondSignal(system->cond);
+	SDL_UnlockMutex(system->mutex);
+	return 1;
+}
+
+static int queuePop(struct JobQueue *queue, struct JobRange *range) {
+	SDL_AtomicLock(&queue->lock);
+	int empty = queue->bottom == queue->top;
+	if (!empty) *range = queue->ranges[--queue->bottom % JOB_QUEUE_SIZE];
+	SDL_AtomicUnlock(&queue->lock);
+	return !empty;
+}
+
+static int queueSteal(struct JobQueue *queue, struct JobRange *range) {
+	SDL_AtomicLock(&queue->lock);
+	int empty = queue->bottom == queue->top;
+	if (!empty) *range = queue->ranges[queue->top++ % JOB_QUEUE_SIZE];
+	SDL_AtomicUnlock(&queue->lock);
+	return !empty;
+}
+
+/** Queues the whole range of a job whose dependencies have all finished. */
+static void enqueueJob(struct JobSystem *system, struct JobWorker *worker, struct Job *job) {
+	struct JobRange range = { job, job->start, job->end };
+	if (!queuePush(system, &worker->queue, range)) runRange(system, worker, range);
+}
+
+static void finishRange(struct JobSystem *system, struct JobWorker *worker, struct Job *job) {
+	// Copy the dependents first since a waiter may reuse the job as soon as it has finished
+	int numDependents = job->numDependents;
+	struct Job *dependents[MAX_JOB_DEPENDENTS];
+	for (int i = 0; i < numDependents; ++i) dependents[i] = job->dependents[i];
+	if (SDL_AtomicAdd(&job->unfinished, -1) != 1) return;
+	// This was the last range: release the dependents
+	for (int i = 0; i < numDependents; ++i) {
+		if (SDL_AtomicAdd(&dependents[i]->dependencies, -1) == 1) enqueueJob(system, worker, dependents[i]);
+	}
+}
+
+static void runRange(struct JobSystem *system, struct JobWorker *worker, struct JobRange range) {
+	struct Job *job = range.job;
+	// Split off the upper halves for others to steal
+	while (range.end - range.start > job->grainSize) {
+		int middle = range.start + (range.end - range.start) / 2;
+		SDL_AtomicAdd(&job->unfinished, 1);
+		if (!queuePush(system, &worker->queue, (struct JobRange) { job, middle, range.end })) {
+			SDL_AtomicAdd(&job->unfinished, -1);
+			break;
+		}
+		range.end = middle;
+	}
+	job->function(job->data, range.start, range.end);
+	finishRange(system, worker, job);
+}
+
+/** Runs one range from the worker's own queue or stolen from another. Returns zero if none was found. */
+static int runOne(struct JobSystem *system, struct JobWorker *worker) {
+	struct JobRange range;
+	int found = queuePop(&worker->queue, &range);
+	for (int i = 1; !found && i < system->numWorkers; ++i) {
+		found = queueSteal(&system->workers[(worker->index + i) % system->numWorkers].queue, &range);
+	}
+	if (!found) return 0;
+	SDL_AtomicAdd(&system->numQueued, -1);
+	runRange(system, worker, range);
+	return 1;
+}
+
+static int workerMain(void *data) {
+	struct JobWorker *worker = data;
+	struct JobSystem *system = worker->system;
+	while (SDL_AtomicGet(&system->running)) {
+		if (runOne(system, worker)) continue;
+		SDL_LockMutex(system->mutex);
+		while (SDL_AtomicGet(&system->numQueued) == 0 && SDL_AtomicGet(&system->running)) {
+			SDL_CondWait(system->cond, system->mutex);
+		}
+		SDL_UnlockMutex(system->mutex);
+	}
+	return 0;
+}
+
+void jobSystemInit(struct JobSystem *system, int numWorkers) {
+#ifdef __EMSCRIPTEN__
+	numWorkers = 1; // Everything runs on the main thread
+#endif
+	assert(numWorkers >= 1);
+	system->numWorkers = numWorkers;
+	system->workers = malloc(sizeof(struct JobWorker) * numWorkers);
+	assert(system->workers && "Failed to allocate memory.");
+	SDL_AtomicSet(&system->numQueued, 0);
+	SDL_AtomicSet(&system->running, 1);
+	system->mutex = SDL_CreateMutex();
+	system->cond = SDL_CreateCond();
+	for (int i = 0; i < numWorkers; ++i) {
+		struct JobWorker *worker = system->workers + i;
+		worker->system = system;
+		worker->index = i;
+		worker->thread = 0;
+		worker->queue.lock = 0;
+		worker->queue.top = worker->queue.bottom = 0;
+	}
+	for (int i = 1; i < numWorkers; ++i) {
+		if (!(system->workers[i].thread = SDL_CreateThread(workerMain, "worker", system->workers + i))) {
+			fprintf(stderr, "SDL_CreateThread Error: %s\n", SDL_GetError());
+		}
+	}
+}
+
+void jobSystemDestroy(struct JobSystem *system) {
+	SDL_AtomicSet(&system->running, 0);
+	SDL_LockMutex(system->mutex);
+	SDL_CondBroadcast(system->cond);
+	SDL_UnlockMutex(system->mutex);
+	for (int i = 1; i < system->numWorkers; ++i) {
+		if (system->workers[i].thread) SDL_WaitThread(system->workers[i].thread, NULL);
+	}
+	SDL_DestroyCond(system->cond);
+	SDL_DestroyMutex(system->mutex);
+	free(system->workers);
+}
+
+void jobInit(struct Job *job, JobFunction function, void *data, int start, int end, int grainSize) {
+	assert(grainSize > 0 && "Grain size must be positive.");
+	job->function = function;
+	job->data = data;
+	job->start = start;
+	job->end = end;
+	job->grainSize = grainSize;
+	SDL_AtomicSet(&job->unfinished, 1);
+	SDL_AtomicSet(&job->dependencies, 1);
+	job->numDependents = 0;
+}
+
+void jobAddDependency(struct Job *job, struct Job *dependency) {
+	assert(dependency->numDependents < MAX_JOB_DEPENDENTS && "Too many dependents.");
+	dependency->dependents[dependency->numDependents++] = job;
+	SDL_AtomicAdd(&job->dependencies, 1);
+}
+
+void jobSystemSubmit(struct JobSystem *system, struct Job *job) {
+	if (SDL_AtomicAdd(&job->dependencies, -1) == 1) enqueueJob(system, system->workers, job);
+}
+
+void jobSystemWait(struct JobSystem *system, struct Job *job) {
+	while (SDL_AtomicGet(&job->unfinished) > 0) {
+		// Give up the time slice while other workers finish the last ranges, rather than spinning
+		if (!runOne(system, system->workers)) SDL_Delay(0);
+	}
+}
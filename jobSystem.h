@@ -0,0 +1,87 @@
+#ifndef JOB_SYSTEM_H
+#define JOB_SYSTEM_H
+
+#include <SDL.h>
+
+/** The maximum number of ranges each worker can have queued. */
+#define JOB_QUEUE_SIZE 256
+#define MAX_JOB_DEPENDENTS 4
+
+/**
+ * Callback processing the items in [start, end) of a parallel-for job.
+ * May be called concurrently from different threads with disjoint ranges.
+ */
+typedef void (*JobFunction)(void *data, int start, int end);
+
+struct Job {
+	JobFunction function;
+	void *data;
+	int start, end;
+	/** Ranges larger than this are split in half so that idle workers can steal them. */
+	int grainSize;
+	/** The number of unfinished ranges of this job. */
+	SDL_atomic_t unfinished;
+	/** The number of unfinished jobs this one waits for, plus one until it is submitted. */
+	SDL_atomic_t dependencies;
+	int numDependents;
+	struct Job *dependents[MAX_JOB_DEPENDENTS];
+};
+
+struct JobRange {
+	struct Job *job;
+	int start, end;
+};
+
+/**
+ * Double-ended queue of ranges.
+ * The owning worker pushes and pops at the bottom while thieves steal from the top.
+ */
+struct JobQueue {
+	SDL_SpinLock lock;
+	unsigned int top, bottom;
+	struct JobRange ranges[JOB_QUEUE_SIZE];
+};
+
+struct JobWorker {
+	struct JobSystem *system;
+	int index;
+	SDL_Thread *thread;
+	struct JobQueue queue;
+};
+
+/**
+ * Work-stealing scheduler for parallel-for jobs.
+ * Worker 0 is the thread that submits and waits for jobs; it helps out while waiting.
+ */
+struct JobSystem {
+	int numWorkers;
+	struct JobWorker *workers;
+	/** The total number of queued ranges, used to put idle workers to sleep. */
+	SDL_atomic_t numQueued;
+	SDL_atomic_t running;
+	SDL_mutex *mutex;
+	SDL_cond *cond;
+};
+
+/**
+ * @param numWorkers The number of threads to run jobs on, including the calling thread.
+ */
+void jobSystemInit(struct JobSystem *system, int numWorkers);
+
+void jobSystemDestroy(struct JobSystem *system);
+
+void jobInit(struct Job *job, JobFunction function, void *data, int start, int end, int grainSize);
+
+/**
+ * Declares that \p job may not start before \p dependency has finished.
+ * All dependencies have to be declared before either job is submitted.
+ */
+void jobAddDependency(struct Job *job, struct Job *dependency);
+
+/** Schedules the job to run once all its dependencies have finished. */
+void jobSystemSubmit(struct JobSystem *system, struct Job *job);
+
+/** Runs queued ranges on the calling thread until the job has finished. */
+void jobSystemWait(struct JobSystem *system, struct Job *job);
+
+#endif
@@ -1,6 +1,8 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <time.h>
+#include <math.h>
 #include <SDL.h>
 #include <GL/glew.h>
 #include <SDL_opengl.h>
@@ -9,17 +11,34 @@
 #include "spriteBatch.h"
 #include "font.h"
 #include "gameState.h"
+#include "inputTrace.h"
+#include "headless.h"
 #ifdef __EMSCRIPTEN__
 #include <emscripten.h>
 #endif
 
+/** The duration of a simulation step in milliseconds. */
+#define SIMULATION_STEP (1000.0f / 120.0f)
+/** Caps the number of steps after a slow frame, to avoid falling further and further behind. */
+#define MAX_ACCUMULATED_TIME 250.0f
+/** The frames rendered before a benchmark starts timing, while caches and drivers warm up. */
+#define WARMUP_FRAMES 30
+/** The number of frames the benchmark camera takes to orbit the origin once. */
+#define BENCHMARK_ORBIT_FRAMES 600
+#define BENCHMARK_ORBIT_RADIUS 40.0f
+/** The random seed of benchmarks, so that every run simulates the same game. */
+#define BENCHMARK_SEED 0
+
 SDL_Window *window;
 struct StateManager manager;
 struct GameState gameState;
 struct SpriteBatch batch;
-Uint64 frequency, lastTime = 0;
+Uint64 frequency, lastTime = 0, startTime;
+/** Simulation time not yet consumed by fixed steps. */
+float accumulator = 0.0f;
 int running = 1;
 struct Font font;
+struct InputTrace inputTrace;
 
 static void update() {
 	const Uint8 *state = SDL_GetKeyboardState(NULL);
@@ -58,8 +77,14 @@ static void update() {
 	if (dt > 1000.0f) dt = 0.0f;
 	lastTime = now;
 
-	manager.state->update(manager.state, dt);
-	manager.state->draw(manager.state, dt);
+	// Advance the simulation in fixed steps and draw in between the last two
+	accumulator += dt;
+	if (accumulator > MAX_ACCUMULATED_TIME) accumulator = MAX_ACCUMULATED_TIME;
+	while (accumulator >= SIMULATION_STEP) {
+		manager.state->update(manager.state, SIMULATION_STEP);
+		accumulator -= SIMULATION_STEP;
+	}
+	manager.state->draw(manager.state, dt, accumulator / SIMULATION_STEP);
 
 	GLenum error;
 	while ((error = glGetError()) != GL_NO_ERROR) {
@@ -67,28 +92,137 @@ static void update() {
 	}
 
 	SDL_GL_SwapWindow(window);
+
+	if (inputTrace.finished) {
+		printf("Replay took %.1f ms.\n", (SDL_GetPerformanceCounter() - startTime) * 1000.0 / frequency);
+		running = 0;
+	}
+}
+
+/** Moves the camera along the fixed path of the benchmark: orbiting the origin, looking in and slightly down. */
+static void setBenchmarkCamera(struct GameState *gameState, int frame) {
+	float angle = 2 * M_PI * frame / BENCHMARK_ORBIT_FRAMES;
+	gameState->noclip = 1;
+	gameState->position = VectorSet(BENCHMARK_ORBIT_RADIUS * sin(angle), 8.0f, BENCHMARK_ORBIT_RADIUS * cos(angle), 1.0f);
+	gameState->yaw = angle;
+	gameState->pitch = -0.3f;
+}
+
+static void printStats(const char *name, const struct GpuProfilerStats *stats) {
+	printf("%s frame time (ms) over %d frames: average %.3f, median %.3f, p95 %.3f, p99 %.3f, max %.3f\n", name,
+			stats->numSamples, stats->average, stats->median, stats->p95, stats->p99, stats->max);
+}
+
+/**
+ * Renders a fixed number of frames along the benchmark camera path, one simulation step each,
+ * and reports the percentiles of the CPU and GPU frame times over the same frames, after the warm-up.
+ * The GPU time of a frame is the sum of its profiled passes.
+ */
+static void runBenchmark(int frames) {
+	float *cpuTimes = malloc(sizeof *cpuTimes * frames), *gpuTimes = malloc(sizeof *gpuTimes * frames);
+	if (!cpuTimes || !gpuTimes) {
+		fprintf(stderr, "Failed to allocate frame times.\n");
+		free(cpuTimes);
+		free(gpuTimes);
+		return;
+	}
+	// Frames in flight, waited on as swapping buffers would so that the CPU does not get arbitrarily far ahead
+	GLsync fences[2] = { 0 };
+	for (int i = -WARMUP_FRAMES; i < frames; ++i) {
+		GLsync *fence = fences + (i & 1);
+		if (*fence) {
+			glClientWaitSync(*fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+			glDeleteSync(*fence);
+		}
+
+		if (i == 0) gpuProfilerRecordTotals(&gameState.profiler, gpuTimes, frames);
+		Uint64 start = SDL_GetPerformanceCounter();
+		manager.state->update(manager.state, SIMULATION_STEP);
+		setBenchmarkCamera(&gameState, i);
+		manager.state->draw(manager.state, SIMULATION_STEP, 1.0f);
+		*fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		if (i >= 0) cpuTimes[i] = (SDL_GetPerformanceCounter() - start) * 1000.0 / frequency;
+	}
+	glFinish();
+	for (int i = 0; i < 2; ++i) glDeleteSync(fences[i]);
+	// Collect the timings of the last frames
+	gpuProfilerBeginFrame(&gameState.profiler);
+	gpuProfilerRecordTotals(&gameState.profiler, 0, 0);
+	// Leave out the frames whose results were dropped
+	int numGpuTimes = 0;
+	for (int i = 0; i < frames; ++i) {
+		if (gpuTimes[i] >= 0.0f) gpuTimes[numGpuTimes++] = gpuTimes[i];
+	}
+
+	GLenum error;
+	while ((error = glGetError()) != GL_NO_ERROR) {
+		fprintf(stderr, "OpenGL error: %d\n", error);
+	}
+
+	struct GpuProfilerStats cpuStats, gpuStats;
+	gpuProfilerComputeStats(cpuTimes, frames, &cpuStats);
+	gpuProfilerComputeStats(gpuTimes, numGpuTimes, &gpuStats);
+	printStats("CPU", &cpuStats);
+	if (gameState.profiler.supported) printStats("GPU", &gpuStats);
+	free(cpuTimes);
+	free(gpuTimes);
 }
 
-int main(int argc, char *arcv[]) {
+int main(int argc, char *argv[]) {
 	setvbuf(stdout, 0, _IONBF, 0);
 	setvbuf(stderr, 0, _IONBF, 0);
-	srand(time(NULL));
-	printf("Starting the engine.\n");
-	if (SDL_Init(SDL_INIT_VIDEO) != 0) {
-		printf("SDL_Init Error: %s\n", SDL_GetError());
-		return 1;
+
+	// Either record the input of this session or replay a recorded one, including its random seed
+	inputTraceInitLive(&inputTrace, time(NULL));
+	const char *profileFilename = 0;
+	int headlessFrames = 0;
+	for (int i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc) {
+			profileFilename = argv[++i];
+			continue;
+		}
+		if (strcmp(argv[i], "--headless") == 0 && i + 1 < argc && (headlessFrames = atoi(argv[i + 1])) > 0) {
+			++i;
+			continue;
+		}
+		enum InputMode mode = strcmp(argv[i], "--record") == 0 ? INPUT_RECORD
+			: strcmp(argv[i], "--replay") == 0 ? INPUT_REPLAY : INPUT_LIVE;
+		if (mode == INPUT_LIVE || i + 1 == argc) {
+			fprintf(stderr, "Usage: %s [--record FILE | --replay FILE] [--profile FILE] [--headless FRAMES]\n", argv[0]);
+			return 1;
+		}
+		if (inputTraceOpen(&inputTrace, mode, argv[++i], inputTrace.seed) != 0) return 1;
 	}
-	// SDL_SetRelativeMouseMode(SDL_TRUE); // Capture mouse and use relative coordinates
-	if (!(window = SDL_CreateWindow("Hello", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, 800, 600, SDL_WINDOW_OPENGL | SDL_WINDOW_RESIZABLE))) {
-		fprintf(stderr, "SDL_CreateWindow Error: %s\n", SDL_GetError());
-		SDL_Quit();
-		return 1;
+	// Benchmarks without recorded input are seeded the same every run
+	if (headlessFrames && inputTrace.mode == INPUT_LIVE) inputTraceInitLive(&inputTrace, BENCHMARK_SEED);
+	srand(inputTrace.seed);
+	printf("Starting the engine.\n");
+	struct HeadlessContext headlessContext;
+	if (headlessFrames) {
+		// Without a display there is no window, and the frame is drawn to a framebuffer object instead
+		if (SDL_Init(0) != 0 || headlessContextInit(&headlessContext, 800, 600) != 0) return 1;
+	} else {
+		if (SDL_Init(SDL_INIT_VIDEO) != 0) {
+			printf("SDL_Init Error: %s\n", SDL_GetError());
+			return 1;
+		}
+		// SDL_SetRelativeMouseMode(SDL_TRUE); // Capture mouse and use relative coordinates
+		if (!(window = SDL_CreateWindow("Hello", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, 800, 600, SDL_WINDOW_OPENGL | SDL_WINDOW_RESIZABLE))) {
+			fprintf(stderr, "SDL_CreateWindow Error: %s\n", SDL_GetError());
+			SDL_Quit();
+			return 1;
+		}
+		SDL_GLContext glcontext = SDL_GL_CreateContext(window);
 	}
-	SDL_GLContext glcontext = SDL_GL_CreateContext(window);
 	GLenum err = glewInit();
+#ifdef GLEW_ERROR_NO_GLX_DISPLAY
+	// GLEW built for GLX still loads the functions of EGL contexts, but reports not finding a GLX display
+	if (headlessFrames && err == GLEW_ERROR_NO_GLX_DISPLAY) err = GLEW_OK;
+#endif
 	if (err != GLEW_OK) {
 		printf("glewInit Error: %s\n", glewGetErrorString(err));
 	}
+	if (headlessFrames && headlessContextCreateFramebuffer(&headlessContext) != 0) return 1;
 
 	glEnable(GL_CULL_FACE);
 	glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
@@ -99,16 +233,22 @@ int main(int argc, char *arcv[]) {
 		fprintf(stderr, "Error initializing font.");
 	}
 
-	gameStateInitialize(&gameState, &batch, &font);
+	gameStateInitialize(&gameState, &batch, &font, &inputTrace);
 	setState(&manager, (struct State *) &gameState);
+	if (headlessFrames) rendererSetOutputFramebuffer(&gameState.renderer, headlessContext.framebuffer);
 
 	frequency = SDL_GetPerformanceFrequency();
+	startTime = SDL_GetPerformanceCounter();
 
 #ifdef __EMSCRIPTEN__
 	emscripten_set_main_loop(update, 0, 1);
 #else
-	while (running) {
-		update();
+	if (headlessFrames) {
+		runBenchmark(headlessFrames);
+	} else {
+		while (running) {
+			update();
+		}
 	}
 #endif
 
@@ -118,6 +258,10 @@ int main(int argc, char *arcv[]) {
 	  spriteBatchDestroy(&batch);
 
 	  SDL_Quit();*/
+	inputTraceClose(&inputTrace);
+	// Write the GPU timings of the last frames for comparing runs
+	if (profileFilename) gpuProfilerWriteCsv(&gameState.profiler, profileFilename);
+	if (headlessFrames) headlessContextDestroy(&headlessContext);
 
 	return 0;
 }
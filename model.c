@@ -4,6 +4,7 @@
 #include <stdio.h>
 #include <assert.h>
 #include <math.h>
+#include <stdint.h>
 #include <objparser.h>
 #include "glUtil.h"
 
@@ -147,7 +148,83 @@ static const struct Material defaultMaterial = {
 	{ 1.0f, 1.0f, 1.0f }
 };
 
-struct Model *loadModelFromObj(char *path) {
+/** Quantizes a value in [0, 1] to a normalized unsigned short. */
+static uint16_t quantizeUnorm16(float x) {
+	return (uint16_t) (CLAMP(x, 0.0f, 1.0f) * 65535.0f + 0.5f);
+}
+
+/** Quantizes a value in [-1, 1] to a signed normalized integer with a maximum of \p max. */
+static int quantizeSnorm(float x, int max) {
+	x = CLAMP(x, -1.0f, 1.0f) * max;
+	return (int) (x < 0.0f ? x - 0.5f : x + 0.5f);
+}
+
+/**
+ * Computes the scale and bias mapping [0, 1] to the range of the values of each component,
+ * so that quantizing over it uses all the bits.
+ */
+static void getQuantization(const float *values, const struct ObjVertexIndex *vertices, unsigned int count,
+		int components, int texcoords, float *scale, float *bias) {
+	for (int c = 0; c < components; ++c) {
+		float min = INFINITY, max = -INFINITY;
+		for (unsigned int i = 0; i < count; ++i) {
+			int index = texcoords ? vertices[i].texcoordIndex : vertices[i].vertexIndex;
+			// Texture coordinates are stored with three components each
+			float x = values[3 * index + c];
+			if (x < min) min = x;
+			if (x > max) max = x;
+		}
+		if (count == 0) min = max = 0.0f;
+		bias[c] = min;
+		scale[c] = max > min ? max - min : 1.0f;
+	}
+}
+
+/** Compresses the vertices of the model into the arena, returning its base vertex. */
+static GLint packVertices(struct Model *model, const struct ObjBuilder *obj, const struct ObjVertexIndex *vertices, unsigned int count) {
+	struct GeometryArena *arena = model->arena;
+	int hasTexcoords = count && vertices[0].texcoordIndex != -1, hasNormals = count && vertices[0].normalIndex != -1;
+	getQuantization(obj->vertices, vertices, count, 3, 0, model->positionScale, model->positionBias);
+	if (hasTexcoords) {
+		getQuantization(obj->texcoords, vertices, count, 2, 1, model->texcoordScale, model->texcoordBias);
+	} else {
+		model->texcoordScale[0] = model->texcoordScale[1] = 1.0f;
+		model->texcoordBias[0] = model->texcoordBias[1] = 0.0f;
+	}
+
+	unsigned char *data, *texcoordData;
+	GLint baseVertex = geometryArenaAddVertices(arena, count, &data, &texcoordData);
+	for (unsigned int i = 0; i < count; ++i) {
+		struct ObjVertexIndex vi = vertices[i];
+		unsigned char *vertex = data + arena->stride * i;
+		uint16_t position[4] = { 0 };
+		for (int c = 0; c < 3; ++c) {
+			position[c] = quantizeUnorm16((obj->vertices[3 * vi.vertexIndex + c] - model->positionBias[c]) / model->positionScale[c]);
+		}
+		memcpy(vertex + arena->position.offset, position, sizeof position);
+		if (hasNormals) {
+			const float *n = obj->normals + 3 * vi.normalIndex;
+			if (arena->normal.type == GL_INT_2_10_10_10_REV) {
+				uint32_t packed = (quantizeSnorm(n[0], 511) & 0x3FF) | (quantizeSnorm(n[1], 511) & 0x3FF) << 10
+					| (quantizeSnorm(n[2], 511) & 0x3FF) << 20;
+				memcpy(vertex + arena->normal.offset, &packed, sizeof packed);
+			} else {
+				int8_t packed[4] = { quantizeSnorm(n[0], 127), quantizeSnorm(n[1], 127), quantizeSnorm(n[2], 127), 0 };
+				memcpy(vertex + arena->normal.offset, packed, sizeof packed);
+			}
+		}
+		if (hasTexcoords) {
+			uint16_t texcoord[2];
+			for (int c = 0; c < 2; ++c) {
+				texcoord[c] = quantizeUnorm16((obj->texcoords[3 * vi.texcoordIndex + c] - model->texcoordBias[c]) / model->texcoordScale[c]);
+			}
+			memcpy(texcoordData + arena->texcoordStride * i + arena->texcoord.offset, texcoord, sizeof texcoord);
+		}
+	}
+	return baseVertex;
+}
+
+struct Model *loadModelFromObj(struct GeometryArena *arena, char *path) {
 	printf("loading model: %s\n", path);
 	char *buffer = readFile(path);
 	if (!buffer) {
@@ -177,12 +254,11 @@ struct Model *loadModelFromObj(char *path) {
 
 	unsigned int vertexCount = 0, indexCount = 0;
 	// Assume that each face is a triangle
-	GLfloat *vertices = malloc(sizeof(float) * obj.numFaces * 3 * (3 + 2 * obj.texcoordsSize + 3 * obj.normalsSize));
+	struct ObjVertexIndex *uniqueVertices = malloc(sizeof *uniqueVertices * obj.numFaces * 3);
 	unsigned int *indices = malloc(sizeof(unsigned int) * obj.numFaces * 3);
-	for (unsigned face = 0, k = 0; face < obj.numFaces; ++face) {
+	for (unsigned face = 0; face < obj.numFaces; ++face) {
 		for (unsigned i = 0; i < 3; ++i, ++indexCount) {
 			struct ObjVertexIndex vi = obj.indices[indexCount];
-			unsigned int vertexIndex = vi.vertexIndex * 3, texcoordIndex = vi.texcoordIndex * 2, normalIndex = vi.normalIndex * 3;
 
 			for (int j = 0; j < indexCount; ++j) {
 				struct ObjVertexIndex vi2 = obj.indices[j];
@@ -192,19 +268,8 @@ struct Model *loadModelFromObj(char *path) {
 				}
 			}
 
-			indices[indexCount] = k++;
-			vertices[vertexCount++] = obj.vertices[vertexIndex];
-			vertices[vertexCount++] = obj.vertices[vertexIndex + 1];
-			vertices[vertexCount++] = obj.vertices[vertexIndex + 2];
-			if (vi.texcoordIndex != -1) {
-				vertices[vertexCount++] = obj.texcoords[texcoordIndex];
-				vertices[vertexCount++] = obj.texcoords[texcoordIndex + 1];
-			}
-			if (vi.normalIndex != -1) {
-				vertices[vertexCount++] = obj.normals[normalIndex];
-				vertices[vertexCount++] = obj.normals[normalIndex + 1];
-				vertices[vertexCount++] = obj.normals[normalIndex + 2];
-			}
+			indices[indexCount] = vertexCount;
+			uniqueVertices[vertexCount++] = vi;
 existingVertex:;
 		}
 	}
@@ -212,16 +277,19 @@ existingVertex:;
 	printf("numFaces: %d, vertexCount: %d, indexCount: %d.\n", obj.numFaces, vertexCount, indexCount);
 
 	struct Model *model = malloc(sizeof(struct Model));
-	model->stride = sizeof(GLfloat) * (3 + 2 * !!obj.texcoordsSize + 3 * !!obj.normalsSize);
+	model->arena = arena;
+	model->id = arena->numModels++;
 	model->indexCount = indexCount;
-	// Copy geometry to the GPU
-	glGenBuffers(1, &model->vertexBuffer);
-	glBindBuffer(GL_ARRAY_BUFFER, model->vertexBuffer);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * vertexCount, vertices, GL_STATIC_DRAW);
-	free(vertices);
-	glGenBuffers(1, &model->indexBuffer);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, model->indexBuffer);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int) * indexCount, indices, GL_STATIC_DRAW);
+	// Append the geometry to the arena, with indices relative to the first vertex of the model
+	GLint baseVertex = packVertices(model, &obj, uniqueVertices, vertexCount);
+	free(uniqueVertices);
+	// Indices fitting in 16 bits halve the index data
+	model->indexType = vertexCount <= 0x10000 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+	if (model->indexType == GL_UNSIGNED_SHORT) {
+		uint16_t *shortIndices = (uint16_t *) indices;
+		for (unsigned int i = 0; i < indexCount; ++i) shortIndices[i] = indices[i];
+	}
+	unsigned int firstIndex = geometryArenaAddIndices(arena, indices, indexCount, model->indexType);
 	free(indices);
 
 	struct ObjGroup defaultGroup = { 0, -1, 0 };
@@ -244,7 +312,8 @@ existingVertex:;
 	group = obj.groupHead;
 	for (int i = 0; i < numParts; ++i) {
 		struct ModelPart *part = parts + i;
-		part->offset = group->faceIndex * 3;
+		part->firstIndex = firstIndex + group->faceIndex * 3;
+		part->baseVertex = baseVertex;
 		part->count = ((group->next ? group->next->faceIndex : obj.numFaces) - group->faceIndex) * 3;
 		part->material = group->materialIndex >= 0 ? model->materials + group->materialIndex : &defaultMaterial;
 
@@ -267,7 +336,5 @@ existingVertex:;
 }
 
 void destroyModel(struct Model *model) {
-	GLuint buffers[] = { model->vertexBuffer, model->indexBuffer };
-	glDeleteBuffers(2, buffers);
 	free(model);
 }
@@ -2,28 +2,46 @@
 #define MODEL_H
 
 #include <GL/glew.h>
+#include "geometryArena.h"
 
 struct Material {
 	float diffuse[3];
 };
 
 typedef struct ModelPart {
-	unsigned int count, offset;
+	/** The number of indices, and the first within the index buffer of the arena, counted in indices of the model. */
+	unsigned int count, firstIndex;
+	/** The vertex within the arena that the indices are relative to. */
+	GLint baseVertex;
 	const struct Material *material;
 } ModelPart;
 
+/**
+ * A mesh with compressed vertices, stored in a geometry arena.
+ *
+ * Positions and texture coordinates are quantized to normalized 16-bit integers over the bounds of the model,
+ * and are decoded by scaling and offsetting them. Normals are packed into 32 bits,
+ * and indices are 16-bit whenever the vertices fit.
+ */
 typedef struct Model {
-	GLuint vertexBuffer, indexBuffer;
+	struct GeometryArena *arena;
+	/** Numbers the model among those of its arena, identifying it in sort keys. */
+	unsigned int id;
 	size_t indexCount;
-	GLsizei stride;
+	GLenum indexType;
+	/** Decodes positions as scale * stored + bias. */
+	float positionScale[3], positionBias[3];
+	float texcoordScale[2], texcoordBias[2];
 	int numParts;
 	struct ModelPart *parts;
 	struct Material *materials;
 	float radius;
 } Model;
 
-struct Model *loadModelFromObj(char *path);
+/** Loads a model, appending its geometry to the arena. */
+struct Model *loadModelFromObj(struct GeometryArena *arena, char *path);
 
+/** Frees the model; its geometry stays in the arena. */
 void destroyModel(struct Model *model);
 
 #endif
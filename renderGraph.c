@@ -0,0 +1,305 @@
+#include "renderGraph.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <assert.h>
+
+/** The number of frames a cached texture or framebuffer is kept without being used. */
+#define KEEP_FRAMES 60
+
+void renderGraphInit(struct RenderGraph *graph) {
+	graph->numResources = graph->numPasses = graph->numOrdered = 0;
+	graph->numTextures = graph->numFramebuffers = 0;
+	graph->defaultFramebuffer = 0;
+	graph->profiler = 0;
+}
+
+void renderGraphDestroy(struct RenderGraph *graph) {
+	for (int i = 0; i < graph->numFramebuffers; ++i) glDeleteFramebuffers(1, &graph->framebuffers[i].framebuffer);
+	for (int i = 0; i < graph->numTextures; ++i) glDeleteTextures(1, &graph->textures[i].texture);
+}
+
+void renderGraphClear(struct RenderGraph *graph) {
+	graph->numResources = graph->numPasses = graph->numOrdered = 0;
+}
+
+static int addResource(struct RenderGraph *graph, const char *name, struct RenderGraphTextureDesc desc, int imported, GLuint texture) {
+	assert(graph->numResources < RENDER_GRAPH_MAX_RESOURCES && "Too many render graph resources.");
+	struct RenderGraphResource *resource = graph->resources + graph->numResources;
+	resource->name = name;
+	resource->desc = desc;
+	resource->imported = imported;
+	resource->texture = texture;
+	return graph->numResources++;
+}
+
+int renderGraphCreateTexture(struct RenderGraph *graph, const char *name, struct RenderGraphTextureDesc desc) {
+	return addResource(graph, name, desc, 0, 0);
+}
+
+int renderGraphImportTexture(struct RenderGraph *graph, const char *name, GLuint texture, int width, int height) {
+	struct RenderGraphTextureDesc desc = { width, height, 0, 0, 0 };
+	return addResource(graph, name, desc, 1, texture);
+}
+
+int renderGraphAddPass(struct RenderGraph *graph, const char *name, RenderGraphPassCallback callback, void *data) {
+	assert(graph->numPasses < RENDER_GRAPH_MAX_PASSES && "Too many render graph passes.");
+	struct RenderGraphPass *pass = graph->passes + graph->numPasses;
+	pass->name = name;
+	pass->callback = callback;
+	pass->data = data;
+	pass->numInputs = 0;
+	pass->color = pass->depth = -1;
+	pass->writesDepth = 0;
+	return graph->numPasses++;
+}
+
+void renderGraphRead(struct RenderGraph *graph, int pass, int resource) {
+	struct RenderGraphPass *p = graph->passes + pass;
+	assert(p->numInputs < RENDER_GRAPH_MAX_INPUTS && "Too many inputs to the pass.");
+	p->inputs[p->numInputs++] = resource;
+}
+
+void renderGraphWrite(struct RenderGraph *graph, int pass, int resource) {
+	graph->passes[pass].color = resource;
+}
+
+void renderGraphDepth(struct RenderGraph *graph, int pass, int resource, int write) {
+	graph->passes[pass].depth = resource;
+	graph->passes[pass].writesDepth = write;
+}
+
+/** Returns the number of resources the pass reads, storing them in \p reads. */
+static int getReads(const struct RenderGraphPass *pass, int *reads) {
+	int count = 0;
+	for (int i = 0; i < pass->numInputs; ++i) reads[count++] = pass->inputs[i];
+	if (pass->depth != -1 && !pass->writesDepth) reads[count++] = pass->depth;
+	return count;
+}
+
+/** Returns the number of resources the pass writes, storing them in \p writes. */
+static int getWrites(const struct RenderGraphPass *pass, int *writes) {
+	int count = 0;
+	if (pass->color != -1) writes[count++] = pass->color;
+	if (pass->depth != -1 && pass->writesDepth) writes[count++] = pass->depth;
+	return count;
+}
+
+static void cullPasses(struct RenderGraph *graph) {
+	int reads[RENDER_GRAPH_MAX_INPUTS + 1], writes[2];
+	// Resources are referenced by the passes reading them, and imported ones by the world outside the frame
+	for (int i = 0; i < graph->numResources; ++i) graph->resources[i].refCount = graph->resources[i].imported;
+	for (int i = 0; i < graph->numPasses; ++i) {
+		struct RenderGraphPass *pass = graph->passes + i;
+		pass->culled = 0;
+		pass->refCount = getWrites(pass, writes);
+		for (int j = 0, numReads = getReads(pass, reads); j < numReads; ++j) ++graph->resources[reads[j]].refCount;
+	}
+
+	// Cull the writers of unreferenced resources, which may leave what they read unreferenced in turn
+	int stack[RENDER_GRAPH_MAX_RESOURCES], size = 0;
+	for (int i = 0; i < graph->numResources; ++i) if (!graph->resources[i].refCount) stack[size++] = i;
+	while (size > 0) {
+		int resource = stack[--size];
+		for (int i = 0; i < graph->numPasses; ++i) {
+			struct RenderGraphPass *pass = graph->passes + i;
+			if (pass->culled || (pass->color != resource && !(pass->depth == resource && pass->writesDepth))) continue;
+			if (--pass->refCount > 0) continue;
+			pass->culled = 1;
+			for (int j = 0, numReads = getReads(pass, reads); j < numReads; ++j) {
+				if (--graph->resources[reads[j]].refCount == 0) stack[size++] = reads[j];
+			}
+		}
+	}
+}
+
+static void orderPasses(struct RenderGraph *graph) {
+	int reads[RENDER_GRAPH_MAX_INPUTS + 1], writes[2];
+	// Each access depends on the last write before it, and each write on the reads since the last write
+	uint32_t dependencies[RENDER_GRAPH_MAX_PASSES], readers[RENDER_GRAPH_MAX_RESOURCES];
+	int lastWriter[RENDER_GRAPH_MAX_RESOURCES];
+	for (int i = 0; i < graph->numResources; ++i) {
+		readers[i] = 0;
+		lastWriter[i] = -1;
+	}
+	for (int i = 0; i < graph->numPasses; ++i) {
+		struct RenderGraphPass *pass = graph->passes + i;
+		dependencies[i] = 0;
+		if (pass->culled) continue;
+		for (int j = 0, numReads = getReads(pass, reads); j < numReads; ++j) {
+			int r = reads[j];
+			assert((graph->resources[r].imported || lastWriter[r] != -1) && "Transient texture read before being written.");
+			if (lastWriter[r] != -1) dependencies[i] |= 1u << lastWriter[r];
+			readers[r] |= 1u << i;
+		}
+		for (int j = 0, numWrites = getWrites(pass, writes); j < numWrites; ++j) {
+			int r = writes[j];
+			if (lastWriter[r] != -1) dependencies[i] |= 1u << lastWriter[r];
+			dependencies[i] |= readers[r] & ~(1u << i);
+			lastWriter[r] = i;
+			readers[r] = 0;
+		}
+	}
+
+	// Topological sort, preferring the order of declaration among ready passes
+	uint32_t scheduled = 0;
+	graph->numOrdered = 0;
+	for (;;) {
+		int next = -1;
+		for (int i = 0; i < graph->numPasses; ++i) {
+			if (graph->passes[i].culled || scheduled & 1u << i) continue;
+			if ((dependencies[i] & ~scheduled) == 0) {
+				next = i;
+				break;
+			}
+		}
+		if (next == -1) break;
+		scheduled |= 1u << next;
+		graph->order[graph->numOrdered++] = next;
+	}
+}
+
+static int isDescEqual(const struct RenderGraphTextureDesc *a, const struct RenderGraphTextureDesc *b) {
+	return a->width == b->width && a->height == b->height && a->format == b->format
+		&& a->type == b->type && a->filter == b->filter;
+}
+
+static int createTexture(struct RenderGraph *graph, struct RenderGraphTextureDesc desc) {
+	assert(graph->numTextures < RENDER_GRAPH_MAX_TEXTURES && "Too many render graph textures.");
+	struct RenderGraphTexture *texture = graph->textures + graph->numTextures;
+	texture->desc = desc;
+	glGenTextures(1, &texture->texture);
+	glBindTexture(GL_TEXTURE_2D, texture->texture);
+	glTexImage2D(GL_TEXTURE_2D, 0, desc.format, desc.width, desc.height, 0, desc.format, desc.type, NULL);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, desc.filter);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, desc.filter);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	return graph->numTextures++;
+}
+
+static void assignTextures(struct RenderGraph *graph) {
+	int writes[2];
+	for (int i = 0; i < graph->numResources; ++i) graph->resources[i].firstUse = graph->resources[i].lastUse = -1;
+	for (int k = 0; k < graph->numOrdered; ++k) {
+		const struct RenderGraphPass *pass = graph->passes + graph->order[k];
+		int resources[RENDER_GRAPH_MAX_INPUTS + 3], count = getReads(pass, resources);
+		for (int j = 0, numWrites = getWrites(pass, writes); j < numWrites; ++j) resources[count++] = writes[j];
+		for (int j = 0; j < count; ++j) {
+			struct RenderGraphResource *resource = graph->resources + resources[j];
+			if (resource->firstUse == -1) resource->firstUse = k;
+			resource->lastUse = k;
+		}
+	}
+
+	// Alias transient resources onto textures freed by resources whose last use came before their first
+	for (int i = 0; i < graph->numTextures; ++i) graph->textures[i].busyUntil = -1;
+	int used[RENDER_GRAPH_MAX_TEXTURES] = { 0 };
+	for (int k = 0; k < graph->numOrdered; ++k) {
+		for (int i = 0; i < graph->numResources; ++i) {
+			struct RenderGraphResource *resource = graph->resources + i;
+			if (resource->imported || resource->firstUse != k) continue;
+			int t;
+			for (t = 0; t < graph->numTextures; ++t) {
+				if (graph->textures[t].busyUntil < k && isDescEqual(&graph->textures[t].desc, &resource->desc)) break;
+			}
+			if (t == graph->numTextures) t = createTexture(graph, resource->desc);
+			graph->textures[t].busyUntil = resource->lastUse;
+			resource->texture = graph->textures[t].texture;
+			used[t] = 1;
+		}
+	}
+
+	// Release textures that have gone unused for a while, such as those of a previous screen size
+	for (int t = 0; t < graph->numTextures; ++t) {
+		struct RenderGraphTexture *texture = graph->textures + t;
+		if (used[t]) {
+			texture->unusedFrames = 0;
+			continue;
+		}
+		if (++texture->unusedFrames <= KEEP_FRAMES) continue;
+		for (int i = 0; i < graph->numFramebuffers; ++i) {
+			struct RenderGraphFramebuffer *framebuffer = graph->framebuffers + i;
+			if (framebuffer->color != texture->texture && framebuffer->depth != texture->texture) continue;
+			glDeleteFramebuffers(1, &framebuffer->framebuffer);
+			*framebuffer = graph->framebuffers[--graph->numFramebuffers];
+			--i;
+		}
+		glDeleteTextures(1, &texture->texture);
+		*texture = graph->textures[--graph->numTextures];
+		used[t] = used[graph->numTextures];
+		--t;
+	}
+}
+
+static void assignFramebuffers(struct RenderGraph *graph) {
+	int used[RENDER_GRAPH_MAX_FRAMEBUFFERS] = { 0 };
+	for (int k = 0; k < graph->numOrdered; ++k) {
+		struct RenderGraphPass *pass = graph->passes + graph->order[k];
+		GLuint color = pass->color != -1 ? graph->resources[pass->color].texture : 0,
+			   depth = pass->depth != -1 ? graph->resources[pass->depth].texture : 0;
+		if (!color && !depth) {
+			pass->framebuffer = graph->defaultFramebuffer;
+			continue;
+		}
+		int i;
+		for (i = 0; i < graph->numFramebuffers; ++i) {
+			if (graph->framebuffers[i].color == color && graph->framebuffers[i].depth == depth) break;
+		}
+		if (i == graph->numFramebuffers) {
+			assert(graph->numFramebuffers < RENDER_GRAPH_MAX_FRAMEBUFFERS && "Too many render graph framebuffers.");
+			struct RenderGraphFramebuffer *framebuffer = graph->framebuffers + graph->numFramebuffers++;
+			framebuffer->color = color;
+			framebuffer->depth = depth;
+			glGenFramebuffers(1, &framebuffer->framebuffer);
+			glBindFramebuffer(GL_FRAMEBUFFER, framebuffer->framebuffer);
+			if (color) glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, color, 0);
+			if (depth) glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depth, 0);
+			if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+				printf("Error creating framebuffer for pass %s.\n", pass->name);
+			}
+		}
+		pass->framebuffer = graph->framebuffers[i].framebuffer;
+		used[i] = 1;
+	}
+
+	for (int i = 0; i < graph->numFramebuffers; ++i) {
+		struct RenderGraphFramebuffer *framebuffer = graph->framebuffers + i;
+		if (used[i]) {
+			framebuffer->unusedFrames = 0;
+			continue;
+		}
+		if (++framebuffer->unusedFrames <= KEEP_FRAMES) continue;
+		glDeleteFramebuffers(1, &framebuffer->framebuffer);
+		*framebuffer = graph->framebuffers[--graph->numFramebuffers];
+		used[i] = used[graph->numFramebuffers];
+		--i;
+	}
+}
+
+void renderGraphCompile(struct RenderGraph *graph) {
+	cullPasses(graph);
+	orderPasses(graph);
+	assignTextures(graph);
+	assignFramebuffers(graph);
+}
+
+void renderGraphExecute(const struct RenderGraph *graph) {
+	for (int k = 0; k < graph->numOrdered; ++k) {
+		const struct RenderGraphPass *pass = graph->passes + graph->order[k];
+		glBindFramebuffer(GL_FRAMEBUFFER, pass->framebuffer);
+		int target = pass->color != -1 ? pass->color : pass->depth;
+		if (target != -1) glViewport(0, 0, graph->resources[target].desc.width, graph->resources[target].desc.height);
+		for (int i = pass->numInputs - 1; i >= 0; --i) {
+			glActiveTexture(GL_TEXTURE0 + i);
+			glBindTexture(GL_TEXTURE_2D, graph->resources[pass->inputs[i]].texture);
+		}
+		glActiveTexture(GL_TEXTURE0);
+		gpuProfilerBegin(graph->profiler, pass->name);
+		pass->callback(pass->data, graph, pass);
+		gpuProfilerEnd(graph->profiler);
+	}
+}
+
+GLuint renderGraphGetTexture(const struct RenderGraph *graph, int resource) {
+	return graph->resources[resource].texture;
+}
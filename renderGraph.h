@@ -0,0 +1,139 @@
+#ifndef RENDER_GRAPH_H
+#define RENDER_GRAPH_H
+
+#include <GL/glew.h>
+#include "gpuProfiler.h"
+
+#define RENDER_GRAPH_MAX_PASSES 32
+#define RENDER_GRAPH_MAX_RESOURCES 32
+/** The most textures a pass can sample, bound to consecutive texture units. */
+#define RENDER_GRAPH_MAX_INPUTS 8
+#define RENDER_GRAPH_MAX_TEXTURES 32
+#define RENDER_GRAPH_MAX_FRAMEBUFFERS 32
+
+struct RenderGraph;
+struct RenderGraphPass;
+
+/**
+ * Records the commands of a pass.
+ * The framebuffer and viewport of the pass are bound, and its inputs are bound to the texture units in order,
+ * leaving the first unit active.
+ */
+typedef void (*RenderGraphPassCallback)(void *data, const struct RenderGraph *graph, const struct RenderGraphPass *pass);
+
+struct RenderGraphTextureDesc {
+	int width, height;
+	/** The format and type of the pixels, such as GL_RGB and GL_UNSIGNED_BYTE. */
+	GLenum format, type;
+	GLint filter;
+};
+
+/** A texture that passes read and write, valid for one frame. */
+struct RenderGraphResource {
+	const char *name;
+	struct RenderGraphTextureDesc desc;
+	/** Whether the texture is owned outside the graph, in which case it outlives the frame and is never aliased. */
+	int imported;
+	/** The texture backing the resource, which transient resources get when the graph is compiled. */
+	GLuint texture;
+	int refCount;
+	/** The first and last positions in the execution order of the passes that use the resource. */
+	int firstUse, lastUse;
+};
+
+struct RenderGraphPass {
+	const char *name;
+	RenderGraphPassCallback callback;
+	void *data;
+	/** The resources sampled by the pass. */
+	int inputs[RENDER_GRAPH_MAX_INPUTS];
+	int numInputs;
+	/** The color and depth attachments, or -1 for none. */
+	int color, depth;
+	/** Whether the pass writes the depth attachment, rather than only testing against it. */
+	int writesDepth;
+	int refCount, culled;
+	GLuint framebuffer;
+};
+
+/** A texture allocated by the graph, kept between frames and shared by transient resources whose uses do not overlap. */
+struct RenderGraphTexture {
+	GLuint texture;
+	struct RenderGraphTextureDesc desc;
+	/** The position of the last pass using the texture in the current frame, or -1 if free. */
+	int busyUntil;
+	int unusedFrames;
+};
+
+struct RenderGraphFramebuffer {
+	GLuint framebuffer, color, depth;
+	int unusedFrames;
+};
+
+/**
+ * Orders the passes of a frame by the textures they read and write,
+ * culls the passes whose results are never used and allocates the textures only needed within the frame.
+ *
+ * The passes are declared anew every frame, while the textures and framebuffers are cached between frames.
+ */
+struct RenderGraph {
+	struct RenderGraphResource resources[RENDER_GRAPH_MAX_RESOURCES];
+	int numResources;
+	struct RenderGraphPass passes[RENDER_GRAPH_MAX_PASSES];
+	int numPasses;
+	/** The passes that are not culled, in execution order. */
+	int order[RENDER_GRAPH_MAX_PASSES];
+	int numOrdered;
+
+	struct RenderGraphTexture textures[RENDER_GRAPH_MAX_TEXTURES];
+	int numTextures;
+	struct RenderGraphFramebuffer framebuffers[RENDER_GRAPH_MAX_FRAMEBUFFERS];
+	int numFramebuffers;
+	/** The framebuffer passes without attachments render to, which is normally the default one. */
+	GLuint defaultFramebuffer;
+	/** Times each executed pass under its name, if not null. */
+	struct GpuProfiler *profiler;
+};
+
+void renderGraphInit(struct RenderGraph *graph);
+
+void renderGraphDestroy(struct RenderGraph *graph);
+
+/** Removes the passes and resources of the last frame, to start declaring those of the next. */
+void renderGraphClear(struct RenderGraph *graph);
+
+/** Declares a texture that only lives within the frame, returning its handle. */
+int renderGraphCreateTexture(struct RenderGraph *graph, const char *name, struct RenderGraphTextureDesc desc);
+
+/**
+ * Declares a texture owned outside the graph, which must stay alive as long as the graph.
+ * Writes to imported textures are results of the frame, so passes making them are never culled.
+ * @param texture The texture, or zero for the default framebuffer of the graph.
+ */
+int renderGraphImportTexture(struct RenderGraph *graph, const char *name, GLuint texture, int width, int height);
+
+/** Declares a pass, returning its handle. Passes have to be declared after those whose results they use. */
+int renderGraphAddPass(struct RenderGraph *graph, const char *name, RenderGraphPassCallback callback, void *data);
+
+/** Samples the resource in the pass, bound to the texture unit after those of the previous inputs. */
+void renderGraphRead(struct RenderGraph *graph, int pass, int resource);
+
+/** Renders to the resource, keeping its contents if an earlier pass wrote it. */
+void renderGraphWrite(struct RenderGraph *graph, int pass, int resource);
+
+/**
+ * Attaches the resource as the depth buffer of the pass.
+ * @param write Whether the pass writes depths, or only tests against them.
+ */
+void renderGraphDepth(struct RenderGraph *graph, int pass, int resource, int write);
+
+/** Culls unused passes, orders the rest and assigns textures and framebuffers to them. */
+void renderGraphCompile(struct RenderGraph *graph);
+
+/** Executes the passes in order, timing each with the profiler of the graph. */
+void renderGraphExecute(const struct RenderGraph *graph);
+
+/** Returns the texture backing a resource, once the graph is compiled. */
+GLuint renderGraphGetTexture(const struct RenderGraph *graph, int resource);
+
+#endif
@@ -0,0 +1,121 @@
+#include "renderQueue.h"
+#include <stdlib.h>
+#include <assert.h>
+
+#define DEPTH_SHIFT 0
+#define MATERIAL_SHIFT (DEPTH_SHIFT + RENDER_KEY_DEPTH_BITS)
+#define MODEL_SHIFT (MATERIAL_SHIFT + RENDER_KEY_MATERIAL_BITS)
+#define PROGRAM_SHIFT (MODEL_SHIFT + RENDER_KEY_MODEL_BITS)
+#define PASS_SHIFT (PROGRAM_SHIFT + RENDER_KEY_PROGRAM_BITS)
+
+#define RADIX_BITS 8
+#define RADIX_SIZE (1 << RADIX_BITS)
+#define NUM_DIGITS (64 / RADIX_BITS)
+
+// Keys of depth-only passes have the depth right below the program, then the model, and no material
+#define DEPTH_KEY_DEPTH_SHIFT (PROGRAM_SHIFT - RENDER_KEY_DEPTH_BITS)
+#define DEPTH_KEY_MODEL_SHIFT (DEPTH_KEY_DEPTH_SHIFT - RENDER_KEY_MODEL_BITS)
+
+static uint32_t quantizeDepth(float depth) {
+	const uint32_t maxDepth = (1u << RENDER_KEY_DEPTH_BITS) - 1;
+	return depth <= 0.0f ? 0 : depth >= 1.0f ? maxDepth : (uint32_t) (depth * maxDepth);
+}
+
+uint64_t renderKey(unsigned int pass, unsigned int program, unsigned int model, unsigned int material, float depth) {
+	assert(pass < 1u << RENDER_KEY_PASS_BITS && program < 1u << RENDER_KEY_PROGRAM_BITS
+			&& model < 1u << RENDER_KEY_MODEL_BITS && material < 1u << RENDER_KEY_MATERIAL_BITS
+			&& "Sort key field out of range.");
+	uint32_t quantizedDepth = quantizeDepth(depth);
+	return (uint64_t) pass << PASS_SHIFT | (uint64_t) program << PROGRAM_SHIFT
+		| (uint64_t) model << MODEL_SHIFT | (uint64_t) material << MATERIAL_SHIFT
+		| (uint64_t) quantizedDepth << DEPTH_SHIFT;
+}
+
+uint64_t renderDepthKey(unsigned int pass, unsigned int program, unsigned int model, float depth) {
+	assert(pass < 1u << RENDER_KEY_PASS_BITS && program < 1u << RENDER_KEY_PROGRAM_BITS
+			&& model < 1u << RENDER_KEY_MODEL_BITS && "Sort key field out of range.");
+	return (uint64_t) pass << PASS_SHIFT | (uint64_t) program << PROGRAM_SHIFT
+		| (uint64_t) quantizeDepth(depth) << DEPTH_KEY_DEPTH_SHIFT | (uint64_t) model << DEPTH_KEY_MODEL_SHIFT;
+}
+
+unsigned int renderKeyPass(uint64_t key) {
+	return key >> PASS_SHIFT;
+}
+
+void renderQueueInit(struct RenderQueue *queue) {
+	queue->commands = queue->scratch = 0;
+	queue->count = queue->capacity = 0;
+}
+
+void renderQueueDestroy(struct RenderQueue *queue) {
+	free(queue->commands);
+	free(queue->scratch);
+}
+
+void renderQueueClear(struct RenderQueue *queue) {
+	queue->count = 0;
+}
+
+void renderQueuePush(struct RenderQueue *queue, struct RenderCommand command) {
+	if (queue->count == queue->capacity) {
+		unsigned int capacity = queue->capacity ? 2 * queue->capacity : 256;
+		struct RenderCommand *commands = realloc(queue->commands, sizeof *commands * capacity),
+							 *scratch = realloc(queue->scratch, sizeof *scratch * capacity);
+		assert(commands && scratch && "Failed to reallocate array.");
+		queue->commands = commands;
+		queue->scratch = scratch;
+		queue->capacity = capacity;
+	}
+	queue->commands[queue->count++] = command;
+}
+
+void renderQueueSort(struct RenderQueue *queue) {
+	const unsigned int count = queue->count;
+	if (count < 2) return;
+
+	// Histogram all digits in a single read of the keys
+	unsigned int histograms[NUM_DIGITS][RADIX_SIZE] = { { 0 } };
+	for (unsigned int i = 0; i < count; ++i) {
+		uint64_t key = queue->commands[i].key;
+		for (int d = 0; d < NUM_DIGITS; ++d) ++histograms[d][key >> d * RADIX_BITS & (RADIX_SIZE - 1)];
+	}
+
+	struct RenderCommand *src = queue->commands, *dst = queue->scratch;
+	for (int d = 0; d < NUM_DIGITS; ++d) {
+		unsigned int *histogram = histograms[d];
+		const int shift = d * RADIX_BITS;
+		// All keys share this digit, so the pass would not change the order
+		if (histogram[src[0].key >> shift & (RADIX_SIZE - 1)] == count) continue;
+
+		// Exclusive prefix sum gives the first slot of each digit
+		unsigned int offset = 0;
+		for (int b = 0; b < RADIX_SIZE; ++b) {
+			unsigned int n = histogram[b];
+			histogram[b] = offset;
+			offset += n;
+		}
+		for (unsigned int i = 0; i < count; ++i) dst[histogram[src[i].key >> shift & (RADIX_SIZE - 1)]++] = src[i];
+
+		struct RenderCommand *tmp = src;
+		src = dst;
+		dst = tmp;
+	}
+	queue->commands = src;
+	queue->scratch = dst;
+}
+
+unsigned int renderQueueFindPass(const struct RenderQueue *queue, unsigned int pass, unsigned int *start) {
+	// Binary search for the first command of this pass and of the next
+	unsigned int bounds[2];
+	for (int i = 0; i < 2; ++i) {
+		unsigned int low = 0, high = queue->count;
+		while (low < high) {
+			unsigned int middle = low + (high - low) / 2;
+			if (renderKeyPass(queue->commands[middle].key) < pass + i) low = middle + 1;
+			else high = middle;
+		}
+		bounds[i] = low;
+	}
+	*start = bounds[0];
+	return bounds[1];
+}
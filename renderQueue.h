@@ -0,0 +1,75 @@
+#ifndef RENDER_QUEUE_H
+#define RENDER_QUEUE_H
+
+#include <stdint.h>
+
+struct Model;
+struct ModelPart;
+
+/*
+ * Layout of the sort keys, from the most significant bits down: pass, program, model, material, depth.
+ * Sorting by the key executes the passes in order, and within a pass changes the program,
+ * then the vertex buffers, then the material as rarely as possible, with the nearest drawn first.
+ * Keys of passes writing only depth put the depth above the model instead, see ::renderDepthKey.
+ */
+#define RENDER_KEY_PASS_BITS 4
+#define RENDER_KEY_PROGRAM_BITS 4
+#define RENDER_KEY_MODEL_BITS 16
+#define RENDER_KEY_MATERIAL_BITS 16
+#define RENDER_KEY_DEPTH_BITS 24
+
+/** One draw of a model part, for a run of instances in the instance data of the frame. */
+struct RenderCommand {
+	uint64_t key;
+	struct Model *model;
+	const struct ModelPart *part;
+	unsigned int first, count;
+};
+
+/** Draws submitted by the passes of a frame, sorted by key before being executed. */
+struct RenderQueue {
+	struct RenderCommand *commands;
+	/** Second buffer for the radix sort. */
+	struct RenderCommand *scratch;
+	unsigned int count, capacity;
+};
+
+/**
+ * Packs the sort key of a draw.
+ * @param depth The distance to the viewer in [0, 1]; values outside are clamped.
+ */
+uint64_t renderKey(unsigned int pass, unsigned int program, unsigned int model, unsigned int material, float depth);
+
+/**
+ * Packs the sort key of a draw of a pass writing only depth, which draws strictly front to back
+ * so that occluded fragments fail the depth test early. Draws at equal depths are ordered by model.
+ * @param depth The distance to the viewer in [0, 1]; values outside are clamped.
+ */
+uint64_t renderDepthKey(unsigned int pass, unsigned int program, unsigned int model, float depth);
+
+/** Returns the pass of a key. */
+unsigned int renderKeyPass(uint64_t key);
+
+void renderQueueInit(struct RenderQueue *queue);
+
+void renderQueueDestroy(struct RenderQueue *queue);
+
+void renderQueueClear(struct RenderQueue *queue);
+
+/** Appends a command, growing the queue if needed. */
+void renderQueuePush(struct RenderQueue *queue, struct RenderCommand command);
+
+/**
+ * Sorts the commands by key with a stable least significant digit radix sort.
+ * Digits shared by all keys are skipped, so that unused fields cost nothing.
+ */
+void renderQueueSort(struct RenderQueue *queue);
+
+/**
+ * Finds the commands of a pass in the sorted queue.
+ * @param start Receives the index of the first command of the pass.
+ * @return The index one past the last command of the pass.
+ */
+unsigned int renderQueueFindPass(const struct RenderQueue *queue, unsigned int pass, unsigned int *start);
+
+#endif
@@ -1,12 +1,20 @@
 #include "renderer.h"
 #include <stdlib.h>
 #include <math.h>
+#include <string.h>
+#include <assert.h>
 #include "glUtil.h"
 #include "pngloader.h"
+#ifdef __EMSCRIPTEN__
+#include <emscripten/html5.h>
+#endif
 
 #define DEGREES_TO_RADIANS(a) ((a) * M_PI / 180)
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
 #define MAX(a, b) ((a) > (b) ? (a) : (b))
+/** Expands a macro into a string literal, for sharing constants with shader sources. */
+#define STR(x) STR_(x)
+#define STR_(x) #x
 
 #define DEPTH_SIZE 1024
 #define Z_NEAR 1.0f
@@ -14,6 +22,16 @@
 #define FOV 90.0f
 #define NUM_FRUSTUM_CORNERS 8
 #define RENDER_MASK (POSITION_COMPONENT_MASK | MODEL_COMPONENT_MASK)
+/** The fraction of accumulated ambient occlusion kept each frame. */
+#define AO_HISTORY_WEIGHT 0.875f
+/** The number of frames before the ambient occlusion sample pattern repeats. */
+#define AO_SPIN_PERIOD 16
+#define GOLDEN_ANGLE 2.39996323f
+/** The size in pixels of the screen tiles motion blur is classified by. */
+#define VELOCITY_TILE_SIZE 16
+/** The index of the camera among the culled views; cascade i is view 1 + i. */
+#define CAMERA_VIEW 0
+#define NUM_VIEWS (1 + NUM_SPLITS)
 
 struct Frustum {
 	float neard;
@@ -117,12 +135,6 @@ static void getFrustumPoints(struct Frustum f, VECTOR center, VECTOR viewDir, VE
 	points[7] = VectorSubtract(VectorSubtract(fc, VectorMultiply(up, VectorReplicate(farHeight))), VectorMultiply(right, VectorReplicate(farWidth)));
 }
 
-struct Plane {
-	VECTOR normal;
-	/** The distance to the origin. */
-	float distance;
-};
-
 /**
  * Computes the planes of the frustum.
  * @param points The eight corners of the frustum.
@@ -150,106 +162,240 @@ static void getFrustumPlanes(VECTOR *points, struct Plane *planes) {
 }
 
 /**
- * Returns whether a sphere is inside a frustum.
- * @param planes The planes of the frustum.
- * @param center The center of the sphere.
- * @param radius The radius of the sphere.
+ * Builds a matrix for cropping the light's projection to the bounding sphere of a frustum slice.
+ * The size of the sphere does not change as the camera turns, and its center is snapped to whole
+ * shadow map texels, so that shadow edges do not shimmer as the camera moves.
+ * @param points Frustum corners
  */
-static int isSphereInFrustum(struct Plane *planes, VECTOR center, float radius) {
-	for (int i = 0; i < 6; ++i) {
-		float distance = Vector3Dot(planes[i].normal, center) + planes[i].distance;
-		if (distance < -radius) return 0;
+static float calculateCropMatrix(struct Frustum f, VECTOR *points, MATRIX lightView, MATRIX *shadowCPM) {
+	ALIGN(16) float vv[4];
+	VECTOR lightPoints[8], center = VectorReplicate(0.0f);
+	for (int i = 0; i < 8; ++i) {
+		lightPoints[i] = VectorTransform(points[i], lightView);
+		center = VectorAdd(center, lightPoints[i]);
 	}
-	return 1;
+	center = VectorDivide(center, VectorReplicate(8.0f));
+	float radius = 0.0f;
+	for (int i = 0; i < 8; ++i) radius = MAX(radius, Vector3Length(VectorSubtract(lightPoints[i], center)));
+	// Round up to keep float noise from changing the size
+	radius = ceilf(radius * 16.0f) / 16.0f;
+
+	VectorGet(vv, center);
+	const float texelSize = 2.0f * radius / DEPTH_SIZE,
+		  x = floorf(vv[0] / texelSize) * texelSize, y = floorf(vv[1] / texelSize) * texelSize,
+		  maxZ = vv[2] + radius, minZ = vv[2] - radius;
+	MATRIX lightProjection = MatrixOrtho(x - radius, x + radius, y - radius, y + radius, -maxZ, -minZ);
+	*shadowCPM = MatrixMultiply(lightProjection, lightView);
+
+	return minZ;
 }
 
+static int isMatrixEqual(MATRIX a, MATRIX b) {
+	ALIGN(16) float av[16], bv[16];
+	MatrixGet(av, a);
+	MatrixGet(bv, b);
+	return memcmp(av, bv, sizeof av) == 0;
+}
+
+static int isUniformBufferSupported() {
+#ifdef __EMSCRIPTEN__
+	return 0; // WebGL 1 has no uniform buffers
+#else
+	return GLEW_ARB_uniform_buffer_object;
+#endif
+}
+
+/** Binding points of the uniform blocks. */
+enum {
+	FRAME_DATA_BINDING,
+	CAMERA_DATA_BINDING,
+	SHADOW_DATA_BINDING
+};
+
+/** Constants that change every frame, laid out as the std140 FrameData block. */
+struct FrameData {
+	float invResolution[2];
+	float blurFactor, effectFactor;
+	/** The inverse size of the ambient occlusion targets. */
+	float aoInvResolution[2];
+	/** Rotation of the ambient occlusion sample pattern, which changes each frame. */
+	float aoSpinAngle;
+	float padding;
+};
+
+/** Constants of the camera, laid out as the std140 CameraData block. */
+struct CameraData {
+	float currentToPreviousMatrix[16];
+	float projInfo[4];
+	float clipInfo[3];
+	float projScale;
+};
+
+/** Constants of the shadow cascades, laid out as the std140 ShadowData block. */
+struct ShadowData {
+	float lightMVP[NUM_SPLITS][16];
+	/** Elements of arrays are padded to 16 bytes. */
+	float cascadeEndClipSpace[NUM_SPLITS][4];
+	float lightDir[3];
+	float padding;
+};
+
+static const struct UniformBlockMember frameDataMembers[] = {
+	{ "invResolution", GL_FLOAT_VEC2, 1, offsetof(struct FrameData, invResolution) },
+	{ "blurFactor", GL_FLOAT, 1, offsetof(struct FrameData, blurFactor) },
+	{ "effectFactor", GL_FLOAT, 1, offsetof(struct FrameData, effectFactor) },
+	{ "aoInvResolution", GL_FLOAT_VEC2, 1, offsetof(struct FrameData, aoInvResolution) },
+	{ "aoSpinAngle", GL_FLOAT, 1, offsetof(struct FrameData, aoSpinAngle) },
+}, cameraDataMembers[] = {
+	{ "currentToPreviousMatrix", GL_FLOAT_MAT4, 1, offsetof(struct CameraData, currentToPreviousMatrix) },
+	{ "projInfo", GL_FLOAT_VEC4, 1, offsetof(struct CameraData, projInfo) },
+	{ "clipInfo", GL_FLOAT_VEC3, 1, offsetof(struct CameraData, clipInfo) },
+	{ "projScale", GL_FLOAT, 1, offsetof(struct CameraData, projScale) },
+}, shadowDataMembers[] = {
+	{ "lightMVP", GL_FLOAT_MAT4, NUM_SPLITS, offsetof(struct ShadowData, lightMVP) },
+	{ "cascadeEndClipSpace", GL_FLOAT, NUM_SPLITS, offsetof(struct ShadowData, cascadeEndClipSpace) },
+	{ "lightDir", GL_FLOAT_VEC3, 1, offsetof(struct ShadowData, lightDir) },
+};
+
+/*
+ * Shader preludes defining how the blocks are declared,
+ * as uniform blocks backed by buffers or as plain uniforms of each program.
+ */
+static const GLchar *uniformBufferPrelude = "#extension GL_ARB_uniform_buffer_object : enable\n"
+	"#define UNIFORM_BLOCK(name) layout(std140) uniform name {\n"
+	"#define END_UNIFORM_BLOCK };\n"
+	"#define BLOCK_UNIFORM\n",
+	*plainUniformPrelude = "#define UNIFORM_BLOCK(name)\n"
+	"#define END_UNIFORM_BLOCK\n"
+	"#define BLOCK_UNIFORM uniform\n",
+	/** Macros declaring the blocks, which have to match the structs above. */
+	*uniformBlockDeclarations = "#define FRAME_DATA UNIFORM_BLOCK(FrameData) BLOCK_UNIFORM vec2 invResolution;"
+	" BLOCK_UNIFORM float blurFactor; BLOCK_UNIFORM float effectFactor; BLOCK_UNIFORM vec2 aoInvResolution;"
+	" BLOCK_UNIFORM float aoSpinAngle; END_UNIFORM_BLOCK\n"
+	"#define CAMERA_DATA UNIFORM_BLOCK(CameraData) BLOCK_UNIFORM mat4 currentToPreviousMatrix;"
+	" BLOCK_UNIFORM vec4 projInfo; BLOCK_UNIFORM vec3 clipInfo; BLOCK_UNIFORM float projScale; END_UNIFORM_BLOCK\n"
+	"#define SHADOW_DATA UNIFORM_BLOCK(ShadowData) BLOCK_UNIFORM mat4 lightMVP[NUM_CASCADES];"
+	" BLOCK_UNIFORM float cascadeEndClipSpace[NUM_CASCADES]; BLOCK_UNIFORM vec3 lightDir; END_UNIFORM_BLOCK\n";
+
 /**
- * Builds a matrix for cropping the light's projection.
- * @param points Frustum corners
+ * Declares the quantized vertex position and decodes it with the scale and bias of the model,
+ * which are declared along with the model matrix.
+ * Shared by the programs drawing models, since the main pass tests for depths equal to those of the depth pass.
  */
-static float calculateCropMatrix(struct Frustum f, VECTOR *points, MATRIX lightView, MATRIX *shadowCPM) {
-	ALIGN(16) float vv[4];
-	float maxZ = -INFINITY, minZ = INFINITY;
-	for (int i = 0; i < 8; ++i) {
-		VECTOR transf = VectorTransform(points[i], lightView);
-		VectorGet(vv, transf);
-		if (vv[2] < minZ) minZ = vv[2];
-		if (vv[2] > maxZ) maxZ = vv[2];
+static const GLchar *positionDecoding = "attribute vec3 position;"
+	"vec4 decodePosition() { return vec4(positionBias + positionScale * position, 1.0); }";
+
+static int isBaseVertexSupported() {
+#ifdef __EMSCRIPTEN__
+	return 0;
+#else
+	return GLEW_VERSION_3_2 || GLEW_ARB_draw_elements_base_vertex;
+#endif
+}
+
+static int isMultiDrawIndirectSupported() {
+#ifdef __EMSCRIPTEN__
+	return 0;
+#else
+	return GLEW_VERSION_4_3 || (GLEW_ARB_multi_draw_indirect && GLEW_ARB_base_instance);
+#endif
+}
+
+static int isInstancingSupported() {
+#ifdef __EMSCRIPTEN__
+	return emscripten_webgl_enable_extension(emscripten_webgl_get_current_context(), "ANGLE_instanced_arrays");
+#else
+	return GLEW_VERSION_3_3;
+#endif
+}
+
+/** Sizes the ambient occlusion history for the screen size and quality; the other targets are sized by the render graph. */
+static void resizeAmbientOcclusion(struct Renderer *renderer) {
+	renderer->aoWidth = MAX(renderer->width >> renderer->ssaoQuality, 1);
+	renderer->aoHeight = MAX(renderer->height >> renderer->ssaoQuality, 1);
+	for (int i = 0; i < 2; ++i) {
+		glBindTexture(GL_TEXTURE_2D, renderer->aoHistory[i]);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, renderer->aoWidth, renderer->aoHeight, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
 	}
+	renderer->aoHistoryValid = 0;
+}
 
-	// Set the projection matrix with the new z-bounds
-	MATRIX lightProjection = MatrixOrtho(-1.0f, 1.0f, -1.0f, 1.0f, -maxZ, -minZ);
-	MATRIX lightViewProjection = MatrixMultiply(lightProjection, lightView);
+static void drawFullscreenQuad(struct Renderer *renderer) {
+	vertexArrayBind(&renderer->quadArray);
+	glDrawArrays(GL_TRIANGLES, 0, 6);
+	vertexArrayUnbind(&renderer->quadArray);
+}
 
-	// Find extents of frustum slice in light's homogeneous coordinates
-	float minX = INFINITY, maxX = -INFINITY, minY = INFINITY, maxY = -INFINITY;
-	for (int i = 0; i < 8; ++i) {
-		VECTOR v = VectorTransform(points[i], lightViewProjection);
-		VectorGet(vv, v);
-		vv[0] /= vv[3];
-		vv[1] /= vv[3];
-		if (vv[0] < minX) minX = vv[0];
-		if (vv[0] > maxX) maxX = vv[0];
-		if (vv[1] < minY) minY = vv[1];
-		if (vv[1] > maxY) maxY = vv[1];
-	}
-
-	float scaleX = 2.0f / (maxX - minX),
-		  scaleY = 2.0f / (maxY - minY),
-		  offsetX = -0.5f * (maxX + minX) * scaleX,
-		  offsetY = -0.5f * (maxY + minY) * scaleY;
-	MATRIX cropMatrix = MatrixSet(
-			scaleX, 0.0f, 0.0f, 0.0f,
-			0.0f, scaleY, 0.0f, 0.0f,
-			0.0f, 0.0f, 1.0f, 0.0f,
-			offsetX, offsetY, 0.0f, 1.0f);
-	*shadowCPM = MatrixMultiply(cropMatrix, lightViewProjection);
+/** Points the per-instance attributes at a run of instances in the instance buffer. The geometry array has to be bound. */
+static void bindInstances(struct Renderer *renderer, unsigned int first) {
+	const GLsizei stride = sizeof(GLfloat) * INSTANCE_FLOATS;
+	const GLuint buffer = renderer->instanceAttribBuffer = renderer->instanceStream.buffer;
+	for (int i = 0; i < 4; ++i) {
+		vertexArrayAttrib(&renderer->geometryArray, ATTRIB_MODEL + i, buffer, 4, GL_FLOAT, GL_FALSE,
+				stride, stride * first + sizeof(GLfloat) * 4 * i, 1);
+	}
+	vertexArrayAttrib(&renderer->geometryArray, ATTRIB_POSITION_SCALE, buffer, 3, GL_FLOAT, GL_FALSE,
+			stride, stride * first + sizeof(GLfloat) * 16, 1);
+	vertexArrayAttrib(&renderer->geometryArray, ATTRIB_POSITION_BIAS, buffer, 3, GL_FLOAT, GL_FALSE,
+			stride, stride * first + sizeof(GLfloat) * 20, 1);
+}
 
-	return minZ;
+/**
+ * Points the vertex attributes at the vertices of the geometry arena, starting at \p baseVertex.
+ * The geometry array has to be bound.
+ */
+static void bindVertices(struct Renderer *renderer, GLint baseVertex) {
+	const struct GeometryArena *arena = &renderer->geometry;
+	const size_t offset = arena->stride * baseVertex;
+	vertexArrayAttrib(&renderer->geometryArray, ATTRIB_POSITION, arena->vertexBuffer, arena->position.size, arena->position.type,
+			arena->position.normalized, arena->stride, offset + arena->position.offset, 0);
+	// Also fetched by the depth program, which ignores it
+	vertexArrayAttrib(&renderer->geometryArray, ATTRIB_NORMAL, arena->vertexBuffer, arena->normal.size, arena->normal.type,
+			arena->normal.normalized, arena->stride, offset + arena->normal.offset, 0);
 }
 
 void rendererResize(struct Renderer *renderer, int width, int height) {
-	ALIGN(16) float mv[16];
 	renderer->width = width;
 	renderer->height = height;
 	renderer->projection = MatrixPerspective(FOV, (float) width / height, Z_NEAR, Z_FAR);
-
-	glUseProgram(renderer->ssaoProgram);
-	const float projScale = width / (-2.0f * tanf(DEGREES_TO_RADIANS(0.5f * FOV)));
-	glUniform1f(glGetUniformLocation(renderer->ssaoProgram, "projScale"), projScale);
-	MatrixGet(mv, renderer->projection);
-	glUniform4f(glGetUniformLocation(renderer->ssaoProgram, "projInfo"), 2.0f / (width * mv[0]), 2.0f / (height * mv[5]), -1.0f / mv[0], -1.0f / mv[5]);
-	glUniform2f(glGetUniformLocation(renderer->ssaoProgram, "invResolution"), 1.0f / width, 1.0f / height);
-
-	glBindTexture(GL_TEXTURE_2D, renderer->depthTexture);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, width, height, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, NULL);
-	glBindTexture(GL_TEXTURE_2D, renderer->sceneTexture);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
-	glBindTexture(GL_TEXTURE_2D, renderer->ssaoTexture);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
-	glBindTexture(GL_TEXTURE_2D, renderer->blurTexture);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+	resizeAmbientOcclusion(renderer);
 }
 
 int rendererInit(struct Renderer *renderer, struct EntityManager *manager, int width, int height) {
 	ALIGN(16) float vv[4], mv[16];
 	renderer->manager = manager;
+	renderer->alpha = 1.0f;
+	renderer->worldMatrices = 0;
+	renderer->visibility = 0;
+	sphereArrayInit(&renderer->bounds);
+	renderer->worldCapacity = 0;
+	renderer->drawOrder = 0;
+	renderer->instanceData = 0;
+	renderer->instanceGroups = 0;
+	renderer->numInstances = renderer->numInstanceGroups = renderer->instanceCapacity = 0;
+	renderQueueInit(&renderer->queue);
+	renderGraphInit(&renderer->graph);
+	renderer->profiler = 0;
+	glGenBuffers(1, &renderer->indirectBuffer);
+	renderer->indirectCommands = 0;
+	renderer->indirectCapacity = 0;
+	geometryArenaInit(&renderer->geometry);
 	renderer->width = width;
 	renderer->height = height;
-	const GLchar *vertexShaderSource = "attribute vec3 position;"
-		"attribute vec3 normal;"
-		"uniform mat4 mvp;"
-		"uniform mat4 model;"
-		"uniform vec3 lightDir;"
+	renderer->ssaoQuality = SSAO_HALF;
+	// Transforms the same way as the depth program, since the main pass tests for equal depths
+	const GLchar *vertexShaderSource = "attribute vec3 normal;"
+		"uniform mat4 viewProjection;"
 		"const int NUM_CASCADES = 3;"
-		"uniform mat4 lightMVP[NUM_CASCADES];"
+		"SHADOW_DATA\n"
 		"varying vec4 lightSpacePos[NUM_CASCADES];"
 		"varying vec3 vNormal;"
 		"void main() {"
 		"	vNormal = vec3(model * vec4(normal, 0.0));"
-		"	gl_Position = mvp * vec4(position, 1.0);"
+		"	vec4 worldPosition = model * decodePosition();"
+		"	gl_Position = viewProjection * worldPosition;"
 		"	for (int i = 0; i < NUM_CASCADES; ++i) {"
-		"		lightSpacePos[i] = lightMVP[i] * model * vec4(position, 1.0);"
+		"		lightSpacePos[i] = lightMVP[i] * worldPosition;"
 		"	}"
 		"}",
 		*fragmentShaderSource = "#extension GL_OES_standard_derivatives : require\n"
@@ -258,11 +404,11 @@ int rendererInit(struct Renderer *renderer, struct EntityManager *manager, int w
 			"#endif\n"
 			"varying vec3 vNormal;"
 			"uniform vec3 color;"
-			"uniform vec3 lightDir;"
 			"const int NUM_CASCADES = 3;"
+			"SHADOW_DATA\n"
 			"varying vec4 lightSpacePos[NUM_CASCADES];"
-			"uniform float cascadeEndClipSpace[NUM_CASCADES];"
 			"uniform sampler2D shadowMap[NUM_CASCADES];"
+			"uniform sampler2D staticShadowMap[NUM_CASCADES];"
 			"vec2 depthGradient(vec2 uv, float z) {" // Receiver plane depth bias
 			"	vec3 duvdist_dx = dFdx(vec3(uv, z)), duvdist_dy = dFdy(vec3(uv, z));"
 			"	vec2 biasUV;" // dz_duv
@@ -278,7 +424,8 @@ int rendererInit(struct Renderer *renderer, struct EntityManager *manager, int w
 			// "		vec2 dz_duv = depthGradient(shadowCoord.xy, shadowCoord.z);"
 			// "		shadowCoord.z -= min(2.0 * dot(vec2(1.0) / 1024.0, abs(dz_duv)), 0.005);"
 			// Slight offset to prevent shadow acne
-			"		return texture2D(shadowMap[i], shadowCoord.xy).x + 0.001 < shadowCoord.z ? 0.3 : 1.0;\n"
+			"		float depth = min(texture2D(shadowMap[i], shadowCoord.xy).x, texture2D(staticShadowMap[i], shadowCoord.xy).x);"
+			"		return depth + 0.001 < shadowCoord.z ? 0.3 : 1.0;\n"
 			"	}"
 			"	}"
 			"	return 1.0;"
@@ -288,53 +435,82 @@ int rendererInit(struct Renderer *renderer, struct EntityManager *manager, int w
 			"	float intensity = max(dot(normalize(vNormal), normalize(-lightDir)), 0.0);"
 			"	gl_FragColor = vec4(shadowFactor * intensity * color, 1.0);"
 			"}";
-	renderer->program = createProgramVertFrag(vertexShaderSource, fragmentShaderSource);
-	if (!renderer->program) return 1;
-	// Specify the layout of the vertex data
-	renderer->posAttrib = glGetAttribLocation(renderer->program, "position");
-	renderer->normalAttrib = glGetAttribLocation(renderer->program, "normal");
-	// Get the location of program uniforms
-	renderer->mvpUniform = glGetUniformLocation(renderer->program, "mvp");
-	renderer->modelUniform = glGetUniformLocation(renderer->program, "model");
-	renderer->colorUniform = glGetUniformLocation(renderer->program, "color");
-	glUseProgram(renderer->program);
+	renderer->instancing = isInstancingSupported();
+	renderer->baseVertex = isBaseVertexSupported();
+	// The base instance selects the instance data of each draw, so this needs instancing
+	renderer->multiDrawIndirect = renderer->instancing && renderer->baseVertex && isMultiDrawIndirectSupported();
+	renderer->uniformBuffers = isUniformBufferSupported();
+	const GLchar *blockPrelude = renderer->uniformBuffers ? uniformBufferPrelude : plainUniformPrelude;
+	uniformBlockInit(&renderer->frameBlock, "FrameData", FRAME_DATA_BINDING, frameDataMembers,
+			sizeof frameDataMembers / sizeof *frameDataMembers, sizeof(struct FrameData), renderer->uniformBuffers);
+	uniformBlockInit(&renderer->cameraBlock, "CameraData", CAMERA_DATA_BINDING, cameraDataMembers,
+			sizeof cameraDataMembers / sizeof *cameraDataMembers, sizeof(struct CameraData), renderer->uniformBuffers);
+	uniformBlockInit(&renderer->shadowBlock, "ShadowData", SHADOW_DATA_BINDING, shadowDataMembers,
+			sizeof shadowDataMembers / sizeof *shadowDataMembers, sizeof(struct ShadowData), renderer->uniformBuffers);
+	renderer->effectFactor = 0.0f;
+	// The model matrix and position decoding are per instance when instancing
+	const GLchar *modelDeclaration = renderer->instancing
+		? "attribute mat4 model; attribute vec3 positionScale; attribute vec3 positionBias;"
+		: "uniform mat4 model; uniform vec3 positionScale; uniform vec3 positionBias;";
+	if (shaderProgramInit(&renderer->program, createProgram(2,
+					createShader(GL_VERTEX_SHADER, 5, blockPrelude, uniformBlockDeclarations, modelDeclaration, positionDecoding, vertexShaderSource), 0,
+					createShader(GL_FRAGMENT_SHADER, 3, blockPrelude, uniformBlockDeclarations, fragmentShaderSource), 0))) return 1;
+	shaderProgramBindBlock(&renderer->program, &renderer->shadowBlock);
+	// Get the handles of program uniforms
+	renderer->viewProjectionUniform = shaderProgramUniform(&renderer->program, "viewProjection");
+	renderer->modelUniform = shaderProgramUniform(&renderer->program, "model");
+	renderer->colorUniform = shaderProgramUniform(&renderer->program, "color");
+	renderer->positionScaleUniform = shaderProgramUniform(&renderer->program, "positionScale");
+	renderer->positionBiasUniform = shaderProgramUniform(&renderer->program, "positionBias");
+	glUseProgram(renderer->program.id);
 	renderer->model = MatrixIdentity();
 	renderer->projection = MatrixPerspective(FOV, (float) width / height, Z_NEAR, Z_FAR);
-	glUniformMatrix4fv(renderer->modelUniform, 1, GL_FALSE, MatrixGet(mv, renderer->model));
+	shaderUniformMatrix4fv(renderer->modelUniform, 1, MatrixGet(mv, renderer->model));
 
 	// Shadow mapping
-	const GLchar *depthVertexShaderSource = "attribute vec3 position;"
-		"uniform mat4 mvp;"
+	const GLchar *depthVertexShaderSource = "uniform mat4 viewProjection;"
 		"void main() {"
-		"	gl_Position = mvp * vec4(position, 1.0);"
+		"	vec4 worldPosition = model * decodePosition();"
+		"	gl_Position = viewProjection * worldPosition;"
 		"}",
 		*depthFragmentShaderSource = "void main() {}";
-	renderer->depthProgram = createProgramVertFrag(depthVertexShaderSource, depthFragmentShaderSource);
-	if (!renderer->depthProgram) return 1;
-	renderer->depthProgramPosition = glGetAttribLocation(renderer->depthProgram, "position");
-	renderer->depthProgramMvp = glGetUniformLocation(renderer->depthProgram, "mvp");
+	if (shaderProgramInit(&renderer->depthProgram, createProgram(2, createShader(GL_VERTEX_SHADER, 3, modelDeclaration, positionDecoding, depthVertexShaderSource), 0,
+					createShader(GL_FRAGMENT_SHADER, 1, depthFragmentShaderSource), 0))) return 1;
+	renderer->depthProgramViewProjection = shaderProgramUniform(&renderer->depthProgram, "viewProjection");
+	renderer->depthProgramModel = shaderProgramUniform(&renderer->depthProgram, "model");
+	renderer->depthProgramPositionScale = shaderProgramUniform(&renderer->depthProgram, "positionScale");
+	renderer->depthProgramPositionBias = shaderProgramUniform(&renderer->depthProgram, "positionBias");
+
+	// Both programs read the attributes at the same locations, so one vertex array serves every pass
+	renderer->firstInstance = 0;
+	if (renderer->instancing) streamBufferInit(&renderer->instanceStream, GL_ARRAY_BUFFER, sizeof(GLfloat) * INSTANCE_FLOATS * 1024);
+	vertexArrayInit(&renderer->geometryArray, renderer->geometry.indexBuffer);
+	bindVertices(renderer, 0);
+	if (renderer->instancing) bindInstances(renderer, 0);
+	vertexArrayUnbind(&renderer->geometryArray);
 
 	// Create the depth buffers
-	glGenTextures(1, &renderer->depthTexture);
-	glBindTexture(GL_TEXTURE_2D, renderer->depthTexture);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, width, height, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, NULL);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-
 	glGenTextures(NUM_SPLITS, renderer->shadowMaps);
-	GLint depthTextures[NUM_SPLITS];
-	for (int i = 0; i < NUM_SPLITS; ++i) {
-		glBindTexture(GL_TEXTURE_2D, renderer->shadowMaps[i]);
+	glGenTextures(NUM_SPLITS, renderer->staticShadowMaps);
+	GLint depthTextures[NUM_SPLITS], staticDepthTextures[NUM_SPLITS];
+	for (int i = 0; i < 2 * NUM_SPLITS; ++i) {
+		glBindTexture(GL_TEXTURE_2D, i < NUM_SPLITS ? renderer->shadowMaps[i] : renderer->staticShadowMaps[i - NUM_SPLITS]);
 		glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, DEPTH_SIZE, DEPTH_SIZE, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, NULL);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	}
+	for (int i = 0; i < NUM_SPLITS; ++i) {
 		depthTextures[i] = i;
+		staticDepthTextures[i] = NUM_SPLITS + i;
+		renderer->staticShadowsValid[i] = 0;
 	}
-	glUniform1iv(glGetUniformLocation(renderer->program, "shadowMap"), NUM_SPLITS, depthTextures);
+	shaderUniform1iv(shaderProgramUniform(&renderer->program, "shadowMap"), NUM_SPLITS, depthTextures);
+	shaderUniform1iv(shaderProgramUniform(&renderer->program, "staticShadowMap"), NUM_SPLITS, staticDepthTextures);
+	renderer->numStaticCasters = 0;
+	renderer->farCascadeInterval = 1;
+	renderer->frameIndex = 0;
 	// Create the FBO
 	glGenFramebuffers(1, &renderer->depthFbo);
 	glBindFramebuffer(GL_FRAMEBUFFER, renderer->depthFbo);
@@ -344,25 +520,13 @@ int rendererInit(struct Renderer *renderer, struct EntityManager *manager, int w
 		printf("Error creating framebuffer.\n");
 	}
 
-	glGenTextures(1, &renderer->sceneTexture);
-	glBindTexture(GL_TEXTURE_2D, renderer->sceneTexture);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glGenFramebuffers(1, &renderer->sceneFbo);
-	glBindFramebuffer(GL_FRAMEBUFFER, renderer->sceneFbo);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, renderer->sceneTexture, 0);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, renderer->depthTexture, 0);
-	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
-		printf("Error creating framebuffer.\n");
-	}
-
 	float quadVertices[] = { -1.0f, -1.0f, 1.0f, -1.0f, -1.0f, 1.0f, -1.0f, 1.0f, 1.0f, -1.0f, 1.0f, 1.0f };
 	glGenBuffers(1, &renderer->quadBuffer);
 	glBindBuffer(GL_ARRAY_BUFFER, renderer->quadBuffer);
 	glBufferData(GL_ARRAY_BUFFER, sizeof quadVertices, quadVertices, GL_STATIC_DRAW);
+	vertexArrayInit(&renderer->quadArray, 0);
+	vertexArrayAttrib(&renderer->quadArray, ATTRIB_POSITION, renderer->quadBuffer, 2, GL_FLOAT, GL_FALSE, 0, 0, 0);
+	vertexArrayUnbind(&renderer->quadArray);
 
 	const GLchar *fullscreenVertexShaderSource = "attribute vec2 position;"
 		"varying vec2 texCoord;"
@@ -372,30 +536,79 @@ int rendererInit(struct Renderer *renderer, struct EntityManager *manager, int w
 		"}";
 	GLuint fullscreenVertexShader = createShader(GL_VERTEX_SHADER, 1, fullscreenVertexShaderSource);
 
+	// Pyramid of camera-space depths, so that distant ambient occlusion taps read coarser levels
+	const GLchar *highPrecision = "#ifdef GL_ES\n"
+		"#ifdef GL_FRAGMENT_PRECISION_HIGH\n"
+		"precision highp float;\n"
+		"#else\n"
+		"precision mediump float;\n"
+		"#endif\n"
+		"#endif\n",
+		*linearizeFragmentShaderSource = "uniform sampler2D depthTexture;"
+		"FRAME_DATA\n"
+		"CAMERA_DATA\n"
+		// Packs a number on [0, 1] into 24 bits
+		"vec3 packDepth(float key) {"
+		"	vec3 p = fract(key * vec3(1.0, 255.0, 65025.0));"
+		"	p.xy -= p.yz * (1.0 / 255.0);"
+		"	return p;"
+		"}"
+		"void main() {"
+		// Read the center of one full resolution pixel rather than filtering depths across edges
+		"	vec2 pixel = floor(floor(gl_FragCoord.xy) * (aoInvResolution / invResolution));"
+		"	float d = texture2D(depthTexture, (pixel + 0.5) * invResolution).r;"
+		"	float z = clipInfo[0] / (clipInfo[1] * d + clipInfo[2]);"
+		"	gl_FragColor = vec4(packDepth(clamp(z / clipInfo[2], 0.0, 1.0)), 1.0);"
+		"}",
+		*downsampleFragmentShaderSource = "uniform sampler2D source;"
+		"uniform vec2 sourceInvSize;"
+		"void main() {"
+		// Rotated grid subsampling: pick one texel of each 2x2 block, alternating in a checkerboard
+		"	vec2 p = floor(gl_FragCoord.xy);"
+		"	vec2 offset = vec2(mod(p.y, 2.0), mod(p.x, 2.0));"
+		"	gl_FragColor = texture2D(source, (2.0 * p + offset + 0.5) * sourceInvSize);"
+		"}";
+	shaderProgramInit(&renderer->linearizeProgram, createProgram(2, fullscreenVertexShader, DONT_DELETE_SHADER,
+				createShader(GL_FRAGMENT_SHADER, 4, blockPrelude, uniformBlockDeclarations, highPrecision, linearizeFragmentShaderSource), 0));
+	shaderProgramBindBlock(&renderer->linearizeProgram, &renderer->frameBlock);
+	shaderProgramBindBlock(&renderer->linearizeProgram, &renderer->cameraBlock);
+	shaderProgramInit(&renderer->downsampleProgram, createProgram(2, fullscreenVertexShader, DONT_DELETE_SHADER,
+				createShader(GL_FRAGMENT_SHADER, 2, highPrecision, downsampleFragmentShaderSource), 0));
+	renderer->downsampleSourceInvSize = shaderProgramUniform(&renderer->downsampleProgram, "sourceInvSize");
+
 	// Screen Space Ambient Occlusion
 	const GLchar *ssaoFragmentShaderSource = "#extension GL_OES_standard_derivatives : require\n"
 		"#ifdef GL_ES\n"
 		"precision mediump float;\n"
 		"#endif\n"
 		// "#extension GL_EXT_gpu_shader4 : require\n"
-		"#define NUM_SAMPLES (31)\n"
+		// Few samples per frame, as the pattern rotates and accumulates over frames
+		"#define NUM_SAMPLES (8)\n"
 		"#define FAR_PLANE_Z (99.0)\n"
-		"#define NUM_SPIRAL_TURNS (7)\n"
+		"#define NUM_SPIRAL_TURNS (3)\n"
+		// Taps further than 2^LOG_MAX_OFFSET pixels away read coarser depths
+		"#define LOG_MAX_OFFSET (3.0)\n"
+		"#define MAX_MIP_LEVEL (3.0)\n"
 		"varying vec2 texCoord;"
 		"uniform float radius;"
-		"uniform float projScale;"
-		"uniform sampler2D depthTexture;"
+		"uniform sampler2D depthMips[4];"
 		"uniform float bias;"
 		"uniform float intensityDivR6;"
-		"uniform vec3 clipInfo;"
-		"uniform vec4 projInfo;"
-		"uniform vec2 invResolution;"
-		"float reconstructCSZ(float d) {"
-		"	return clipInfo[0] / (clipInfo[1] * d + clipInfo[2]);"
+		"FRAME_DATA\n"
+		"CAMERA_DATA\n"
+		"float unpackDepth(vec3 p) {"
+		"	return dot(p, vec3(1.0, 1.0 / 255.0, 1.0 / 65025.0)) * clipInfo[2];"
+		"}"
+		// Read the camera-space depth at screen-space position ssP from the given level of the pyramid.
+		"float getDepth(vec2 ssP, float level) {"
+		"	if (level < 1.0) return unpackDepth(texture2D(depthMips[0], ssP).rgb);"
+		"	if (level < 2.0) return unpackDepth(texture2D(depthMips[1], ssP).rgb);"
+		"	if (level < 3.0) return unpackDepth(texture2D(depthMips[2], ssP).rgb);"
+		"	return unpackDepth(texture2D(depthMips[3], ssP).rgb);"
 		"}"
 		// Read the camera-space position of the point at screen-space position ssP.
-		"vec3 getPosition(vec2 ssP) {"
-		"	float z = reconstructCSZ(texture2D(depthTexture, ssP).r);"
+		"vec3 getPosition(vec2 ssP, float level) {"
+		"	float z = getDepth(ssP, level);"
 		"	return vec3((ssP * projInfo.xy + projInfo.zw) * z, z);"
 		"}"
 		"float CSZToKey(float z) {"
@@ -416,7 +629,9 @@ int rendererInit(struct Renderer *renderer, struct EntityManager *manager, int w
 		"float sampleAO(in vec2 ssC, in vec3 C, in vec3 n_C, in float ssDiskRadius, in int tapIndex, in float randomPatternRotationAngle) {"
 		"	float ssR;"
 		"	vec2 unitOffset = tapLocation(tapIndex, randomPatternRotationAngle, ssR);"
-		"	vec3 Q = getPosition(ssC + ssR * ssDiskRadius * unitOffset * invResolution);"
+		"	float ssOffset = ssR * ssDiskRadius;"
+		"	float level = clamp(floor(log2(ssOffset)) - LOG_MAX_OFFSET, 0.0, MAX_MIP_LEVEL);"
+		"	vec3 Q = getPosition(ssC + ssOffset * unitOffset * aoInvResolution, level);"
 		"	vec3 v = Q - C;"
 		"	float vv = dot(v, v), vn = dot(v, n_C);"
 		"	const float epsilon = 0.01;"
@@ -425,11 +640,11 @@ int rendererInit(struct Renderer *renderer, struct EntityManager *manager, int w
 		"}"
 		"void main() {"
 		"	vec2 ssC = texCoord;" // Pixel being shaded
-		"	vec3 C = getPosition(ssC);" // World space point being shaded
+		"	vec3 C = getPosition(ssC, 0.0);" // World space point being shaded
 		"	if (C.z >= FAR_PLANE_Z) discard;"
 		"	vec3 n_C = normalize(cross(dFdy(C), dFdx(C)));" // Reconstruct screen-space unit normal from screen-space position
 		// "	float randomPatternRotationAngle = float((3 * ssC.x ^ ssC.y + ssC.x * ssC.y) * 10);"
-		"	float randomPatternRotationAngle = 1000.0 * fract(52.9829189 * fract(dot(ssC, vec2(0.06711056, 0.00583715))));"
+		"	float randomPatternRotationAngle = 6.28 * fract(52.9829189 * fract(dot(gl_FragCoord.xy, vec2(0.06711056, 0.00583715)))) + aoSpinAngle;"
 		"	float ssDiskRadius = projScale * radius / C.z;"
 		"	float sum = 0.0;"
 		"	for (int i = 0; i < NUM_SAMPLES; ++i) {"
@@ -441,42 +656,25 @@ int rendererInit(struct Renderer *renderer, struct EntityManager *manager, int w
 		"	gl_FragColor.r = A;"
 		"	packKey(CSZToKey(C.z), gl_FragColor.gb);"
 		"}";
-	renderer->ssaoProgram = createProgram(2, fullscreenVertexShader, DONT_DELETE_SHADER,
-			createShader(GL_FRAGMENT_SHADER, 1, ssaoFragmentShaderSource), 0);
-	glUseProgram(renderer->ssaoProgram);
+	shaderProgramInit(&renderer->ssaoProgram, createProgram(2, fullscreenVertexShader, DONT_DELETE_SHADER,
+				createShader(GL_FRAGMENT_SHADER, 3, blockPrelude, uniformBlockDeclarations, ssaoFragmentShaderSource), 0));
+	shaderProgramBindBlock(&renderer->ssaoProgram, &renderer->frameBlock);
+	shaderProgramBindBlock(&renderer->ssaoProgram, &renderer->cameraBlock);
+	glUseProgram(renderer->ssaoProgram.id);
 	const float radius = 1.0f;
-	glUniform1f(glGetUniformLocation(renderer->ssaoProgram, "radius"), radius);
-	glUniform1f(glGetUniformLocation(renderer->ssaoProgram, "bias"), 0.012f);
-	glUniform1f(glGetUniformLocation(renderer->ssaoProgram, "intensityDivR6"), 1.0f / pow(radius, 6.0f));
-	renderer->ssaoPosition = glGetAttribLocation(renderer->ssaoProgram, "position");
-	// Clipping plane constants for use by reconstructZ
-	const float clipInfo[] = {Z_NEAR * Z_FAR, Z_NEAR - Z_FAR, Z_FAR};
-	glUniform3fv(glGetUniformLocation(renderer->ssaoProgram, "clipInfo"), 1, clipInfo);
-	const float projScale = width / (tanf(DEGREES_TO_RADIANS(FOV) * 0.5f) * 2.0f);
-	glUniform1f(glGetUniformLocation(renderer->ssaoProgram, "projScale"), projScale);
-	MatrixGet(mv, renderer->projection);
-	const float projInfo[] = { 2.0f / mv[0], 2.0f / mv[5], -1.0f / mv[0], -1.0f / mv[5] };
-	glUniform4fv(glGetUniformLocation(renderer->ssaoProgram, "projInfo"), 1, projInfo);
-	glUniform2f(glGetUniformLocation(renderer->ssaoProgram, "invResolution"), 1.0f / width, 1.0f / height);
-
-	glGenTextures(1, &renderer->ssaoTexture);
-	glBindTexture(GL_TEXTURE_2D, renderer->ssaoTexture);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-
-	glGenFramebuffers(1, &renderer->ssaoFbo);
-	glBindFramebuffer(GL_FRAMEBUFFER, renderer->ssaoFbo);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, renderer->ssaoTexture, 0);
+	shaderUniform1f(shaderProgramUniform(&renderer->ssaoProgram, "radius"), radius);
+	shaderUniform1f(shaderProgramUniform(&renderer->ssaoProgram, "bias"), 0.012f);
+	shaderUniform1f(shaderProgramUniform(&renderer->ssaoProgram, "intensityDivR6"), 1.0f / pow(radius, 6.0f));
+	const GLint depthMipUnits[NUM_DEPTH_MIPS] = { 0, 1, 2, 3 };
+	shaderUniform1iv(shaderProgramUniform(&renderer->ssaoProgram, "depthMips"), NUM_DEPTH_MIPS, depthMipUnits);
 
 	const GLchar *blurFragmentShaderSource = "#ifdef GL_ES\n"
 		"precision mediump float;\n"
 		"#endif\n"
 		"varying vec2 texCoord;"
 		"uniform sampler2D source;"
-		"uniform vec2 invResolutionDirection;" // Either set x to 1/width or y to 1/height
+		"uniform vec2 direction;" // Either (1, 0) or (0, 1)
+		"FRAME_DATA\n"
 		"uniform float sharpness;"
 		"const float KERNEL_RADIUS = 3.0;"
 		/* Returns a number on (0, 1) */
@@ -495,6 +693,7 @@ int rendererInit(struct Renderer *renderer, struct EntityManager *manager, int w
 		"	return c * w;"
 		"}"
 		"void main() {"
+		"	vec2 invResolutionDirection = direction * aoInvResolution;"
 		"	vec4 temp = texture2D(source, texCoord);"
 		"	float center_c = temp.r;"
 		"	float center_d = unpackKey(temp.gb);"
@@ -516,69 +715,197 @@ int rendererInit(struct Renderer *renderer, struct EntityManager *manager, int w
 		"	gl_FragColor = vec4(vec3(c_total / w_total), 1.0);\n"
 		"#endif\n"
 		"}";
-	renderer->blur1Program = createProgram(2, fullscreenVertexShader, DONT_DELETE_SHADER,
-			createShader(GL_FRAGMENT_SHADER, 2, "#define AO_PACK_KEY\n", blurFragmentShaderSource), 0);
-	glUseProgram(renderer->blur1Program);
+	shaderProgramInit(&renderer->blur1Program, createProgram(2, fullscreenVertexShader, DONT_DELETE_SHADER,
+				createShader(GL_FRAGMENT_SHADER, 4, blockPrelude, uniformBlockDeclarations, "#define AO_PACK_KEY\n", blurFragmentShaderSource), 0));
+	shaderProgramBindBlock(&renderer->blur1Program, &renderer->frameBlock);
+	glUseProgram(renderer->blur1Program.id);
 	const float sharpness = 40.0f;
-	glUniform1f(glGetUniformLocation(renderer->blur1Program, "sharpness"), sharpness);
-	renderer->blur1Position = glGetAttribLocation(renderer->blur1Program, "position");
-	renderer->blur2Program = createProgram(2, fullscreenVertexShader, DONT_DELETE_SHADER,
-			createShader(GL_FRAGMENT_SHADER, 1, blurFragmentShaderSource), 0);
-	glUseProgram(renderer->blur2Program);
-	glUniform1f(glGetUniformLocation(renderer->blur2Program, "sharpness"), sharpness);
-	renderer->blur2Position = glGetAttribLocation(renderer->blur2Program, "position");
-
-	glGenTextures(1, &renderer->blurTexture);
-	glBindTexture(GL_TEXTURE_2D, renderer->blurTexture);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-
-	glGenFramebuffers(1, &renderer->blurFbo);
-	glBindFramebuffer(GL_FRAMEBUFFER, renderer->blurFbo);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, renderer->blurTexture, 0);
+	shaderUniform1f(shaderProgramUniform(&renderer->blur1Program, "sharpness"), sharpness);
+	renderer->blur1DirectionUniform = shaderProgramUniform(&renderer->blur1Program, "direction");
+	shaderProgramInit(&renderer->blur2Program, createProgram(2, fullscreenVertexShader, DONT_DELETE_SHADER,
+				createShader(GL_FRAGMENT_SHADER, 3, blockPrelude, uniformBlockDeclarations, blurFragmentShaderSource), 0));
+	shaderProgramBindBlock(&renderer->blur2Program, &renderer->frameBlock);
+	glUseProgram(renderer->blur2Program.id);
+	shaderUniform1f(shaderProgramUniform(&renderer->blur2Program, "sharpness"), sharpness);
+	shaderUniform2f(shaderProgramUniform(&renderer->blur2Program, "direction"), 0.0f, 1.0f);
+
+	// Temporal accumulation of ambient occlusion, reprojected with the camera motion
+	const GLchar *temporalFragmentShaderSource = "#define FAR_PLANE_Z (99.0)\n"
+		// The relative depth difference beyond which the history is of another surface
+		"#define DEPTH_TOLERANCE (0.05)\n"
+		"varying vec2 texCoord;"
+		"uniform sampler2D source;"
+		"uniform sampler2D history;"
+		"uniform float historyWeight;"
+		"FRAME_DATA\n"
+		"CAMERA_DATA\n"
+		"float unpackKey(vec2 p) {"
+		"	return p.x * (256.0 / 257.0) + p.y * (1.0 / 257.0);"
+		"}"
+		"void main() {"
+		"	vec4 current = texture2D(source, texCoord);"
+		"	float z = unpackKey(current.gb) * FAR_PLANE_Z;"
+		"	float d = (clipInfo[0] / z - clipInfo[2]) / clipInfo[1];" // Inverse of reconstructing z from the depth buffer
+		"	vec4 previousPos = currentToPreviousMatrix * vec4(2.0 * texCoord - 1.0, 2.0 * d - 1.0, 1.0);"
+		"	previousPos /= previousPos.w;"
+		"	vec2 previousCoord = 0.5 * previousPos.xy + 0.5;"
+		"	float previousZ = clipInfo[0] / (clipInfo[1] * (0.5 * previousPos.z + 0.5) + clipInfo[2]);"
+		"	vec4 previous = texture2D(history, previousCoord);"
+		// Reject history from off screen or of a surface that was disoccluded
+		"	float w = historyWeight;"
+		"	if (z >= FAR_PLANE_Z || previousCoord != clamp(previousCoord, 0.0, 1.0)"
+		"			|| abs(unpackKey(previous.gb) * FAR_PLANE_Z - previousZ) > DEPTH_TOLERANCE * previousZ) w = 0.0;"
+		"	gl_FragColor = vec4(mix(current.r, previous.r, w), current.gb, 1.0);"
+		"}";
+	shaderProgramInit(&renderer->temporalProgram, createProgram(2, fullscreenVertexShader, DONT_DELETE_SHADER,
+				createShader(GL_FRAGMENT_SHADER, 4, blockPrelude, uniformBlockDeclarations, highPrecision, temporalFragmentShaderSource), 0));
+	shaderProgramBindBlock(&renderer->temporalProgram, &renderer->frameBlock);
+	shaderProgramBindBlock(&renderer->temporalProgram, &renderer->cameraBlock);
+	glUseProgram(renderer->temporalProgram.id);
+	shaderUniform1i(shaderProgramUniform(&renderer->temporalProgram, "history"), 1);
+	renderer->temporalHistoryWeight = shaderProgramUniform(&renderer->temporalProgram, "historyWeight");
+
+	glGenTextures(2, renderer->aoHistory);
+	for (int i = 0; i < 2; ++i) {
+		glBindTexture(GL_TEXTURE_2D, renderer->aoHistory[i]);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	}
+	renderer->aoHistoryIndex = 0;
+	resizeAmbientOcclusion(renderer);
 
-	const GLchar *effectFragmentShaderSource = "#define NUM_SAMPLES (24)\n"
-		"#define VIGNETTE_RADIUS 0.75\n"
-		"#define VIGNETTE_SOFTNESS 0.45\n"
-		"#ifdef GL_ES\n"
-		"precision mediump float;\n"
-		"#endif\n"
+	// Joint bilateral upsampling of reduced resolution ambient occlusion, guided by the full resolution depth
+	const GLchar *upsampleFragmentShaderSource = "#define FAR_PLANE_Z (99.0)\n"
 		"varying vec2 texCoord;"
-		"uniform sampler2D texture;"
+		"uniform sampler2D source;"
 		"uniform sampler2D depthTexture;"
-		"uniform mat4 currentToPreviousMatrix;"
-		"uniform float blurFactor;"
-		"uniform vec2 resolution;"
-		"uniform float effectFactor;"
+		"uniform float sharpness;"
+		"FRAME_DATA\n"
+		"CAMERA_DATA\n"
+		"float unpackKey(vec2 p) {"
+		"	return p.x * (256.0 / 257.0) + p.y * (1.0 / 257.0);"
+		"}"
 		"void main() {"
-		"	vec4 currentPos = vec4(2.0 * texCoord - 1.0, texture2D(depthTexture, texCoord).x, 1.0);"
+		"	float z = clipInfo[0] / (clipInfo[1] * texture2D(depthTexture, texCoord).r + clipInfo[2]);"
+		"	float key = clamp(z * (1.0 / FAR_PLANE_Z), 0.0, 1.0);"
+		"	vec2 position = texCoord / aoInvResolution - 0.5;"
+		"	vec2 base = floor(position), f = position - base;"
+		"	float sum = 0.0, totalWeight = 0.0;"
+		"	for (int i = 0; i < 4; ++i) {"
+		"		vec2 offset = vec2(mod(float(i), 2.0), floor(float(i) * 0.5));"
+		"		vec4 temp = texture2D(source, (base + offset + 0.5) * aoInvResolution);"
+		"		vec2 b = mix(1.0 - f, f, offset);"
+		"		float ddiff = (unpackKey(temp.gb) - key) * sharpness;"
+		// The small constant falls back to bilinear weights where no texel matches the depth
+		"		float w = b.x * b.y * (exp2(-ddiff * ddiff) + 0.001);"
+		"		sum += temp.r * w;"
+		"		totalWeight += w;"
+		"	}"
+		"	gl_FragColor = vec4(vec3(sum / totalWeight), 1.0);"
+		"}";
+	shaderProgramInit(&renderer->upsampleProgram, createProgram(2, fullscreenVertexShader, DONT_DELETE_SHADER,
+				createShader(GL_FRAGMENT_SHADER, 4, blockPrelude, uniformBlockDeclarations, highPrecision, upsampleFragmentShaderSource), 0));
+	shaderProgramBindBlock(&renderer->upsampleProgram, &renderer->frameBlock);
+	shaderProgramBindBlock(&renderer->upsampleProgram, &renderer->cameraBlock);
+	glUseProgram(renderer->upsampleProgram.id);
+	shaderUniform1i(shaderProgramUniform(&renderer->upsampleProgram, "depthTexture"), 1);
+	shaderUniform1f(shaderProgramUniform(&renderer->upsampleProgram, "sharpness"), 200.0f);
+
+	// Motion blur, whose length in texture coordinates is shared by the tile classification
+	const GLchar *mediumPrecision = "#ifdef GL_ES\n"
+		"precision mediump float;\n"
+		"#endif\n",
+		*velocitySource = "uniform sampler2D depthTexture;"
+		"FRAME_DATA\n"
+		"CAMERA_DATA\n"
+		"vec2 getVelocity(vec2 uv) {"
+		"	vec4 currentPos = vec4(2.0 * uv - 1.0, texture2D(depthTexture, uv).x, 1.0);"
 		"	vec4 previousPos = currentToPreviousMatrix * currentPos;"
 		"	previousPos /= previousPos.w;"
-		"	vec2 velocity = blurFactor * (currentPos.xy - previousPos.xy) * 0.5;"
+		"	return blurFactor * (currentPos.xy - previousPos.xy) * 0.5;"
+		"}",
+		// Tile lengths are stored in pixels divided by MAX_TILE_VELOCITY
+		*velocityTileDefines = "#define TILE_SIZE " STR(VELOCITY_TILE_SIZE) "\n"
+		"#define MAX_TILE_VELOCITY (64.0)\n",
+		*velocityTileFragmentShaderSource = "uniform sampler2D source;"
+		"uniform vec2 sourceInvSize;"
+		"void main() {"
+		"	float maxVelocity = 0.0;\n"
+		"#ifdef FROM_DEPTH\n"
+		"	vec2 p = vec2(floor(gl_FragCoord.x) * float(TILE_SIZE), gl_FragCoord.y);"
+		"	for (int i = 0; i < TILE_SIZE; ++i) {"
+		"		vec2 uv = min(vec2(p.x + float(i) + 0.5, p.y) * invResolution, 1.0);"
+		"		maxVelocity = max(maxVelocity, length(getVelocity(uv) / invResolution) * (1.0 / MAX_TILE_VELOCITY));"
+		"	}\n"
+		"#else\n"
+		"	vec2 p = vec2(gl_FragCoord.x, floor(gl_FragCoord.y) * float(TILE_SIZE));"
+		"	for (int i = 0; i < TILE_SIZE; ++i) {"
+		"		maxVelocity = max(maxVelocity, texture2D(source, vec2(p.x, p.y + float(i) + 0.5) * sourceInvSize).r);"
+		"	}\n"
+		"#endif\n"
+		"	gl_FragColor = vec4(maxVelocity, 0.0, 0.0, 1.0);"
+		"}";
+	shaderProgramInit(&renderer->velocityTileProgram, createProgram(2, fullscreenVertexShader, DONT_DELETE_SHADER,
+				createShader(GL_FRAGMENT_SHADER, 7, blockPrelude, uniformBlockDeclarations, mediumPrecision,
+					velocityTileDefines, "#define FROM_DEPTH\n", velocitySource, velocityTileFragmentShaderSource), 0));
+	shaderProgramBindBlock(&renderer->velocityTileProgram, &renderer->frameBlock);
+	shaderProgramBindBlock(&renderer->velocityTileProgram, &renderer->cameraBlock);
+	shaderProgramInit(&renderer->tileMaxProgram, createProgram(2, fullscreenVertexShader, DONT_DELETE_SHADER,
+				createShader(GL_FRAGMENT_SHADER, 3, mediumPrecision, velocityTileDefines, velocityTileFragmentShaderSource), 0));
+	renderer->tileMaxSourceInvSize = shaderProgramUniform(&renderer->tileMaxProgram, "sourceInvSize");
+
+	// Presents the scene when there are no effects
+	const GLchar *copyFragmentShaderSource = "varying vec2 texCoord;"
+		"uniform sampler2D texture;"
+		"void main() {"
+		"	gl_FragColor = texture2D(texture, texCoord);"
+		"}";
+	shaderProgramInit(&renderer->copyProgram, createProgram(2, fullscreenVertexShader, DONT_DELETE_SHADER,
+				createShader(GL_FRAGMENT_SHADER, 2, mediumPrecision, copyFragmentShaderSource), 0));
+
+	const GLchar *effectFragmentShaderSource = "#define NUM_SAMPLES (24)\n"
+		"#define NUM_SMALL_SAMPLES (8)\n"
+		// Tiles moving less than half a pixel are not blurred, and less than SMALL_VELOCITY pixels take fewer samples
+		"#define STATIC_VELOCITY (0.5)\n"
+		"#define SMALL_VELOCITY (8.0)\n"
+		"#define VIGNETTE_RADIUS 0.75\n"
+		"#define VIGNETTE_SOFTNESS 0.45\n"
+		"varying vec2 texCoord;"
+		"uniform sampler2D texture;"
+		"uniform sampler2D tileTexture;"
+		"uniform vec2 tileInvSize;"
+		"vec4 motionBlur(vec2 velocity, int numSamples) {"
 		"	vec4 result = texture2D(texture, texCoord);"
 		"	for (int i = 1; i < NUM_SAMPLES; ++i) {"
-		"		vec2 offset = velocity * (float(i) / float(NUM_SAMPLES - 1) - 0.5);"
+		"		if (i >= numSamples) break;"
+		"		vec2 offset = velocity * (float(i) / float(numSamples - 1) - 0.5);"
 		"		result += texture2D(texture, texCoord + offset);"
 		"	}"
-		"	gl_FragColor = result / float(NUM_SAMPLES);"
+		"	return result / float(numSamples);"
+		"}"
+		"void main() {"
+		"	vec2 tile = floor(gl_FragCoord.xy * (1.0 / float(TILE_SIZE)));"
+		"	float tileVelocity = texture2D(tileTexture, (tile + 0.5) * tileInvSize).r * MAX_TILE_VELOCITY;"
+		"	if (tileVelocity < STATIC_VELOCITY) gl_FragColor = texture2D(texture, texCoord);"
+		"	else gl_FragColor = motionBlur(getVelocity(texCoord), tileVelocity < SMALL_VELOCITY ? NUM_SMALL_SAMPLES : NUM_SAMPLES);"
 
 		"	float gray = dot(gl_FragColor.rgb, vec3(0.299, 0.587, 0.114));"
 		"	gl_FragColor.rgb = mix(gl_FragColor.rgb, gl_FragColor.rgb * gray, effectFactor);"
 
-		"	float vignette = smoothstep(VIGNETTE_RADIUS, VIGNETTE_RADIUS - VIGNETTE_SOFTNESS, length(gl_FragCoord.xy / vec2(800.0, 600.0) - 0.5));"
+		"	float vignette = smoothstep(VIGNETTE_RADIUS, VIGNETTE_RADIUS - VIGNETTE_SOFTNESS, length(gl_FragCoord.xy * invResolution - 0.5));"
 		"	gl_FragColor.rgb = mix(gl_FragColor.rgb, gl_FragColor.rgb * vignette, effectFactor);"
 		"}";
-	renderer->effectProgram = createProgram(2, fullscreenVertexShader, 0,
-			createShader(GL_FRAGMENT_SHADER, 1, effectFragmentShaderSource), 0);
-	glUseProgram(renderer->effectProgram);
-	renderer->effectPosition = glGetAttribLocation(renderer->effectProgram, "position");
-	glUniform1i(glGetUniformLocation(renderer->effectProgram, "depthTexture"), 1);
-	renderer->effectCurrToPrevUniform = glGetUniformLocation(renderer->effectProgram, "currentToPreviousMatrix");
-	renderer->effectBlurFactorUniform = glGetUniformLocation(renderer->effectProgram, "blurFactor");
-	renderer->effectFactorUniform = glGetUniformLocation(renderer->effectProgram, "effectFactor");
+	shaderProgramInit(&renderer->effectProgram, createProgram(2, fullscreenVertexShader, 0,
+				createShader(GL_FRAGMENT_SHADER, 6, blockPrelude, uniformBlockDeclarations, mediumPrecision,
+					velocityTileDefines, velocitySource, effectFragmentShaderSource), 0));
+	shaderProgramBindBlock(&renderer->effectProgram, &renderer->frameBlock);
+	shaderProgramBindBlock(&renderer->effectProgram, &renderer->cameraBlock);
+	glUseProgram(renderer->effectProgram.id);
+	shaderUniform1i(shaderProgramUniform(&renderer->effectProgram, "depthTexture"), 1);
+	shaderUniform1i(shaderProgramUniform(&renderer->effectProgram, "tileTexture"), 2);
+	renderer->effectTileInvSize = shaderProgramUniform(&renderer->effectProgram, "tileInvSize");
 
 	// Skybox
 	const char *cubemapFiles[6] = {
@@ -603,91 +930,456 @@ int rendererInit(struct Renderer *renderer, struct EntityManager *manager, int w
 			"void main() {"
 			"	gl_FragColor = textureCube(texture, eyeDirection);"
 			"}";
-	renderer->skyboxProgram = createProgramVertFrag(skyboxVertexShaderSource, skyboxFragmentShaderSource);
-	renderer->skyboxPositionAttrib = glGetAttribLocation(renderer->skyboxProgram, "position");
+	shaderProgramInit(&renderer->skyboxProgram, createProgramVertFrag(skyboxVertexShaderSource, skyboxFragmentShaderSource));
+	renderer->skyboxInvProjectionUniform = shaderProgramUniform(&renderer->skyboxProgram, "invProjection");
+	renderer->skyboxModelViewUniform = shaderProgramUniform(&renderer->skyboxProgram, "modelView");
 
 	glBindFramebuffer(GL_FRAMEBUFFER, 0); // TODO remove
 	return 0;
 }
 
 void rendererDestroy(struct Renderer *renderer) {
-	glDeleteProgram(renderer->program);
-	glDeleteFramebuffers(1, &renderer->sceneFbo);
-	glDeleteTextures(1, &renderer->sceneTexture);
-	glDeleteProgram(renderer->depthProgram);
+	shaderProgramDestroy(&renderer->program);
+	shaderProgramDestroy(&renderer->depthProgram);
 	glDeleteFramebuffers(1, &renderer->depthFbo);
-	glDeleteTextures(1, &renderer->depthTexture);
 	glDeleteTextures(NUM_SPLITS, renderer->shadowMaps);
+	glDeleteTextures(NUM_SPLITS, renderer->staticShadowMaps);
 
 	glDeleteBuffers(1, &renderer->quadBuffer);
-	glDeleteProgram(renderer->ssaoProgram);
-	glDeleteTextures(1, &renderer->ssaoTexture);
-	glDeleteFramebuffers(1, &renderer->ssaoFbo);
-	glDeleteProgram(renderer->blur1Program);
-	glDeleteProgram(renderer->blur2Program);
-	glDeleteTextures(1, &renderer->blurTexture);
-	glDeleteFramebuffers(1, &renderer->blurFbo);
-	glDeleteProgram(renderer->effectProgram);
+	vertexArrayDestroy(&renderer->quadArray);
+	shaderProgramDestroy(&renderer->linearizeProgram);
+	shaderProgramDestroy(&renderer->downsampleProgram);
+	shaderProgramDestroy(&renderer->ssaoProgram);
+	shaderProgramDestroy(&renderer->blur1Program);
+	shaderProgramDestroy(&renderer->blur2Program);
+	shaderProgramDestroy(&renderer->temporalProgram);
+	glDeleteTextures(2, renderer->aoHistory);
+	shaderProgramDestroy(&renderer->upsampleProgram);
+	shaderProgramDestroy(&renderer->velocityTileProgram);
+	shaderProgramDestroy(&renderer->tileMaxProgram);
+	shaderProgramDestroy(&renderer->effectProgram);
+	shaderProgramDestroy(&renderer->copyProgram);
+	renderGraphDestroy(&renderer->graph);
 	glDeleteTextures(1, &renderer->skyboxTexture);
-	glDeleteProgram(renderer->skyboxProgram);
+	shaderProgramDestroy(&renderer->skyboxProgram);
+	uniformBlockDestroy(&renderer->frameBlock);
+	uniformBlockDestroy(&renderer->cameraBlock);
+	uniformBlockDestroy(&renderer->shadowBlock);
+	free(renderer->worldMatrices);
+	free(renderer->visibility);
+	sphereArrayDestroy(&renderer->bounds);
+	free(renderer->drawOrder);
+	if (renderer->instancing) {
+		streamBufferDestroy(&renderer->instanceStream);
+	} else {
+		free(renderer->instanceData);
+	}
+	free(renderer->instanceGroups);
+	renderQueueDestroy(&renderer->queue);
+	glDeleteBuffers(1, &renderer->indirectBuffer);
+	free(renderer->indirectCommands);
+	geometryArenaDestroy(&renderer->geometry);
+	vertexArrayDestroy(&renderer->geometryArray);
+}
+
+static int compareDrawItems(const void *a, const void *b) {
+	const struct DrawItem *x = a, *y = b;
+	if (x->model != y->model) return (uintptr_t) x->model < (uintptr_t) y->model ? -1 : 1;
+	return (x->index > y->index) - (x->index < y->index);
 }
 
-static void drawEntitiesDepth(struct Renderer *renderer, MATRIX viewProjection, struct Plane *frustumPlanes) {
-	ALIGN(16) float mv[16];
+/**
+ * Computes the world matrices and bounding spheres of the renderable entities for this frame,
+ * and sorts them by model.
+ */
+static void updateWorldMatrices(struct Renderer *renderer) {
 	struct EntityManager *manager = renderer->manager;
-	struct Model *lastModel = 0;
-	for (int j = 0; j < MAX_ENTITIES; ++j) {
-		if ((manager->entityMasks[j] & RENDER_MASK) == RENDER_MASK) {
-			struct Model *model = manager->models[j].model;
-			VECTOR position = manager->positions[j].position;
-
-			if (!isSphereInFrustum(frustumPlanes, position, model->radius)) continue;
-
-			if (model != lastModel) {
-				glBindBuffer(GL_ARRAY_BUFFER, model->vertexBuffer);
-				glVertexAttribPointer(renderer->depthProgramPosition, 3, GL_FLOAT, GL_FALSE, model->stride, 0);
-				glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, model->indexBuffer);
-				lastModel = model;
-			}
-			MATRIX mvp = MatrixMultiply(viewProjection, MatrixTranslationFromVector(position));
-			glUniformMatrix4fv(renderer->depthProgramMvp, 1, GL_FALSE, MatrixGet(mv, mvp));
-			for (int i = 0; i < model->numParts; ++i) {
-				struct ModelPart *part = model->parts + i;
-				glDrawElements(GL_TRIANGLES, part->count, GL_UNSIGNED_INT, (const GLvoid *) (uintptr_t) part->offset);
-			}
+	const struct EntityQuery *query = entityManagerQuery(manager, RENDER_MASK);
+	if (query->count > renderer->worldCapacity) {
+		unsigned int capacity = renderer->worldCapacity ? renderer->worldCapacity : 64;
+		while (capacity < query->count) capacity *= 2;
+		float *worldMatrices = realloc(renderer->worldMatrices, sizeof *worldMatrices * 16 * capacity);
+		struct DrawItem *drawOrder = realloc(renderer->drawOrder, sizeof *drawOrder * capacity);
+		unsigned char *visibility = realloc(renderer->visibility, sizeof *visibility * capacity);
+		assert(worldMatrices && drawOrder && visibility && "Failed to reallocate array.");
+		renderer->worldMatrices = worldMatrices;
+		renderer->visibility = visibility;
+		renderer->drawOrder = drawOrder;
+		renderer->worldCapacity = capacity;
+	}
+
+	entityManagerComputeWorldMatrices(manager, query, renderer->alpha, renderer->worldMatrices);
+	struct SphereArray *bounds = &renderer->bounds;
+	sphereArrayResize(bounds, query->count);
+	for (unsigned int k = 0; k < query->count; ++k) {
+		unsigned int j = query->entities[k];
+		const float *scale = manager->transforms[j].scale, *m = renderer->worldMatrices + 16 * k;
+		float maxScale = MAX(fabsf(scale[0]), MAX(fabsf(scale[1]), fabsf(scale[2])));
+		bounds->x[k] = m[12];
+		bounds->y[k] = m[13];
+		bounds->z[k] = m[14];
+		bounds->radius[k] = manager->models[j].model->radius * maxScale;
+		renderer->drawOrder[k] = (struct DrawItem) { manager->models[j].model, k, !!(manager->entityMasks[j] & STATIC_COMPONENT_MASK) };
+	}
+	qsort(renderer->drawOrder, query->count, sizeof *renderer->drawOrder, compareDrawItems);
+}
+
+/** Selects which entities a pass draws. */
+enum DrawFilter {
+	DRAW_ALL,
+	DRAW_STATIC,
+	DRAW_DYNAMIC
+};
+
+/** The passes drawing entities through the render queue, in the order they are executed. */
+enum RenderPass {
+	RENDER_PASS_STATIC_SHADOW,
+	RENDER_PASS_SHADOW = RENDER_PASS_STATIC_SHADOW + NUM_SPLITS,
+	RENDER_PASS_DEPTH = RENDER_PASS_SHADOW + NUM_SPLITS,
+	RENDER_PASS_MAIN
+};
+
+/** The names the shadow passes are profiled under. */
+static const char *staticShadowPassNames[NUM_SPLITS] = { "staticShadow0", "staticShadow1", "staticShadow2" },
+			 *shadowPassNames[NUM_SPLITS] = { "shadow0", "shadow1", "shadow2" };
+
+enum RenderProgram {
+	RENDER_PROGRAM_DEPTH,
+	RENDER_PROGRAM_MAIN
+};
+
+/** Makes room for the instance data and groups of a frame with at most \p count instances. */
+static void reserveInstances(struct Renderer *renderer, unsigned int count) {
+	if (renderer->instancing) {
+		// Only the instances actually gathered are committed, so reserving for the worst case costs nothing
+		renderer->instanceData = streamBufferReserve(&renderer->instanceStream,
+				sizeof(GLfloat) * INSTANCE_FLOATS * count, sizeof(GLfloat) * INSTANCE_FLOATS);
+	}
+	if (count <= renderer->instanceCapacity) return;
+	unsigned int capacity = renderer->instanceCapacity ? renderer->instanceCapacity : 64;
+	while (capacity < count) capacity *= 2;
+	if (!renderer->instancing) {
+		float *instanceData = realloc(renderer->instanceData, sizeof *instanceData * INSTANCE_FLOATS * capacity);
+		assert(instanceData && "Failed to reallocate array.");
+		renderer->instanceData = instanceData;
+	}
+	struct InstanceGroup *instanceGroups = realloc(renderer->instanceGroups, sizeof *instanceGroups * capacity);
+	assert(instanceGroups && "Failed to reallocate array.");
+	renderer->instanceGroups = instanceGroups;
+	renderer->instanceCapacity = capacity;
+}
+
+/**
+ * Appends the world matrices and position decoding of the entities visible in the view to the instance data of the frame, grouped by model.
+ * @param view The view to cull against, or -1 to not cull.
+ * @param eye The position to measure the depth of the groups from, or null to not sort by depth.
+ * @return The index of the first of the new groups.
+ */
+static unsigned int gatherInstances(struct Renderer *renderer, int view, enum DrawFilter filter, const float *eye) {
+	const struct EntityQuery *query = entityManagerQuery(renderer->manager, RENDER_MASK);
+	const struct SphereArray *bounds = &renderer->bounds;
+	const unsigned int firstGroup = renderer->numInstanceGroups;
+	for (unsigned int n = 0; n < query->count; ++n) {
+		struct DrawItem item = renderer->drawOrder[n];
+		if (view >= 0 && !(renderer->visibility[item.index] & 1 << view)) continue;
+		if (filter != DRAW_ALL && item.isStatic != (filter == DRAW_STATIC)) continue;
+
+		float depth = 0.0f;
+		if (eye) {
+			float dx = bounds->x[item.index] - eye[0], dy = bounds->y[item.index] - eye[1], dz = bounds->z[item.index] - eye[2];
+			depth = MAX(sqrtf(dx * dx + dy * dy + dz * dz) - bounds->radius[item.index], 0.0f);
+		}
+		if (renderer->numInstanceGroups == firstGroup || renderer->instanceGroups[renderer->numInstanceGroups - 1].model != item.model) {
+			renderer->instanceGroups[renderer->numInstanceGroups++] = (struct InstanceGroup) { item.model, renderer->numInstances, 0, depth };
 		}
+		struct InstanceGroup *group = renderer->instanceGroups + renderer->numInstanceGroups - 1;
+		++group->count;
+		if (depth < group->depth) group->depth = depth;
+		float *instance = renderer->instanceData + INSTANCE_FLOATS * renderer->numInstances++;
+		memcpy(instance, renderer->worldMatrices + 16 * item.index, sizeof(GLfloat) * 16);
+		memcpy(instance + 16, item.model->positionScale, sizeof item.model->positionScale);
+		memcpy(instance + 20, item.model->positionBias, sizeof item.model->positionBias);
 	}
+	return firstGroup;
 }
 
-static void drawEntities(struct Renderer *renderer, MATRIX viewProjection, struct Plane *frustumPlanes) {
-	ALIGN(16) float mv[16];
-	struct EntityManager *manager = renderer->manager;
-	struct Model *lastModel = 0;
-	for (int j = 0; j < MAX_ENTITIES; ++j) {
-		if ((manager->entityMasks[j] & RENDER_MASK) == RENDER_MASK) {
-			struct Model *model = manager->models[j].model;
-			VECTOR position = manager->positions[j].position;
-
-			if (!isSphereInFrustum(frustumPlanes, position, model->radius)) continue;
-
-			if (model != lastModel) {
-				glBindBuffer(GL_ARRAY_BUFFER, model->vertexBuffer);
-				glVertexAttribPointer(renderer->posAttrib, 3, GL_FLOAT, GL_FALSE, model->stride, 0);
-				glVertexAttribPointer(renderer->normalAttrib, 3, GL_FLOAT, GL_FALSE, model->stride, (const GLvoid *) (sizeof(GLfloat) * 3));
-				glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, model->indexBuffer);
-				lastModel = model;
+/** Submits a draw of each part of the groups gathered since \p firstGroup to the pass. */
+static void submitInstances(struct Renderer *renderer, enum RenderPass pass, enum RenderProgram program, unsigned int firstGroup) {
+	for (unsigned int g = firstGroup; g < renderer->numInstanceGroups; ++g) {
+		const struct InstanceGroup *group = renderer->instanceGroups + g;
+		struct Model *model = group->model;
+		for (int i = 0; i < model->numParts; ++i) {
+			const struct ModelPart *part = model->parts + i;
+			// Passes writing only depth draw front to back; the main pass tests for equal depths, so sorts by state
+			uint64_t key = program == RENDER_PROGRAM_MAIN
+				? renderKey(pass, program, model->id, part->material - model->materials, group->depth / Z_FAR)
+				: renderDepthKey(pass, program, model->id, group->depth / Z_FAR);
+			renderQueuePush(&renderer->queue, (struct RenderCommand) { key, model, part, group->first, group->count });
+		}
+	}
+}
+
+/**
+ * The uniforms of the program used by a pass, or null for those it lacks.
+ * Its attributes are at the fixed locations of ::AttribLocation.
+ */
+struct PassLocations {
+	struct ShaderUniform *modelUniform, *color, *positionScale, *positionBias;
+};
+
+/** Fills the indirect draw buffer with a command for each draw in the queue, in the same order. */
+static void uploadIndirectCommands(struct Renderer *renderer) {
+	const unsigned int count = renderer->queue.count;
+	if (count > renderer->indirectCapacity) {
+		unsigned int capacity = renderer->indirectCapacity ? renderer->indirectCapacity : 64;
+		while (capacity < count) capacity *= 2;
+		struct DrawElementsIndirectCommand *commands = realloc(renderer->indirectCommands, sizeof *commands * capacity);
+		assert(commands && "Failed to reallocate array.");
+		renderer->indirectCommands = commands;
+		renderer->indirectCapacity = capacity;
+	}
+	for (unsigned int n = 0; n < count; ++n) {
+		const struct RenderCommand *command = renderer->queue.commands + n;
+		renderer->indirectCommands[n] = (struct DrawElementsIndirectCommand) {
+			command->part->count, command->count, command->part->firstIndex, command->part->baseVertex,
+			renderer->firstInstance + command->first
+		};
+	}
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, renderer->indirectBuffer);
+	glBufferData(GL_DRAW_INDIRECT_BUFFER, sizeof *renderer->indirectCommands * count, renderer->indirectCommands, GL_STREAM_DRAW);
+}
+
+/**
+ * Executes the sorted draws of the pass with its program already bound.
+ *
+ * All models share the buffers of the geometry arena, whose vertex array is bound once. Where supported,
+ * runs of draws with the same material and index type are issued as a single indirect multi-draw,
+ * with the base instance selecting their instance data. Otherwise each draw is issued separately,
+ * only rebinding the instance data when it differs from that of the previous draw.
+ */
+static void executePass(struct Renderer *renderer, enum RenderPass pass, struct PassLocations locations) {
+	unsigned int start, end = renderQueueFindPass(&renderer->queue, pass, &start);
+	const struct RenderCommand *commands = renderer->queue.commands;
+	vertexArrayBind(&renderer->geometryArray);
+
+	if (renderer->multiDrawIndirect) {
+		// The instances are selected by the base instances, leaving the attributes as created
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, renderer->indirectBuffer);
+		for (unsigned int n = start, batchEnd; n < end; n = batchEnd) {
+			const struct RenderCommand *command = commands + n;
+			// The depth program has no color, so its draws only differ in index type
+			for (batchEnd = n + 1; batchEnd < end; ++batchEnd) {
+				const struct RenderCommand *next = commands + batchEnd;
+				if (next->model->indexType != command->model->indexType
+						|| (locations.color && next->part->material != command->part->material)) break;
 			}
-			MATRIX modelMatrix = MatrixTranslationFromVector(position);
-			MATRIX mvp = MatrixMultiply(viewProjection, modelMatrix);
-			glUniformMatrix4fv(renderer->mvpUniform, 1, GL_FALSE, MatrixGet(mv, mvp));
-			glUniformMatrix4fv(renderer->modelUniform, 1, GL_FALSE, MatrixGet(mv, modelMatrix));
-			for (int i = 0; i < model->numParts; ++i) {
-				struct ModelPart *part = model->parts + i;
-				glUniform3fv(renderer->colorUniform, 1, part->material->diffuse);
-				glDrawElements(GL_TRIANGLES, part->count, GL_UNSIGNED_INT, (const GLvoid *) (uintptr_t) part->offset);
+			shaderUniform3fv(locations.color, 1, command->part->material->diffuse);
+			glMultiDrawElementsIndirect(GL_TRIANGLES, command->model->indexType,
+					BUFFER_OFFSET(sizeof(struct DrawElementsIndirectCommand) * n), batchEnd - n, 0);
+		}
+	} else {
+		const struct Model *boundModel = 0;
+		unsigned int boundFirst = 0;
+		for (unsigned int n = start; n < end; ++n) {
+			const struct RenderCommand *command = commands + n;
+			const struct Model *model = command->model;
+			const struct ModelPart *part = command->part;
+			if (model != boundModel) {
+				// Without base vertices the attributes start at the vertices of the model instead
+				if (!renderer->baseVertex) bindVertices(renderer, part->baseVertex);
+				shaderUniform3fv(locations.positionScale, 1, model->positionScale);
+				shaderUniform3fv(locations.positionBias, 1, model->positionBias);
+			}
+			if (renderer->instancing && (model != boundModel || command->first != boundFirst)) {
+				bindInstances(renderer, renderer->firstInstance + command->first);
+				boundFirst = command->first;
+			}
+			boundModel = model;
+			shaderUniform3fv(locations.color, 1, part->material->diffuse);
+
+			const GLvoid *offset = BUFFER_OFFSET(part->firstIndex * indexTypeSize(model->indexType));
+			if (renderer->instancing) {
+				if (renderer->baseVertex) {
+					glDrawElementsInstancedBaseVertex(GL_TRIANGLES, part->count, model->indexType, offset, command->count, part->baseVertex);
+				} else {
+					glDrawElementsInstanced(GL_TRIANGLES, part->count, model->indexType, offset, command->count);
+				}
+			} else {
+				for (unsigned int k = command->first; k < command->first + command->count; ++k) {
+					shaderUniformMatrix4fv(locations.modelUniform, 1, renderer->instanceData + INSTANCE_FLOATS * k);
+					if (renderer->baseVertex) {
+						glDrawElementsBaseVertex(GL_TRIANGLES, part->count, model->indexType, offset, part->baseVertex);
+					} else {
+						glDrawElements(GL_TRIANGLES, part->count, model->indexType, offset);
+					}
+				}
 			}
 		}
 	}
+	vertexArrayUnbind(&renderer->geometryArray);
+}
+
+static struct PassLocations depthPassLocations(struct Renderer *renderer) {
+	return (struct PassLocations) { renderer->depthProgramModel, 0, renderer->depthProgramPositionScale, renderer->depthProgramPositionBias };
+}
+
+static unsigned int countStaticCasters(struct Renderer *renderer) {
+	const struct EntityQuery *query = entityManagerQuery(renderer->manager, RENDER_MASK);
+	unsigned int count = 0;
+	for (unsigned int n = 0; n < query->count; ++n) count += renderer->drawOrder[n].isStatic;
+	return count;
+}
+
+/** The state of the frame shared with the passes of the render graph. */
+struct FrameContext {
+	struct Renderer *renderer;
+	ALIGN(16) float viewProjection[16];
+	ALIGN(16) float invProjection[16];
+	ALIGN(16) float modelView[16];
+};
+
+/** Binds a program of a screen-space pass along with the blocks it reads. */
+static void useScreenProgram(struct Renderer *renderer, struct ShaderProgram *program) {
+	glUseProgram(program->id);
+	shaderProgramApplyBlock(program, &renderer->frameBlock);
+	shaderProgramApplyBlock(program, &renderer->cameraBlock);
+}
+
+static void depthPass(void *data, const struct RenderGraph *graph, const struct RenderGraphPass *pass) {
+	struct FrameContext *context = data;
+	struct Renderer *renderer = context->renderer;
+	const struct PassLocations locations = depthPassLocations(renderer);
+	glEnable(GL_DEPTH_TEST);
+	glClear(GL_DEPTH_BUFFER_BIT);
+	glUseProgram(renderer->depthProgram.id);
+	shaderUniformMatrix4fv(renderer->depthProgramViewProjection, 1, context->viewProjection);
+	executePass(renderer, RENDER_PASS_DEPTH, locations);
+}
+
+/** Renders the scene as normal with shadow mapping, only shading the pixels of the depth pass. */
+static void mainPass(void *data, const struct RenderGraph *graph, const struct RenderGraphPass *pass) {
+	struct FrameContext *context = data;
+	struct Renderer *renderer = context->renderer;
+	const struct PassLocations locations = { renderer->modelUniform, renderer->colorUniform, renderer->positionScaleUniform, renderer->positionBiasUniform };
+	glClear(GL_COLOR_BUFFER_BIT); // Clear the screen
+
+	// Draw the skybox
+	glDisable(GL_DEPTH_TEST);
+	glUseProgram(renderer->skyboxProgram.id);
+	shaderUniformMatrix4fv(renderer->skyboxInvProjectionUniform, 1, context->invProjection);
+	shaderUniformMatrix4fv(renderer->skyboxModelViewUniform, 1, context->modelView);
+	glBindTexture(GL_TEXTURE_CUBE_MAP, renderer->skyboxTexture);
+	drawFullscreenQuad(renderer);
+	glEnable(GL_DEPTH_TEST);
+
+	// Draw the scene
+	glDepthFunc(GL_EQUAL);
+	glDepthMask(GL_FALSE);
+	glUseProgram(renderer->program.id);
+	shaderProgramApplyBlock(&renderer->program, &renderer->shadowBlock);
+	for (int i = 0; i < NUM_SPLITS; ++i) {
+		glActiveTexture(GL_TEXTURE0 + i);
+		glBindTexture(GL_TEXTURE_2D, renderer->shadowMaps[i]);
+		glActiveTexture(GL_TEXTURE0 + NUM_SPLITS + i);
+		glBindTexture(GL_TEXTURE_2D, renderer->staticShadowMaps[i]);
+	}
+	shaderUniformMatrix4fv(renderer->viewProjectionUniform, 1, context->viewProjection);
+	executePass(renderer, RENDER_PASS_MAIN, locations); // Draw each entity
+	glDepthFunc(GL_LESS);
+	glDepthMask(GL_TRUE);
+	glDisable(GL_DEPTH_TEST);
+}
+
+static void linearizeDepthPass(void *data, const struct RenderGraph *graph, const struct RenderGraphPass *pass) {
+	struct Renderer *renderer = data;
+	useScreenProgram(renderer, &renderer->linearizeProgram);
+	drawFullscreenQuad(renderer);
+}
+
+static void downsampleDepthPass(void *data, const struct RenderGraph *graph, const struct RenderGraphPass *pass) {
+	struct Renderer *renderer = data;
+	const struct RenderGraphTextureDesc *source = &graph->resources[pass->inputs[0]].desc;
+	glUseProgram(renderer->downsampleProgram.id);
+	shaderUniform2f(renderer->downsampleSourceInvSize, 1.0f / source->width, 1.0f / source->height);
+	drawFullscreenQuad(renderer);
+}
+
+static void ssaoPass(void *data, const struct RenderGraph *graph, const struct RenderGraphPass *pass) {
+	struct Renderer *renderer = data;
+	glClear(GL_COLOR_BUFFER_BIT);
+	useScreenProgram(renderer, &renderer->ssaoProgram);
+	drawFullscreenQuad(renderer);
+}
+
+/** Blends with the history, which the blur reads so that it is not accumulated. */
+static void ssaoTemporalPass(void *data, const struct RenderGraph *graph, const struct RenderGraphPass *pass) {
+	struct Renderer *renderer = data;
+	useScreenProgram(renderer, &renderer->temporalProgram);
+	shaderUniform1f(renderer->temporalHistoryWeight, renderer->aoHistoryValid ? AO_HISTORY_WEIGHT : 0.0f);
+	drawFullscreenQuad(renderer);
+}
+
+static void ssaoBlurPass(struct Renderer *renderer, float x, float y) {
+	useScreenProgram(renderer, &renderer->blur1Program);
+	shaderUniform2f(renderer->blur1DirectionUniform, x, y);
+	drawFullscreenQuad(renderer);
+}
+
+static void ssaoHorizontalBlurPass(void *data, const struct RenderGraph *graph, const struct RenderGraphPass *pass) {
+	ssaoBlurPass(data, 1.0f, 0.0f);
+}
+
+/** Blurs vertically at reduced resolution, keeping the depth keys for upsampling. */
+static void ssaoVerticalBlurPass(void *data, const struct RenderGraph *graph, const struct RenderGraphPass *pass) {
+	ssaoBlurPass(data, 0.0f, 1.0f);
+}
+
+/** Blurs vertically at full resolution, multiplying the scene by the ambient occlusion. */
+static void ssaoBlendBlurPass(void *data, const struct RenderGraph *graph, const struct RenderGraphPass *pass) {
+	struct Renderer *renderer = data;
+	useScreenProgram(renderer, &renderer->blur2Program);
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_ZERO, GL_SRC_COLOR);
+	drawFullscreenQuad(renderer);
+	glDisable(GL_BLEND);
+}
+
+static void ssaoUpsamplePass(void *data, const struct RenderGraph *graph, const struct RenderGraphPass *pass) {
+	struct Renderer *renderer = data;
+	useScreenProgram(renderer, &renderer->upsampleProgram);
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_ZERO, GL_SRC_COLOR);
+	drawFullscreenQuad(renderer);
+	glDisable(GL_BLEND);
+}
+
+static void velocityTilePass(void *data, const struct RenderGraph *graph, const struct RenderGraphPass *pass) {
+	struct Renderer *renderer = data;
+	useScreenProgram(renderer, &renderer->velocityTileProgram);
+	drawFullscreenQuad(renderer);
+}
+
+static void tileMaxPass(void *data, const struct RenderGraph *graph, const struct RenderGraphPass *pass) {
+	struct Renderer *renderer = data;
+	const struct RenderGraphTextureDesc *source = &graph->resources[pass->inputs[0]].desc;
+	glUseProgram(renderer->tileMaxProgram.id);
+	shaderUniform2f(renderer->tileMaxSourceInvSize, 1.0f / source->width, 1.0f / source->height);
+	drawFullscreenQuad(renderer);
+}
+
+static void effectPass(void *data, const struct RenderGraph *graph, const struct RenderGraphPass *pass) {
+	struct Renderer *renderer = data;
+	const struct RenderGraphTextureDesc *tiles = &graph->resources[pass->inputs[2]].desc;
+	glClear(GL_COLOR_BUFFER_BIT);
+	useScreenProgram(renderer, &renderer->effectProgram);
+	shaderUniform2f(renderer->effectTileInvSize, 1.0f / tiles->width, 1.0f / tiles->height);
+	drawFullscreenQuad(renderer);
+}
+
+static void copyPass(void *data, const struct RenderGraph *graph, const struct RenderGraphPass *pass) {
+	struct Renderer *renderer = data;
+	glUseProgram(renderer->copyProgram.id);
+	drawFullscreenQuad(renderer);
 }
 
 void rendererDraw(struct Renderer *renderer, VECTOR position, float yaw, float pitch, float roll, float dt) {
@@ -710,21 +1402,15 @@ void rendererDraw(struct Renderer *renderer, VECTOR position, float yaw, float p
 	struct Frustum frustum = { Z_NEAR, Z_FAR, DEGREES_TO_RADIANS(FOV), (float) renderer->width / renderer->height };
 	VECTOR points[8];
 	getFrustumPoints(frustum, position, viewDir, points);
-	struct Plane planes[6];
-	getFrustumPlanes(points, planes);
+	struct Plane frustums[NUM_VIEWS][6];
+	getFrustumPlanes(points, frustums[CAMERA_VIEW]);
 
-	// Shadow map pass
-	glViewport(0, 0, DEPTH_SIZE, DEPTH_SIZE);
-	glUseProgram(renderer->depthProgram);
-	glEnableVertexAttribArray(renderer->depthProgramPosition);
-	glBindFramebuffer(GL_FRAMEBUFFER, renderer->depthFbo);
-	// glCullFace(GL_FRONT); // Avoid peter-panning
 	const VECTOR lightDir = Vector4Normalize(VectorSet(-1.0f, -1.0f, 1.0f, 0.0f));
 	const MATRIX lightView = lookAt(VectorSet(0.0f, 0.0f, 0.0f, 1.0f), lightDir, VectorSet(1.0f, 0.0f, 0.0f, 0.0f));
 	float splitDistances[NUM_SPLITS + 1];
 	getSplitDistances(splitDistances, Z_NEAR, Z_FAR);
 	struct Frustum f[NUM_SPLITS];
-	MATRIX shadowCPM[NUM_SPLITS];
+	int updateCascade[NUM_SPLITS];
 	for (int i = 0; i < NUM_SPLITS; ++i) {
 		f[i].fov = DEGREES_TO_RADIANS(FOV) + 0.2f;
 		f[i].ratio = (float) renderer->width / renderer->height;
@@ -734,127 +1420,251 @@ void rendererDraw(struct Renderer *renderer, VECTOR position, float yaw, float p
 		// Compute camera frustum slice boundary points in world space
 		VECTOR frustumPoints[8];
 		getFrustumPoints(f[i], position, viewDir, frustumPoints);
-		calculateCropMatrix(f[i], frustumPoints, lightView, shadowCPM + i);
+		getFrustumPlanes(frustumPoints, frustums[1 + i]);
 
-		struct Plane frustumPlanes[6];
-		getFrustumPlanes(frustumPoints, frustumPlanes);
+		// Skipped cascades keep the matrix they were rendered with
+		updateCascade[i] = i == 0 || renderer->frameIndex == 0 || (renderer->frameIndex + i) % renderer->farCascadeInterval == 0;
+		if (updateCascade[i]) calculateCropMatrix(f[i], frustumPoints, lightView, renderer->shadowCPM + i);
+	}
+	++renderer->frameIndex;
+
+	// Update the constants shared between programs, uploaded once for all of them
+	struct FrameData frameData;
+	ALIGN(16) struct CameraData cameraData;
+	ALIGN(16) struct ShadowData shadowData;
+	memset(&frameData, 0, sizeof frameData);
+	memset(&cameraData, 0, sizeof cameraData);
+	memset(&shadowData, 0, sizeof shadowData);
+	frameData.invResolution[0] = 1.0f / renderer->width;
+	frameData.invResolution[1] = 1.0f / renderer->height;
+	frameData.blurFactor = 50.0f / dt;
+	frameData.effectFactor = renderer->effectFactor;
+	frameData.aoInvResolution[0] = 1.0f / renderer->aoWidth;
+	frameData.aoInvResolution[1] = 1.0f / renderer->aoHeight;
+	frameData.aoSpinAngle = renderer->frameIndex % AO_SPIN_PERIOD * GOLDEN_ANGLE;
+	uniformBlockUpdate(&renderer->frameBlock, &frameData);
+
+	const MATRIX viewProjection = MatrixMultiply(renderer->projection, renderer->view);
+	const int cameraMoved = !isMatrixEqual(renderer->prevViewProjection, viewProjection);
+	MatrixGet(cameraData.currentToPreviousMatrix, MatrixMultiply(renderer->prevViewProjection, MatrixInverse(mvp)));
+	renderer->prevViewProjection = viewProjection;
+	MatrixGet(mv, renderer->projection);
+	const float projInfo[] = { 2.0f / mv[0], 2.0f / mv[5], -1.0f / mv[0], -1.0f / mv[5] },
+		  clipInfo[] = { Z_NEAR * Z_FAR, Z_NEAR - Z_FAR, Z_FAR }; // Clipping plane constants for use by reconstructZ
+	memcpy(cameraData.projInfo, projInfo, sizeof projInfo);
+	memcpy(cameraData.clipInfo, clipInfo, sizeof clipInfo);
+	cameraData.projScale = renderer->aoWidth / (tanf(DEGREES_TO_RADIANS(FOV) * 0.5f) * 2.0f);
+	uniformBlockUpdate(&renderer->cameraBlock, &cameraData);
+
+	for (int i = 0; i < NUM_SPLITS; ++i) {
+		// Compute split far distance in camera homogeneous coordinates and normalize to [0, 1]
+		shadowData.cascadeEndClipSpace[i][0] = 0.5f * (-f[i].fard * mv[10] + mv[14]) / f[i].fard + 0.5f;
+		MatrixGet(shadowData.lightMVP[i], MatrixMultiply(bias, renderer->shadowCPM[i]));
+	}
+	VectorGet(vv, lightDir);
+	memcpy(shadowData.lightDir, vv, sizeof shadowData.lightDir);
+	uniformBlockUpdate(&renderer->shadowBlock, &shadowData);
+
+	// Cull against all views at once
+	updateWorldMatrices(renderer);
+	cullSpheres(&renderer->bounds, frustums, NUM_VIEWS, renderer->visibility);
+
+	// Submit the draws of all passes, then sort them once
+	renderQueueClear(&renderer->queue);
+	renderer->numInstances = renderer->numInstanceGroups = 0;
+	const unsigned int numStaticCasters = countStaticCasters(renderer);
+	if (numStaticCasters != renderer->numStaticCasters) {
+		rendererInvalidateStaticShadows(renderer);
+		renderer->numStaticCasters = numStaticCasters;
+	}
+	int drawStaticShadows[NUM_SPLITS];
+	unsigned int numGathers = 1;
+	for (int i = 0; i < NUM_SPLITS; ++i) {
+		// The static casters are only drawn when the cascade has moved, and are not culled since it may stay put
+		drawStaticShadows[i] = updateCascade[i]
+			&& (!renderer->staticShadowsValid[i] || !isMatrixEqual(renderer->staticShadowCPM[i], renderer->shadowCPM[i]));
+		numGathers += drawStaticShadows[i] + updateCascade[i];
+	}
+	// Each gather adds at most one instance per renderable entity
+	reserveInstances(renderer, numGathers * entityManagerQuery(renderer->manager, RENDER_MASK)->count);
+	for (int i = 0; i < NUM_SPLITS; ++i) {
+		if (drawStaticShadows[i]) submitInstances(renderer, RENDER_PASS_STATIC_SHADOW + i, RENDER_PROGRAM_DEPTH, gatherInstances(renderer, -1, DRAW_STATIC, 0));
+		if (updateCascade[i]) submitInstances(renderer, RENDER_PASS_SHADOW + i, RENDER_PROGRAM_DEPTH, gatherInstances(renderer, 1 + i, DRAW_DYNAMIC, 0));
+	}
+	// The depth and main passes draw the same instances
+	const unsigned int cameraGroups = gatherInstances(renderer, CAMERA_VIEW, DRAW_ALL, VectorGet(vv, position));
+	submitInstances(renderer, RENDER_PASS_DEPTH, RENDER_PROGRAM_DEPTH, cameraGroups);
+	submitInstances(renderer, RENDER_PASS_MAIN, RENDER_PROGRAM_MAIN, cameraGroups);
+	renderQueueSort(&renderer->queue);
+	if (renderer->instancing) {
+		const GLsizei stride = sizeof(GLfloat) * INSTANCE_FLOATS;
+		renderer->firstInstance = streamBufferCommit(&renderer->instanceStream, stride * renderer->numInstances) / stride;
+		if (renderer->instanceStream.buffer != renderer->instanceAttribBuffer) {
+			vertexArrayBind(&renderer->geometryArray);
+			bindInstances(renderer, 0);
+			vertexArrayUnbind(&renderer->geometryArray);
+		}
+	}
+	if (renderer->multiDrawIndirect) uploadIndirectCommands(renderer);
+	geometryArenaUpload(&renderer->geometry);
+	const struct PassLocations depthLocations = depthPassLocations(renderer);
+
+	// Shadow map pass
+	glViewport(0, 0, DEPTH_SIZE, DEPTH_SIZE);
+	glUseProgram(renderer->depthProgram.id);
+	glBindFramebuffer(GL_FRAMEBUFFER, renderer->depthFbo);
+	// glCullFace(GL_FRONT); // Avoid peter-panning
+	for (int i = 0; i < NUM_SPLITS; ++i) {
+		shaderUniformMatrix4fv(renderer->depthProgramViewProjection, 1, MatrixGet(mv, renderer->shadowCPM[i]));
+		if (drawStaticShadows[i]) {
+			gpuProfilerBegin(renderer->profiler, staticShadowPassNames[i]);
+			glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, renderer->staticShadowMaps[i], 0);
+			glClear(GL_DEPTH_BUFFER_BIT);
+			executePass(renderer, RENDER_PASS_STATIC_SHADOW + i, depthLocations);
+			gpuProfilerEnd(renderer->profiler);
+			renderer->staticShadowCPM[i] = renderer->shadowCPM[i];
+			renderer->staticShadowsValid[i] = 1;
+		}
+		if (!updateCascade[i]) continue;
 
 		// Bind and clear current cascade
+		gpuProfilerBegin(renderer->profiler, shadowPassNames[i]);
 		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, renderer->shadowMaps[i], 0);
 		glClear(GL_DEPTH_BUFFER_BIT);
-		drawEntitiesDepth(renderer, shadowCPM[i], frustumPlanes);
+		executePass(renderer, RENDER_PASS_SHADOW + i, depthLocations);
+		gpuProfilerEnd(renderer->profiler);
 	}
 	// glCullFace(GL_BACK);
-	glViewport(0, 0, renderer->width, renderer->height);
-
-	// Depth pass
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, renderer->depthTexture, 0);
-	glClear(GL_DEPTH_BUFFER_BIT);
-	drawEntitiesDepth(renderer, mvp, planes);
-	glDisableVertexAttribArray(renderer->depthProgramPosition);
-
-	// Main pass: render scene as normal with shadow mapping (using depth map)
-	glBindFramebuffer(GL_FRAMEBUFFER, renderer->sceneFbo);
-	glClear(GL_COLOR_BUFFER_BIT); // Clear the screen
-
-	// Draw the skybox
-	glDisable(GL_DEPTH_TEST);
-	glUseProgram(renderer->skyboxProgram);
-	glUniformMatrix4fv(glGetUniformLocation(renderer->skyboxProgram, "invProjection"), 1, GL_FALSE, MatrixGet(mv, MatrixInverse(renderer->projection)));
-	glUniformMatrix4fv(glGetUniformLocation(renderer->skyboxProgram, "modelView"), 1, GL_FALSE, MatrixGet(mv, modelView));
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_CUBE_MAP, renderer->skyboxTexture);
-	glBindBuffer(GL_ARRAY_BUFFER, renderer->quadBuffer);
-	glEnableVertexAttribArray(renderer->skyboxPositionAttrib);
-	glVertexAttribPointer(renderer->skyboxPositionAttrib, 2, GL_FLOAT, GL_FALSE, 0, 0);
-	glDrawArrays(GL_TRIANGLES, 0, 6);
-	glDisableVertexAttribArray(renderer->skyboxPositionAttrib);
-	glEnable(GL_DEPTH_TEST);
 
-	// Draw the scene
-	glDepthFunc(GL_EQUAL);
-	glDepthMask(GL_FALSE);
-	glUseProgram(renderer->program);
-	float cascadeEndClipSpace[NUM_SPLITS];
-	GLfloat shadowCPMValues[NUM_SPLITS * 16];
-	MatrixGet(mv, renderer->projection);
-	for (int i = 0; i < NUM_SPLITS; ++i) {
-		// Compute split far distance in camera homogeneous coordinates and normalize to [0, 1]
-		const float farBound = 0.5f * (-f[i].fard * mv[10] + mv[14]) / f[i].fard + 0.5f;
-		cascadeEndClipSpace[i] = farBound;
+	struct FrameContext context;
+	context.renderer = renderer;
+	MatrixGet(context.viewProjection, mvp);
+	MatrixGet(context.invProjection, MatrixInverse(renderer->projection));
+	MatrixGet(context.modelView, modelView);
+
+	// Declare the screen-space passes, letting the graph allocate their targets and cull what is unused
+	struct RenderGraph *graph = &renderer->graph;
+	renderGraphClear(graph);
+	const int width = renderer->width, height = renderer->height, aoWidth = renderer->aoWidth, aoHeight = renderer->aoHeight;
+	const struct RenderGraphTextureDesc depthDesc = { width, height, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, GL_LINEAR },
+		  sceneDesc = { width, height, GL_RGB, GL_UNSIGNED_BYTE, GL_LINEAR },
+		  aoDesc = { aoWidth, aoHeight, GL_RGB, GL_UNSIGNED_BYTE, GL_NEAREST };
+	const int depth = renderGraphCreateTexture(graph, "depth", depthDesc),
+		  scene = renderGraphCreateTexture(graph, "scene", sceneDesc),
+		  backbuffer = renderGraphImportTexture(graph, "backbuffer", 0, width, height);
+	int pass = renderGraphAddPass(graph, "depth", depthPass, &context);
+	renderGraphDepth(graph, pass, depth, 1);
+	pass = renderGraphAddPass(graph, "main", mainPass, &context);
+	renderGraphWrite(graph, pass, scene);
+	renderGraphDepth(graph, pass, depth, 0);
+
+	/*
+	 * Camera-space depth at the ambient occlusion resolution and successively halved, packed in RGB.
+	 * Separate textures rather than mipmap levels, as only level zero can be rendered to in GLES 2.
+	 */
+	int depthMips[NUM_DEPTH_MIPS];
+	for (int i = 0; i < NUM_DEPTH_MIPS; ++i) {
+		const struct RenderGraphTextureDesc desc = { MAX(aoWidth >> i, 1), MAX(aoHeight >> i, 1), GL_RGB, GL_UNSIGNED_BYTE, GL_NEAREST };
+		depthMips[i] = renderGraphCreateTexture(graph, "depthMip", desc);
+		pass = i == 0 ? renderGraphAddPass(graph, "linearizeDepth", linearizeDepthPass, renderer)
+			: renderGraphAddPass(graph, "downsampleDepth", downsampleDepthPass, renderer);
+		renderGraphRead(graph, pass, i == 0 ? depth : depthMips[i - 1]);
+		renderGraphWrite(graph, pass, depthMips[i]);
+	}
 
-		MatrixGet(shadowCPMValues + 16 * i, MatrixMultiply(bias, shadowCPM[i]));
+	// Ambient occlusion, accumulated into one history texture while the other is read
+	const int ssao = renderGraphCreateTexture(graph, "ssao", aoDesc),
+		  ssaoBlur = renderGraphCreateTexture(graph, "ssaoBlur", aoDesc),
+		  history = renderGraphImportTexture(graph, "ssaoHistory", renderer->aoHistory[!renderer->aoHistoryIndex], aoWidth, aoHeight),
+		  accumulated = renderGraphImportTexture(graph, "ssaoAccumulated", renderer->aoHistory[renderer->aoHistoryIndex], aoWidth, aoHeight);
+	pass = renderGraphAddPass(graph, "ssao", ssaoPass, renderer);
+	for (int i = 0; i < NUM_DEPTH_MIPS; ++i) renderGraphRead(graph, pass, depthMips[i]);
+	renderGraphWrite(graph, pass, ssao);
+	pass = renderGraphAddPass(graph, "ssaoTemporal", ssaoTemporalPass, renderer);
+	renderGraphRead(graph, pass, ssao);
+	renderGraphRead(graph, pass, history);
+	renderGraphWrite(graph, pass, accumulated);
+	pass = renderGraphAddPass(graph, "ssaoBlurX", ssaoHorizontalBlurPass, renderer);
+	renderGraphRead(graph, pass, accumulated);
+	renderGraphWrite(graph, pass, ssaoBlur);
+	if (renderer->ssaoQuality == SSAO_FULL) {
+		pass = renderGraphAddPass(graph, "ssaoBlurY", ssaoBlendBlurPass, renderer);
+		renderGraphRead(graph, pass, ssaoBlur);
+		renderGraphWrite(graph, pass, scene);
+	} else {
+		const int ssaoBlurred = renderGraphCreateTexture(graph, "ssaoBlurred", aoDesc);
+		pass = renderGraphAddPass(graph, "ssaoBlurY", ssaoVerticalBlurPass, renderer);
+		renderGraphRead(graph, pass, ssaoBlur);
+		renderGraphWrite(graph, pass, ssaoBlurred);
+		pass = renderGraphAddPass(graph, "ssaoUpsample", ssaoUpsamplePass, renderer);
+		renderGraphRead(graph, pass, ssaoBlurred);
+		renderGraphRead(graph, pass, depth);
+		renderGraphWrite(graph, pass, scene);
+	}
 
-		glActiveTexture(GL_TEXTURE0 + i);
-		glBindTexture(GL_TEXTURE_2D, renderer->shadowMaps[i]);
+	/*
+	 * The largest motion blur length of each screen tile, first reduced along rows then along columns.
+	 * Motion blur takes fewer samples on tiles of little motion and none on static ones.
+	 */
+	const int tilesWidth = (width + VELOCITY_TILE_SIZE - 1) / VELOCITY_TILE_SIZE,
+		  tilesHeight = (height + VELOCITY_TILE_SIZE - 1) / VELOCITY_TILE_SIZE;
+	const struct RenderGraphTextureDesc rowTilesDesc = { tilesWidth, height, GL_RGB, GL_UNSIGNED_BYTE, GL_NEAREST },
+		  tilesDesc = { tilesWidth, tilesHeight, GL_RGB, GL_UNSIGNED_BYTE, GL_NEAREST };
+	const int rowTiles = renderGraphCreateTexture(graph, "velocityTileRows", rowTilesDesc),
+		  tiles = renderGraphCreateTexture(graph, "velocityTiles", tilesDesc);
+	pass = renderGraphAddPass(graph, "velocityTileRows", velocityTilePass, renderer);
+	renderGraphRead(graph, pass, depth);
+	renderGraphWrite(graph, pass, rowTiles);
+	pass = renderGraphAddPass(graph, "velocityTiles", tileMaxPass, renderer);
+	renderGraphRead(graph, pass, rowTiles);
+	renderGraphWrite(graph, pass, tiles);
+	/*
+	 * Without effects the scene is copied as is, which leaves the velocity tiles unused and culled.
+	 * Either pass writes the backbuffer, which is imported so its writers are never culled, hence the choice here.
+	 */
+	if (cameraMoved || renderer->effectFactor != 0.0f) {
+		pass = renderGraphAddPass(graph, "motionBlur", effectPass, renderer);
+		renderGraphRead(graph, pass, scene);
+		renderGraphRead(graph, pass, depth);
+		renderGraphRead(graph, pass, tiles);
+	} else {
+		pass = renderGraphAddPass(graph, "present", copyPass, renderer);
+		renderGraphRead(graph, pass, scene);
 	}
-	glUniform1fv(glGetUniformLocation(renderer->program, "cascadeEndClipSpace"), NUM_SPLITS, cascadeEndClipSpace);
-	glUniformMatrix4fv(glGetUniformLocation(renderer->program, "lightMVP"), NUM_SPLITS, GL_FALSE, shadowCPMValues);
-	glUniform3fv(glGetUniformLocation(renderer->program, "lightDir"), 1, VectorGet(vv, lightDir));
-	glEnableVertexAttribArray(renderer->posAttrib);
-	glEnableVertexAttribArray(renderer->normalAttrib);
-	drawEntities(renderer, mvp, planes); // Draw each entity
-	glDisableVertexAttribArray(renderer->posAttrib);
-	glDisableVertexAttribArray(renderer->normalAttrib);
-	glDepthFunc(GL_LESS);
+	renderGraphWrite(graph, pass, backbuffer);
 
-	glDisable(GL_DEPTH_TEST);
-	glBindBuffer(GL_ARRAY_BUFFER, renderer->quadBuffer);
+	renderGraphCompile(graph);
+	renderGraphExecute(graph);
+	renderer->aoHistoryIndex = !renderer->aoHistoryIndex;
+	renderer->aoHistoryValid = 1;
+}
 
-	// Draw ambient occlusion
-	glBindFramebuffer(GL_FRAMEBUFFER, renderer->ssaoFbo);
-	glClear(GL_COLOR_BUFFER_BIT);
-	glUseProgram(renderer->ssaoProgram);
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, renderer->depthTexture);
-	glEnableVertexAttribArray(renderer->ssaoPosition);
-	glVertexAttribPointer(renderer->ssaoPosition, 2, GL_FLOAT, GL_FALSE, 0, 0);
-	glDrawArrays(GL_TRIANGLES, 0, 6);
-	glDisableVertexAttribArray(renderer->ssaoPosition);
+void rendererSetEffectFactor(struct Renderer *renderer, float f) {
+	renderer->effectFactor = f;
+}
 
-	glBindFramebuffer(GL_FRAMEBUFFER, renderer->blurFbo);
-	glClear(GL_COLOR_BUFFER_BIT);
-	glUseProgram(renderer->blur1Program);
-	glBindTexture(GL_TEXTURE_2D, renderer->ssaoTexture);
-	glEnableVertexAttribArray(renderer->blur1Position);
-	glVertexAttribPointer(renderer->blur1Position, 2, GL_FLOAT, GL_FALSE, 0, 0);
-	glUniform2f(glGetUniformLocation(renderer->blur1Program, "invResolutionDirection"), 1.0f / renderer->width, 0);
-	glDrawArrays(GL_TRIANGLES, 0, 6);
-	glDisableVertexAttribArray(renderer->blur1Position);
+void rendererSetSsaoQuality(struct Renderer *renderer, enum SsaoQuality quality) {
+	renderer->ssaoQuality = quality;
+	resizeAmbientOcclusion(renderer);
+}
 
-	glUseProgram(renderer->blur2Program);
-	glBindFramebuffer(GL_FRAMEBUFFER, renderer->sceneFbo);
-	glEnable(GL_BLEND);
-	glBlendFunc(GL_ZERO, GL_SRC_COLOR);
-	glBindTexture(GL_TEXTURE_2D, renderer->blurTexture);
-	glUniform2f(glGetUniformLocation(renderer->blur2Program, "invResolutionDirection"), 0, 1.0f / renderer->height);
-	glEnableVertexAttribArray(renderer->blur2Position);
-	glVertexAttribPointer(renderer->blur2Position, 2, GL_FLOAT, GL_FALSE, 0, 0);
-	glDrawArrays(GL_TRIANGLES, 0, 6);
-	glDisableVertexAttribArray(renderer->blur2Position);
-	glDisable(GL_BLEND);
+void rendererSetOutputFramebuffer(struct Renderer *renderer, GLuint framebuffer) {
+	renderer->graph.defaultFramebuffer = framebuffer;
+}
 
-	// Draw motion blur
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
-	glClear(GL_COLOR_BUFFER_BIT);
-	glUseProgram(renderer->effectProgram);
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, renderer->sceneTexture);
-	glActiveTexture(GL_TEXTURE1);
-	glBindTexture(GL_TEXTURE_2D, renderer->depthTexture);
-	MATRIX viewProjectionInverse = MatrixInverse(mvp);
-	glUniformMatrix4fv(renderer->effectCurrToPrevUniform, 1, GL_FALSE, MatrixGet(mv, MatrixMultiply(renderer->prevViewProjection, viewProjectionInverse)));
-	glUniform1f(renderer->effectBlurFactorUniform, 50.0f / dt);
-	renderer->prevViewProjection = MatrixMultiply(renderer->projection, renderer->view);
-	glEnableVertexAttribArray(renderer->effectPosition);
-	glVertexAttribPointer(renderer->effectPosition, 2, GL_FLOAT, GL_FALSE, 0, 0);
-	glDrawArrays(GL_TRIANGLES, 0, 6);
-	glDisableVertexAttribArray(renderer->effectPosition);
+void rendererSetProfiler(struct Renderer *renderer, struct GpuProfiler *profiler) {
+	renderer->profiler = renderer->graph.profiler = profiler;
+}
 
-	glDepthMask(GL_TRUE);
+void rendererSetInterpolation(struct Renderer *renderer, float alpha) {
+	renderer->alpha = alpha;
 }
 
-void rendererSetEffectFactor(struct Renderer *renderer, float f) {
-	glUseProgram(renderer->effectProgram);
-	glUniform1f(renderer->effectFactorUniform, f);
+void rendererSetFarCascadeInterval(struct Renderer *renderer, int interval) {
+	assert(interval >= 1 && "The interval must be positive.");
+	renderer->farCascadeInterval = interval;
+}
+
+void rendererInvalidateStaticShadows(struct Renderer *renderer) {
+	for (int i = 0; i < NUM_SPLITS; ++i) renderer->staticShadowsValid[i] = 0;
 }
@@ -5,30 +5,158 @@
 #include <vmath.h>
 #include "entity.h"
 #include "model.h"
+#include "glUtil.h"
+#include "culling.h"
+#include "renderQueue.h"
+#include "renderGraph.h"
+#include "gpuProfiler.h"
+#include "streamBuffer.h"
 
 // The number of cascades.
 #define NUM_SPLITS 3
+// The number of levels of the camera-space depth pyramid read by ambient occlusion.
+#define NUM_DEPTH_MIPS 4
+/** The floats of each instance: the world matrix, then the scale and bias decoding the positions, each padded to four. */
+#define INSTANCE_FLOATS 24
+
+/** The resolution ambient occlusion is computed at, as a fraction of the screen size. */
+enum SsaoQuality {
+	SSAO_FULL,
+	SSAO_HALF,
+	SSAO_QUARTER
+};
+
+/** A renderable entity, identified by its index in the render query. */
+struct DrawItem {
+	struct Model *model;
+	unsigned int index;
+	int isStatic;
+};
+
+/** A run of instances of the same model within the instance data of the frame. */
+struct InstanceGroup {
+	struct Model *model;
+	unsigned int first, count;
+	/** The distance from the viewer to the nearest instance, or zero if not sorted by depth. */
+	float depth;
+};
+
+/** The parameters of a draw read from the indirect draw buffer. */
+struct DrawElementsIndirectCommand {
+	GLuint count, instanceCount, firstIndex;
+	GLint baseVertex;
+	GLuint baseInstance;
+};
 
 struct Renderer {
 	struct EntityManager *manager;
 	int width, height;
 	MATRIX model, view, projection, prevViewProjection;
-	GLuint program;
-	GLint posAttrib, normalAttrib, mvpUniform, modelUniform, colorUniform;
+	struct ShaderProgram program;
+	struct ShaderUniform *viewProjectionUniform, *modelUniform, *colorUniform;
+	/** Decode the compressed positions, as uniforms or as per-instance attributes when instancing. */
+	struct ShaderUniform *positionScaleUniform, *positionBiasUniform;
+
+	struct ShaderProgram depthProgram;
+	GLuint depthFbo,
+		   shadowMaps[NUM_SPLITS], // Depth textures
+		   staticShadowMaps[NUM_SPLITS]; // Cached depth of the static casters
+	struct ShaderUniform *depthProgramViewProjection, *depthProgramModel, *depthProgramPositionScale, *depthProgramPositionBias;
+
+	struct ShaderProgram ssaoProgram, blur1Program, blur2Program, effectProgram, copyProgram;
+	GLuint quadBuffer;
+	/** The triangles covering the screen, drawn by all screen-space passes and the skybox. */
+	struct VertexArray quadArray;
+	float effectFactor;
+	struct ShaderUniform *blur1DirectionUniform;
 
-	GLuint sceneFbo, sceneTexture;
+	/** The size of the ambient occlusion targets is that of the screen shifted right by the quality. */
+	enum SsaoQuality ssaoQuality;
+	int aoWidth, aoHeight;
+	struct ShaderProgram linearizeProgram, downsampleProgram, upsampleProgram;
+	struct ShaderUniform *downsampleSourceInvSize;
+	/**
+	 * Ambient occlusion accumulated over previous frames, with its depth keys.
+	 * The two targets alternate between being read as history and written as the result.
+	 */
+	GLuint aoHistory[2];
+	int aoHistoryIndex, aoHistoryValid;
+	struct ShaderProgram temporalProgram;
+	struct ShaderUniform *temporalHistoryWeight;
 
-	GLuint depthProgram, depthFbo,
-		   depthTexture, shadowMaps[NUM_SPLITS]; // Depth textures
-	GLint depthProgramPosition, depthProgramMvp;
+	struct ShaderProgram velocityTileProgram, tileMaxProgram;
+	struct ShaderUniform *tileMaxSourceInvSize, *effectTileInvSize;
 
-	GLuint quadBuffer,
-		   ssaoProgram, ssaoPosition, ssaoTexture, ssaoFbo,
-		   blur1Program, blur1Position, blur2Program, blur2Position, blurTexture, blurFbo,
-		   effectProgram, effectPosition, effectCurrToPrevUniform, effectBlurFactorUniform, effectFactorUniform;
+	/** Whether the blocks are backed by uniform buffer objects, rather than set in each program. */
+	int uniformBuffers;
+	/** Constants shared between programs, updated once per frame. */
+	struct UniformBlock frameBlock, cameraBlock, shadowBlock;
 
-	GLuint skyboxTexture, skyboxProgram;
-	GLint skyboxPositionAttrib;
+	/** The light matrices the cascades were last rendered with. */
+	MATRIX shadowCPM[NUM_SPLITS];
+	/** The light matrices the static shadow maps were rendered with. */
+	MATRIX staticShadowCPM[NUM_SPLITS];
+	int staticShadowsValid[NUM_SPLITS];
+	/** The number of static casters when the static shadow maps were rendered. */
+	unsigned int numStaticCasters;
+	/** Cascades after the first are re-rendered every this many frames, staggered between frames. */
+	int farCascadeInterval;
+	unsigned int frameIndex;
+
+	GLuint skyboxTexture;
+	struct ShaderProgram skyboxProgram;
+	struct ShaderUniform *skyboxInvProjectionUniform, *skyboxModelViewUniform;
+
+	/** The fraction of the way between the last two simulation steps to draw entities at. */
+	float alpha;
+	/**
+	 * World matrices of the renderable entities, 16 floats each in query order,
+	 * computed once per frame and shared by all passes.
+	 */
+	float *worldMatrices;
+	/** Bounding spheres of the renderable entities in world space, including their scale. */
+	struct SphereArray bounds;
+	/** Bitmask of the views each renderable entity is visible in, computed once per frame. */
+	unsigned char *visibility;
+	unsigned int worldCapacity;
+
+	/**
+	 * Whether entities sharing a model are drawn with one instanced draw call per part.
+	 * Otherwise the model matrix is a uniform set before drawing each instance.
+	 */
+	int instancing;
+	/** Streams the instance data of each frame when instancing. */
+	struct StreamBuffer instanceStream;
+	/** The position of the instance data of the frame in the stream, counted in instances. */
+	unsigned int firstInstance;
+	/** The buffer the instance attributes of the geometry array point into, which changes when the stream grows. */
+	GLuint instanceAttribBuffer;
+	/** Whether vertices can be offset by a base vertex when drawing, otherwise the attributes are respecified. */
+	int baseVertex;
+	/** Whether each pass is drawn with indirect multi-draws, with a command per draw of the queue. */
+	int multiDrawIndirect;
+	GLuint indirectBuffer;
+	struct DrawElementsIndirectCommand *indirectCommands;
+	unsigned int indirectCapacity;
+	/** The vertices and indices of all models. */
+	struct GeometryArena geometry;
+	/** The vertices of the arena along with the instance data, shared by the depth and main programs. */
+	struct VertexArray geometryArray;
+	/** The renderable entities sorted by model, so that instances of the same model are adjacent. */
+	struct DrawItem *drawOrder;
+	/**
+	 * The data of the instances drawn by the passes of this frame, ::INSTANCE_FLOATS each, grouped by model.
+	 * Reserved in the instance stream when instancing, so that it is written where the GPU reads it.
+	 */
+	float *instanceData;
+	struct InstanceGroup *instanceGroups;
+	unsigned int numInstances, numInstanceGroups, instanceCapacity;
+	/** The draws of all passes of this frame, sorted to minimise state changes. */
+	struct RenderQueue queue;
+	/** The screen-space passes of the frame, which allocates the textures that only live within it. */
+	struct RenderGraph graph;
+	/** Times the passes of each frame, if not null. */
+	struct GpuProfiler *profiler;
 };
 
 int rendererInit(struct Renderer *renderer, struct EntityManager *manager, int width, int height);
@@ -41,4 +169,24 @@ void rendererDraw(struct Renderer *renderer, VECTOR position, float yaw, float p
 
 void rendererSetEffectFactor(struct Renderer *renderer, float f);
 
+void rendererSetInterpolation(struct Renderer *renderer, float alpha);
+
+/** Sets the resolution ambient occlusion is computed at, before being upsampled to the screen. */
+void rendererSetSsaoQuality(struct Renderer *renderer, enum SsaoQuality quality);
+
+/**
+ * Re-renders cascades after the first only every \p interval frames; one updates all of them every frame.
+ * Skipped cascades keep the shadows of their last update.
+ */
+void rendererSetFarCascadeInterval(struct Renderer *renderer, int interval);
+
+/** Sets the framebuffer the frame is presented to, or zero for the window. */
+void rendererSetOutputFramebuffer(struct Renderer *renderer, GLuint framebuffer);
+
+/** Times the passes of following frames with the profiler, or stops timing them if null. */
+void rendererSetProfiler(struct Renderer *renderer, struct GpuProfiler *profiler);
+
+/** Forces the shadows of the static entities to be re-rendered, for when they have moved. */
+void rendererInvalidateStaticShadows(struct Renderer *renderer);
+
 #endif
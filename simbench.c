@@ -0,0 +1,172 @@
+/*
+ * Headless benchmark of the entity manager and gameplay systems.
+ * Steps a horde of enemies chasing the player at the fixed simulation rate without a window or GL context,
+ * and reports the cost of each system per entity and tick along with percentiles of the tick times.
+ *
+ * Usage: fpsgame_simbench [ticks]
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include <time.h>
+#include <assert.h>
+#include "entity.h"
+#include "spatialHash.h"
+#include "systems.h"
+
+#define SIMULATION_STEP (1000.0f / 120.0f)
+#define DEFAULT_TICKS 600
+#define WARMUP_TICKS 60
+/** The average distance between neighbouring enemies; the area grows with their number. */
+#define ENEMY_SPACING 4.0f
+#define PLAYER_SPEED .02f
+
+enum {
+	SAVE_POSITIONS,
+	ENEMY_SYSTEM,
+	BROADPHASE_SYSTEM,
+	COLLISION_SYSTEM,
+	VELOCITY_SYSTEM,
+	NUM_SYSTEMS
+};
+
+static const char *systemNames[NUM_SYSTEMS] = { "savePositions", "enemies", "broadphase", "collisions", "velocities" };
+
+static const int entityCounts[] = { 128, 1000, 10000, 100000 };
+
+static long long getNanoseconds() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int compareTimes(const void *a, const void *b) {
+	long long x = *(const long long *) a, y = *(const long long *) b;
+	return (x > y) - (x < y);
+}
+
+/** Returns the nearest-rank percentile of the sorted times. */
+static long long percentile(const long long *sorted, int count, float p) {
+	int rank = (int) ceilf(p / 100.0f * count);
+	return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+static void onPlayerHit(void *data) {
+	++*(int *) data;
+}
+
+static void spawnHorde(struct EntityManager *manager, Entity *player, int numEnemies) {
+	entityManagerClear(manager);
+	*player = entityManagerSpawn(manager);
+	unsigned int playerIndex = entityIndex(*player);
+	entityManagerSetMask(manager, *player, POSITION_COMPONENT_MASK | VELOCITY_COMPONENT_MASK | COLLIDER_COMPONENT_MASK);
+	entityManagerSetPosition(manager, playerIndex, VectorSet(0.0f, 0.0f, 0.0f, 1.0f));
+	entityManagerSetVelocity(manager, playerIndex, VectorSet(0.0f, 0.0f, -PLAYER_SPEED, 0.0f));
+	manager->colliders[playerIndex].radius = 0.2f;
+
+	const float range = ENEMY_SPACING * sqrtf(numEnemies);
+	for (int i = 0; i < numEnemies; ++i) {
+		Entity enemyEntity = entityManagerSpawn(manager);
+		entityManagerSetMask(manager, enemyEntity, POSITION_COMPONENT_MASK | VELOCITY_COMPONENT_MASK | COLLIDER_COMPONENT_MASK | ENEMY_COMPONENT_MASK);
+		unsigned int enemy = entityIndex(enemyEntity);
+		float x = range * ((float) rand() / RAND_MAX) - range / 2, z = range * ((float) rand() / RAND_MAX) - range / 2;
+		entityManagerSetPosition(manager, enemy, VectorSet(x, 0.0f, z, 1.0f));
+		entityManagerSetVelocity(manager, enemy, VectorReplicate(0.0f));
+		manager->colliders[enemy].radius = 0.5f;
+	}
+}
+
+static void runBenchmark(int numEnemies, int ticks) {
+	struct EntityManager manager;
+	struct SpatialHash broadphase;
+	entityManagerInit(&manager);
+	spatialHashInit(&broadphase);
+	Entity player;
+	srand(1); // The same horde on every run
+	spawnHorde(&manager, &player, numEnemies);
+
+	long long *times = malloc(sizeof *times * NUM_SYSTEMS * ticks);
+	assert(times && "Failed to allocate memory.");
+	int hits = 0;
+	const float dt = SIMULATION_STEP;
+	for (int tick = -WARMUP_TICKS; tick < ticks; ++tick) {
+		long long start = getNanoseconds(), end, systemTimes[NUM_SYSTEMS];
+
+		// Same order as the game update, run serially to measure each system in isolation
+		entityManagerSavePositions(&manager);
+		end = getNanoseconds();
+		systemTimes[SAVE_POSITIONS] = end - start;
+
+		struct SystemContext context;
+		systemContextInit(&context, &manager, &broadphase, player, dt);
+		context.onPlayerHit = onPlayerHit;
+		context.data = &hits;
+
+		start = getNanoseconds();
+		processEnemies(&context, 0, context.enemies->count);
+		end = getNanoseconds();
+		systemTimes[ENEMY_SYSTEM] = end - start;
+
+		start = end;
+		buildBroadphase(&context, 0, 1);
+		end = getNanoseconds();
+		systemTimes[BROADPHASE_SYSTEM] = end - start;
+
+		start = end;
+		processCollisions(&context, 0, 1);
+		end = getNanoseconds();
+		systemTimes[COLLISION_SYSTEM] = end - start;
+
+		start = end;
+		processVelocities(&context, 0, entityManagerNumBatches(&manager));
+		end = getNanoseconds();
+		systemTimes[VELOCITY_SYSTEM] = end - start;
+
+		if (tick >= 0) {
+			for (int i = 0; i < NUM_SYSTEMS; ++i) times[i * ticks + tick] = systemTimes[i];
+		}
+	}
+
+	const int numEntities = numEnemies + 1;
+	long long *totals = calloc(ticks, sizeof *totals);
+	assert(totals && "Failed to allocate memory.");
+	for (int i = 0; i < NUM_SYSTEMS; ++i) {
+		long long *systemTimes = times + i * ticks, sum = 0;
+		for (int tick = 0; tick < ticks; ++tick) {
+			sum += systemTimes[tick];
+			totals[tick] += systemTimes[tick];
+		}
+		qsort(systemTimes, ticks, sizeof *systemTimes, compareTimes);
+		printf("%9d %-14s %11.2f %10.1f %10.1f %10.1f\n", numEntities, systemNames[i],
+				(double) sum / ticks / numEntities,
+				percentile(systemTimes, ticks, 50) / 1000.0, percentile(systemTimes, ticks, 90) / 1000.0,
+				percentile(systemTimes, ticks, 99) / 1000.0);
+	}
+	long long sum = 0;
+	for (int tick = 0; tick < ticks; ++tick) sum += totals[tick];
+	qsort(totals, ticks, sizeof *totals, compareTimes);
+	printf("%9d %-14s %11.2f %10.1f %10.1f %10.1f  (%d player hits)\n", numEntities, "total",
+			(double) sum / ticks / numEntities,
+			percentile(totals, ticks, 50) / 1000.0, percentile(totals, ticks, 90) / 1000.0,
+			percentile(totals, ticks, 99) / 1000.0, hits);
+
+	free(totals);
+	free(times);
+	spatialHashDestroy(&broadphase);
+	entityManagerDestroy(&manager);
+}
+
+int main(int argc, char *argv[]) {
+	int ticks = argc > 1 ? atoi(argv[1]) : DEFAULT_TICKS;
+	if (ticks <= 0) {
+		fprintf(stderr, "Usage: %s [ticks]\n", argv[0]);
+		return 1;
+	}
+
+	printf("%d ticks of %.2f ms per run\n", ticks, SIMULATION_STEP);
+	printf("%9s %-14s %11s %10s %10s %10s\n", "entities", "system", "ns/ent/tick", "p50 us", "p90 us", "p99 us");
+	for (unsigned int i = 0; i < sizeof entityCounts / sizeof *entityCounts; ++i) {
+		runBenchmark(entityCounts[i], ticks);
+	}
+	return 0;
+}
@@ -0,0 +1,172 @@
+#include "spatialHash.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+
+#define NUM_NEIGHBOR_CELLS 27
+/**
+ * How much larger than needed the cells are made when rebuilding,
+ * so that speeds creeping up do not force a rebuild every step.
+ */
+#define CELL_SIZE_SLACK 1.5f
+
+static unsigned int hashCell(const struct SpatialHash *hash, const int *cell) {
+	return ((unsigned int) cell[0] * 73856093u ^ (unsigned int) cell[1] * 19349663u ^ (unsigned int) cell[2] * 83492791u) & (hash->numBuckets - 1);
+}
+
+void spatialHashInit(struct SpatialHash *hash) {
+	hash->cellSize = 0.0f;
+	hash->numBuckets = hash->count = hash->slotCapacity = hash->stamp = 0;
+	hash->bucketHeads = hash->members = hash->memberIndices = hash->next = hash->prev = hash->buckets = hash->stamps = 0;
+	hash->cells = 0;
+}
+
+void spatialHashDestroy(struct SpatialHash *hash) {
+	free(hash->bucketHeads);
+	free(hash->members);
+	free(hash->memberIndices);
+	free(hash->next);
+	free(hash->prev);
+	free(hash->buckets);
+	free(hash->cells);
+	free(hash->stamps);
+}
+
+/** Grows the arrays indexed by slot to the capacity of the entity manager. */
+static void spatialHashReserve(struct SpatialHash *hash, unsigned int capacity) {
+	if (capacity <= hash->slotCapacity) return;
+	unsigned int *members = realloc(hash->members, sizeof *members * capacity),
+				 *memberIndices = realloc(hash->memberIndices, sizeof *memberIndices * capacity),
+				 *next = realloc(hash->next, sizeof *next * capacity),
+				 *prev = realloc(hash->prev, sizeof *prev * capacity),
+				 *buckets = realloc(hash->buckets, sizeof *buckets * capacity),
+				 *stamps = realloc(hash->stamps, sizeof *stamps * capacity);
+	int (*cells)[3] = realloc(hash->cells, sizeof *cells * capacity);
+	assert(members && memberIndices && next && prev && buckets && stamps && cells && "Failed to reallocate array.");
+	for (unsigned int i = hash->slotCapacity; i < capacity; ++i) memberIndices[i] = SPATIAL_HASH_NONE;
+	hash->members = members;
+	hash->memberIndices = memberIndices;
+	hash->next = next;
+	hash->prev = prev;
+	hash->buckets = buckets;
+	hash->stamps = stamps;
+	hash->cells = cells;
+	hash->slotCapacity = capacity;
+}
+
+static void linkEntity(struct SpatialHash *hash, unsigned int i) {
+	unsigned int bucket = hash->buckets[i] = hashCell(hash, hash->cells[i]), head = hash->bucketHeads[bucket];
+	hash->next[i] = head;
+	hash->prev[i] = SPATIAL_HASH_NONE;
+	if (head != SPATIAL_HASH_NONE) hash->prev[head] = i;
+	hash->bucketHeads[bucket] = i;
+}
+
+static void unlinkEntity(struct SpatialHash *hash, unsigned int i) {
+	unsigned int next = hash->next[i], prev = hash->prev[i];
+	if (prev != SPATIAL_HASH_NONE) hash->next[prev] = next;
+	else hash->bucketHeads[hash->buckets[i]] = next;
+	if (next != SPATIAL_HASH_NONE) hash->prev[next] = prev;
+}
+
+/** Empties the grid with new cells and buckets, to be filled again by the update. */
+static void spatialHashReset(struct SpatialHash *hash, float cellSize, unsigned int count) {
+	hash->cellSize = cellSize;
+	// Keep the load factor at most one half
+	unsigned int numBuckets = 64;
+	while (numBuckets < 2 * count) numBuckets *= 2;
+	if (numBuckets != hash->numBuckets) {
+		unsigned int *bucketHeads = realloc(hash->bucketHeads, sizeof *bucketHeads * numBuckets);
+		assert(bucketHeads && "Failed to reallocate array.");
+		hash->bucketHeads = bucketHeads;
+		hash->numBuckets = numBuckets;
+	}
+	memset(hash->bucketHeads, 0xFF, sizeof *hash->bucketHeads * numBuckets);
+	for (unsigned int k = 0; k < hash->count; ++k) hash->memberIndices[hash->members[k]] = SPATIAL_HASH_NONE;
+	hash->count = 0;
+}
+
+void spatialHashUpdate(struct SpatialHash *hash, struct EntityManager *manager, const struct EntityQuery *query, float dt) {
+	const unsigned int count = query->count;
+	spatialHashReserve(hash, manager->capacity);
+
+	// Two spheres can only touch if their centers are closer than the sum of the radii plus their movement
+	float maxRadius = 0.0f, maxSpeedSquared = 0.0f;
+	for (unsigned int k = 0; k < count; ++k) {
+		unsigned int i = query->entities[k];
+		float radius = manager->colliders[i].radius,
+			  vx = manager->velocities.x[i], vy = manager->velocities.y[i], vz = manager->velocities.z[i],
+			  speedSquared = vx * vx + vy * vy + vz * vz;
+		if (radius > maxRadius) maxRadius = radius;
+		if (speedSquared > maxSpeedSquared) maxSpeedSquared = speedSquared;
+	}
+	float cellSize = 2.0f * (maxRadius + sqrtf(maxSpeedSquared) * fabsf(dt));
+	if (cellSize < 1e-3f) cellSize = 1e-3f;
+	// Rebuild if the cells are too small to hold the pairs, so large that buckets get crowded, or the buckets too full
+	if (cellSize > hash->cellSize || cellSize * CELL_SIZE_SLACK * CELL_SIZE_SLACK < hash->cellSize || 2 * count > hash->numBuckets) {
+		spatialHashReset(hash, cellSize * CELL_SIZE_SLACK, count);
+	}
+	const float invCellSize = 1.0f / hash->cellSize;
+
+	const unsigned int stamp = ++hash->stamp;
+	for (unsigned int k = 0; k < count; ++k) {
+		unsigned int i = query->entities[k];
+		const int cell[3] = {
+			(int) floorf(manager->positions.x[i] * invCellSize),
+			(int) floorf(manager->positions.y[i] * invCellSize),
+			(int) floorf(manager->positions.z[i] * invCellSize)
+		};
+		hash->stamps[i] = stamp;
+		if (hash->memberIndices[i] == SPATIAL_HASH_NONE) {
+			hash->memberIndices[i] = hash->count;
+			hash->members[hash->count++] = i;
+		} else if (memcmp(hash->cells[i], cell, sizeof cell) != 0) {
+			unlinkEntity(hash, i);
+		} else {
+			continue; // Still in the same cell
+		}
+		memcpy(hash->cells[i], cell, sizeof cell);
+		linkEntity(hash, i);
+	}
+
+	// Remove the entities that have left the query since the last update
+	for (unsigned int k = 0; k < hash->count;) {
+		unsigned int i = hash->members[k];
+		if (hash->stamps[i] == stamp) {
+			++k;
+			continue;
+		}
+		unlinkEntity(hash, i);
+		hash->memberIndices[i] = SPATIAL_HASH_NONE;
+		unsigned int last = hash->members[--hash->count];
+		hash->members[k] = last;
+		if (last != i) hash->memberIndices[last] = k;
+	}
+}
+
+void spatialHashQuery(const struct SpatialHash *hash, unsigned int entity, SpatialHashPairCallback callback, void *data) {
+	if (entity >= hash->slotCapacity || hash->memberIndices[entity] == SPATIAL_HASH_NONE) return;
+	const int *cell = hash->cells[entity];
+
+	// Gather the distinct buckets of the neighbouring cells
+	unsigned int buckets[NUM_NEIGHBOR_CELLS];
+	int numBuckets = 0;
+	for (int dx = -1; dx <= 1; ++dx) for (int dy = -1; dy <= 1; ++dy) for (int dz = -1; dz <= 1; ++dz) {
+		const int neighbor[3] = { cell[0] + dx, cell[1] + dy, cell[2] + dz };
+		unsigned int bucket = hashCell(hash, neighbor);
+		int seen = 0;
+		for (int i = 0; i < numBuckets; ++i) if (buckets[i] == bucket) seen = 1;
+		if (!seen) buckets[numBuckets++] = bucket;
+	}
+
+	for (int i = 0; i < numBuckets; ++i) {
+		for (unsigned int other = hash->bucketHeads[buckets[i]]; other != SPATIAL_HASH_NONE; other = hash->next[other]) {
+			const int *otherCell = hash->cells[other];
+			// Skip entries that merely share a bucket
+			if (other != entity && abs(otherCell[0] - cell[0]) <= 1 && abs(otherCell[1] - cell[1]) <= 1 && abs(otherCell[2] - cell[2]) <= 1) {
+				callback(data, entity, other);
+			}
+		}
+	}
+}
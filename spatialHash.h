@@ -0,0 +1,64 @@
+#ifndef SPATIAL_HASH_H
+#define SPATIAL_HASH_H
+
+#include "entity.h"
+
+/**
+ * Called for each entity near a queried one.
+ * @param a The slot index of the queried entity.
+ * @param b The slot index of the neighbouring entity.
+ */
+typedef void (*SpatialHashPairCallback)(void *data, unsigned int a, unsigned int b);
+
+/**
+ * Uniform grid broadphase for sphere colliders.
+ * Spheres are hashed by the cell containing their center, with the cell size chosen so
+ * that spheres which may touch during the frame are always in neighbouring cells.
+ *
+ * The grid persists between steps: each bucket is a linked list threaded through arrays indexed by slot,
+ * so an entity moving to another cell is relinked in constant time and entities staying in their cell cost nothing.
+ * The grid is only rebuilt when the cell size no longer fits the colliders or the buckets become too full.
+ */
+struct SpatialHash {
+	float cellSize;
+	/** The number of buckets; always a power of two. */
+	unsigned int numBuckets;
+	/** The first entity of each bucket, or ::SPATIAL_HASH_NONE. */
+	unsigned int *bucketHeads;
+	/** The number of inserted entities. */
+	unsigned int count;
+	/** Slot indices of the inserted entities. */
+	unsigned int *members;
+	/*
+	 * Indexed by slot: the position in \c members or ::SPATIAL_HASH_NONE if not inserted,
+	 * the links of the bucket list, the bucket, the cell coordinates and the step last seen in.
+	 */
+	unsigned int *memberIndices, *next, *prev, *buckets;
+	int (*cells)[3];
+	unsigned int *stamps;
+	unsigned int slotCapacity;
+	/** Counts the updates, to find the entities that left the query. */
+	unsigned int stamp;
+};
+
+#define SPATIAL_HASH_NONE ((unsigned int) -1)
+
+void spatialHashInit(struct SpatialHash *hash);
+
+void spatialHashDestroy(struct SpatialHash *hash);
+
+/**
+ * Brings the grid up to date with the positions and collider radii of the entities in the query,
+ * inserting and removing entities that entered and left it.
+ * Only entities whose cell changed are moved between buckets.
+ * @param dt The time step, used to account for the movement during the frame.
+ */
+void spatialHashUpdate(struct SpatialHash *hash, struct EntityManager *manager, const struct EntityQuery *query, float dt);
+
+/**
+ * Emits the entities in the cells neighbouring that of an inserted entity, which are the only ones it may touch.
+ * Does nothing if the entity is not inserted.
+ */
+void spatialHashQuery(const struct SpatialHash *hash, unsigned int entity, SpatialHashPairCallback callback, void *data);
+
+#endif
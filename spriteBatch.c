@@ -8,12 +8,23 @@
  * Number of vertices per sprite in sprite batch.
  */
 #define SPRITE_SIZE 20
+/** The size in bytes of a vertex: the position and texture coordinates, then the packed color. */
+#define VERTEX_STRIDE (sizeof(GLfloat) * 4 + sizeof(GLubyte) * 4)
+/** The number of full batches each region of the stream holds. */
+#define BATCHES_PER_REGION 4
 
 struct Color white = { 1.0f, 1.0f, 1.0f, 1.0f };
 
+/** Makes the program current for the batch, looking up the handles of its uniforms. */
+static void spriteBatchSetProgram(struct SpriteBatch *batch, struct ShaderProgram *program) {
+	batch->program = program;
+	batch->projectionUniform = shaderProgramUniform(program, "projection");
+	batch->textureUniform = shaderProgramUniform(program, "texture");
+}
+
 void spriteBatchInitialize(struct SpriteBatch *batch, int size) {
 	assert(batch && "The spritebatch cannot be null.");
-	batch->vertices = malloc(sizeof(GLfloat) * (batch->maxVertices = SPRITE_SIZE * size));
+	batch->maxVertices = SPRITE_SIZE * size;
 	GLushort *indices = malloc(sizeof(GLushort) * 6 * size);
 	for (int i = 0, j = 0, length = size * 6; i < length; i += 6, j += 4) {
 		indices[i] = j + 0;
@@ -26,13 +37,18 @@ void spriteBatchInitialize(struct SpriteBatch *batch, int size) {
 	batch->index = 0;
 	batch->drawing = 0;
 
-	glGenBuffers(1, &batch->vertexObject);
-	glBindBuffer(GL_ARRAY_BUFFER, batch->vertexObject);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * SPRITE_SIZE * size, batch->vertices, GL_STREAM_DRAW);
+	streamBufferInit(&batch->stream, GL_ARRAY_BUFFER, sizeof(GLfloat) * batch->maxVertices * BATCHES_PER_REGION);
+	// Reservations are never larger than the regions, so the buffer stays the same
+	batch->vertices = streamBufferReserve(&batch->stream, sizeof(GLfloat) * batch->maxVertices, VERTEX_STRIDE);
 	glGenBuffers(1, &batch->indexObject);
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, batch->indexObject);
 	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLushort) * 6 * size, indices, GL_STATIC_DRAW);
 	free(indices);
+	vertexArrayInit(&batch->vertexArray, batch->indexObject);
+	vertexArrayAttrib(&batch->vertexArray, ATTRIB_VERTEX, batch->stream.buffer, 2, GL_FLOAT, GL_FALSE, VERTEX_STRIDE, 0, 0);
+	vertexArrayAttrib(&batch->vertexArray, ATTRIB_TEX_COORD, batch->stream.buffer, 2, GL_FLOAT, GL_FALSE, VERTEX_STRIDE, sizeof(GLfloat) * 2, 0);
+	vertexArrayAttrib(&batch->vertexArray, ATTRIB_COLOR, batch->stream.buffer, 4, GL_UNSIGNED_BYTE, GL_TRUE, VERTEX_STRIDE, sizeof(GLfloat) * 4, 0);
+	vertexArrayUnbind(&batch->vertexArray);
 
 	const GLchar *vertexShaderSource = "uniform mat4 projection;"
 		"attribute vec2 vertex;"
@@ -54,7 +70,8 @@ void spriteBatchInitialize(struct SpriteBatch *batch, int size) {
 			"void main() {"
 			"	gl_FragColor = vColor * texture2D(texture, vTexCoord);"
 			"}";
-	batch->defaultProgram = batch->program = createProgramVertFrag(vertexShaderSource, fragmentShaderSource);
+	shaderProgramInit(&batch->defaultProgram, createProgramVertFrag(vertexShaderSource, fragmentShaderSource));
+	spriteBatchSetProgram(batch, &batch->defaultProgram);
 
 	const GLubyte whiteTextureData[] = { 0xFF };
 	glGenTextures(1, &batch->whiteTexture);
@@ -69,20 +86,17 @@ static int packColor(struct Color color) {
 }
 
 void spriteBatchDestroy(struct SpriteBatch *batch) {
-	glDeleteBuffers(1, &batch->vertexObject);
+	streamBufferDestroy(&batch->stream);
 	glDeleteBuffers(1, &batch->indexObject);
-	free(batch->vertices);
-	glDeleteProgram(batch->defaultProgram);
+	vertexArrayDestroy(&batch->vertexArray);
+	shaderProgramDestroy(&batch->defaultProgram);
 	glDeleteTextures(1, &batch->whiteTexture);
 }
 
 static void spriteBatchSetupProgram(struct SpriteBatch *batch) {
 	ALIGN(16) float mv[16];
-	glUniformMatrix4fv(glGetUniformLocation(batch->program, "projection"), 1, 0, MatrixGet(mv, batch->projectionMatrix));
-	glUniform1i(glGetUniformLocation(batch->program, "texture"), 0);
-	batch->vertexAttrib = glGetAttribLocation(batch->program, "vertex");
-	batch->texCoordAttrib = glGetAttribLocation(batch->program, "tex_coord");
-	batch->colorAttrib = glGetAttribLocation(batch->program, "color");
+	shaderUniformMatrix4fv(batch->projectionUniform, 1, MatrixGet(mv, batch->projectionMatrix));
+	shaderUniform1i(batch->textureUniform, 0);
 }
 
 void spriteBatchBegin(struct SpriteBatch *batch) {
@@ -91,43 +105,41 @@ void spriteBatchBegin(struct SpriteBatch *batch) {
 	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
 	glActiveTexture(GL_TEXTURE0);
-	glUseProgram(batch->program);
+	glUseProgram(batch->program->id);
 	spriteBatchSetupProgram(batch);
-	glBindBuffer(GL_ARRAY_BUFFER, batch->vertexObject);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, batch->indexObject);
-	glEnableVertexAttribArray(batch->vertexAttrib);
-	glEnableVertexAttribArray(batch->texCoordAttrib);
-	glEnableVertexAttribArray(batch->colorAttrib);
+	vertexArrayBind(&batch->vertexArray);
 }
 
 static void spriteBatchFlush(struct SpriteBatch *batch) {
 	if (batch->index == 0) return;
-	GLsizei stride = sizeof(GLfloat) * 4 + sizeof(GLubyte) * 4;
-	glVertexAttribPointer(batch->vertexAttrib, 2, GL_FLOAT, GL_FALSE, stride, 0);
-	glVertexAttribPointer(batch->texCoordAttrib, 2, GL_FLOAT, GL_FALSE, stride, BUFFER_OFFSET(sizeof(GLfloat) * 2));
-	glVertexAttribPointer(batch->colorAttrib, 4, GL_UNSIGNED_BYTE, GL_TRUE, stride, BUFFER_OFFSET(sizeof(GLfloat) * 4));
-	glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(float) * batch->index, batch->vertices);
-	glDrawElements(GL_TRIANGLES, batch->index / stride * 6, GL_UNSIGNED_SHORT, 0);
+	size_t offset = streamBufferCommit(&batch->stream, sizeof(GLfloat) * batch->index);
+	// Batches follow each other in a mapped stream, so the indices are offset to the first vertex
+	GLint baseVertex = offset / VERTEX_STRIDE;
+	GLsizei count = batch->index / SPRITE_SIZE * 6;
+	if (baseVertex) {
+		glDrawElementsBaseVertex(GL_TRIANGLES, count, GL_UNSIGNED_SHORT, 0, baseVertex);
+	} else {
+		glDrawElements(GL_TRIANGLES, count, GL_UNSIGNED_SHORT, 0);
+	}
 	batch->index = 0;
+	batch->vertices = streamBufferReserve(&batch->stream, sizeof(GLfloat) * batch->maxVertices, VERTEX_STRIDE);
 }
 
 void spriteBatchEnd(struct SpriteBatch *batch) {
 	assert(batch->drawing && "Call begin before end.");
 	spriteBatchFlush(batch);
-	glDisableVertexAttribArray(batch->vertexAttrib);
-	glDisableVertexAttribArray(batch->texCoordAttrib);
-	glDisableVertexAttribArray(batch->colorAttrib);
+	vertexArrayUnbind(&batch->vertexArray);
 	batch->lastTexture = 0;
 	batch->drawing = 0;
 }
 
-void spriteBatchSwitchProgram(struct SpriteBatch *batch, GLuint program) {
+void spriteBatchSwitchProgram(struct SpriteBatch *batch, struct ShaderProgram *program) {
 	if (batch->drawing) {
 		spriteBatchFlush(batch);
 	}
-	batch->program = program ? program : batch->defaultProgram;
+	spriteBatchSetProgram(batch, program ? program : &batch->defaultProgram);
 	if (batch->drawing) {
-		glUseProgram(batch->program);
+		glUseProgram(batch->program->id);
 		spriteBatchSetupProgram(batch);
 	}
 }
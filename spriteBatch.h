@@ -4,6 +4,8 @@
 #include <GL/glew.h>
 #include <vmath.h>
 #include "font.h"
+#include "glUtil.h"
+#include "streamBuffer.h"
 
 #include "linebreak.h"
 
@@ -14,16 +16,21 @@ struct Color {
 extern struct Color white;
 
 struct SpriteBatch {
-	GLuint vertexObject, indexObject;
+	/** The vertices of the sprites, streamed to the GPU as each batch is flushed. */
+	struct StreamBuffer stream;
+	GLuint indexObject;
+	struct VertexArray vertexArray;
 	// Number of sprites able to be stored
 	int index;
 	int maxVertices;
 	/** Whether or not we are drawing. */
 	int drawing;
+	/** Where the vertices of the batch are written, reserved in the stream. */
 	float *vertices;
-	GLuint program, defaultProgram;
+	struct ShaderProgram *program, defaultProgram;
+	/** Handles of the uniforms of the current program. */
+	struct ShaderUniform *projectionUniform, *textureUniform;
 	MATRIX projectionMatrix;
-	GLint vertexAttrib, texCoordAttrib, colorAttrib;
 	GLuint whiteTexture, lastTexture;
 };
 
@@ -35,7 +42,11 @@ void spriteBatchBegin(struct SpriteBatch *batch);
 
 void spriteBatchEnd(struct SpriteBatch *batch);
 
-void spriteBatchSwitchProgram(struct SpriteBatch *batch, GLuint program);
+/**
+ * Switches to drawing with the specified program, or the default one if null.
+ * The program has to name its attributes like the default one, which binds them to the locations of the vertex array.
+ */
+void spriteBatchSwitchProgram(struct SpriteBatch *batch, struct ShaderProgram *program);
 
 void spriteBatchDraw(struct SpriteBatch *batch, GLuint texture, float x, float y, float width, float height);
 
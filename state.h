@@ -5,7 +5,11 @@
 
 typedef struct State {
 	void (*update)(struct State *state, float dt);
-	void (*draw)(struct State *state, float dt);
+	/**
+	 * @param dt The time since the last frame.
+	 * @param alpha How far the frame is between the last two simulation steps, in [0, 1).
+	 */
+	void (*draw)(struct State *state, float dt, float alpha);
 	void (*resize)(struct State *state, int width, int height);
 	void (*mouseDown)(struct State *state, int button, int x, int y);
 	void (*mouseUp)(struct State *state, int button, int x, int y);
@@ -0,0 +1,118 @@
+#include "streamBuffer.h"
+#include <stdlib.h>
+#include <assert.h>
+
+static int isPersistentMappingSupported() {
+#ifdef __EMSCRIPTEN__
+	return 0; // WebGL cannot map buffers
+#else
+	// Data is drawn from offsets into the ring with base vertices, which come with 3.2
+	return GLEW_VERSION_4_4 || (GLEW_ARB_buffer_storage && GLEW_VERSION_3_2);
+#endif
+}
+
+/** Creates the storage of all regions and maps it for as long as the buffer lives. */
+static void createStorage(struct StreamBuffer *stream) {
+	const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+	const size_t size = stream->regionSize * STREAM_BUFFER_REGIONS;
+	glGenBuffers(1, &stream->buffer);
+	glBindBuffer(stream->target, stream->buffer);
+	glBufferStorage(stream->target, size, NULL, flags);
+	stream->mapped = glMapBufferRange(stream->target, 0, size, flags);
+	assert(stream->mapped && "Failed to map stream buffer.");
+	for (int i = 0; i < STREAM_BUFFER_REGIONS; ++i) stream->fences[i] = 0;
+	stream->region = 0;
+	stream->head = 0;
+}
+
+static void deleteStorage(struct StreamBuffer *stream) {
+	for (int i = 0; i < STREAM_BUFFER_REGIONS; ++i) {
+		if (stream->fences[i]) glDeleteSync(stream->fences[i]);
+	}
+	// Draws still reading the buffer keep its storage alive
+	glDeleteBuffers(1, &stream->buffer);
+}
+
+/** Waits until the GPU has finished the draws the fence was placed after, and deletes it. */
+static void waitFence(GLsync *fence) {
+	if (!*fence) return;
+	// Flush on the first try, or the fence may never be reached
+	GLbitfield flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+	while (glClientWaitSync(*fence, flags, 1000000000) == GL_TIMEOUT_EXPIRED) flags = 0;
+	glDeleteSync(*fence);
+	*fence = 0;
+}
+
+/** Returns the offset in the buffer of the free space of the region, rounded up to the alignment. */
+static size_t alignedHead(const struct StreamBuffer *stream, size_t align) {
+	size_t offset = stream->region * stream->regionSize + stream->head;
+	return (offset + align - 1) / align * align;
+}
+
+void streamBufferInit(struct StreamBuffer *stream, GLenum target, size_t regionSize) {
+	assert(regionSize > 0 && "Stream regions cannot be empty.");
+	stream->target = target;
+	stream->regionSize = regionSize;
+	stream->mapped = 0;
+	stream->memory = 0;
+	stream->reserved = 0;
+	if (isPersistentMappingSupported()) {
+		createStorage(stream);
+	} else {
+		glGenBuffers(1, &stream->buffer);
+		stream->memory = malloc(regionSize);
+		assert(stream->memory && "Failed to allocate memory.");
+	}
+}
+
+void streamBufferDestroy(struct StreamBuffer *stream) {
+	if (stream->mapped) {
+		deleteStorage(stream);
+	} else {
+		glDeleteBuffers(1, &stream->buffer);
+		free(stream->memory);
+	}
+}
+
+void *streamBufferReserve(struct StreamBuffer *stream, size_t size, size_t align) {
+	if (!stream->mapped) {
+		if (size > stream->regionSize) {
+			unsigned char *memory = realloc(stream->memory, size);
+			assert(memory && "Failed to reallocate array.");
+			stream->memory = memory;
+			stream->regionSize = size;
+		}
+		return stream->memory;
+	}
+
+	size_t offset = alignedHead(stream, align);
+	if (offset + size > (stream->region + 1) * stream->regionSize && stream->head > 0) {
+		// Fence the draws of the full region and move on to the next one, once the GPU is done with it
+		stream->fences[stream->region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		stream->region = (stream->region + 1) % STREAM_BUFFER_REGIONS;
+		stream->head = 0;
+		waitFence(stream->fences + stream->region);
+		offset = alignedHead(stream, align);
+	}
+	if (offset + size > (stream->region + 1) * stream->regionSize) {
+		// Even an empty region is too small, so replace the buffer with a larger one
+		deleteStorage(stream);
+		while (stream->regionSize < size + align) stream->regionSize *= 2;
+		createStorage(stream);
+		offset = alignedHead(stream, align);
+	}
+	stream->reserved = offset;
+	return stream->mapped + offset;
+}
+
+size_t streamBufferCommit(struct StreamBuffer *stream, size_t size) {
+	glBindBuffer(stream->target, stream->buffer);
+	if (!stream->mapped) {
+		// Respecifying the whole buffer orphans the storage draws may still be reading
+		if (size > 0) glBufferData(stream->target, size, stream->memory, GL_STREAM_DRAW);
+		return 0;
+	}
+	// The mapping is coherent, so the writes are seen by the commands that follow
+	stream->head = stream->reserved + size - stream->region * stream->regionSize;
+	return stream->reserved;
+}
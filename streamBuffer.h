@@ -0,0 +1,60 @@
+#ifndef STREAM_BUFFER_H
+#define STREAM_BUFFER_H
+
+#include <stddef.h>
+#include <GL/glew.h>
+
+/** The number of regions of the ring, so that the GPU can read two while the third is written. */
+#define STREAM_BUFFER_REGIONS 3
+
+/**
+ * A buffer for data written every frame, which is written in place instead of copied in.
+ *
+ * Where buffer storage is supported, the buffer is mapped persistently and split into a ring of regions.
+ * Data is appended to the current region, and when it is full the draws reading it are fenced
+ * and the next region is waited on, so that the GPU never reads data being overwritten.
+ * Otherwise data is written to memory and uploaded on commit, orphaning the storage of the buffer
+ * so that the upload never waits on draws still reading the previous data.
+ *
+ * The data of a reservation has to be drawn before the next reservation, for the fences to cover it.
+ */
+struct StreamBuffer {
+	GLenum target;
+	GLuint buffer;
+	/** The size of each region, or of the memory when not mapped. */
+	size_t regionSize;
+	/** The persistently mapped regions, or null if unsupported. */
+	unsigned char *mapped;
+	/** Fences after the draws reading each region, or zero. */
+	GLsync fences[STREAM_BUFFER_REGIONS];
+	unsigned int region;
+	/** The offset of the free space within the region. */
+	size_t head;
+	/** The offset of the reservation in the buffer. */
+	size_t reserved;
+	/** Where data is written before being uploaded, when not mapped. */
+	unsigned char *memory;
+};
+
+/**
+ * @param target The target the buffer is bound to on commit.
+ * @param regionSize The initial size of each region, which grows to fit larger reservations.
+ */
+void streamBufferInit(struct StreamBuffer *stream, GLenum target, size_t regionSize);
+
+void streamBufferDestroy(struct StreamBuffer *stream);
+
+/**
+ * Returns memory to write up to \p size bytes of data to, until ::streamBufferCommit.
+ * Growing to fit the reservation replaces the buffer object, so callers pointing at it have to compare its name.
+ * @param align The alignment of the data from the start of the buffer, such as the size of a vertex.
+ */
+void *streamBufferReserve(struct StreamBuffer *stream, size_t size, size_t align);
+
+/**
+ * Makes the first \p size bytes written to the reservation available to the GPU, and binds the buffer.
+ * @return The offset of the data in the buffer.
+ */
+size_t streamBufferCommit(struct StreamBuffer *stream, size_t size);
+
+#endif
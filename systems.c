@@ -0,0 +1,58 @@
+#include "systems.h"
+#include "collision.h"
+
+void systemContextInit(struct SystemContext *context, struct EntityManager *manager, struct SpatialHash *broadphase, Entity player, float dt) {
+	context->manager = manager;
+	context->broadphase = broadphase;
+	context->player = entityIndex(player);
+	context->dt = dt;
+	context->playerPos = entityManagerGetPosition(manager, context->player);
+	context->enemies = entityManagerQuery(manager, ENEMY_SYSTEM_MASK);
+	context->colliders = entityManagerQuery(manager, COLLIDER_SYSTEM_MASK);
+	context->onPlayerHit = 0;
+	context->data = 0;
+}
+
+void processEnemies(void *data, int start, int end) {
+	struct SystemContext *context = data;
+	struct EntityManager *manager = context->manager;
+	for (int k = start; k < end; ++k) {
+		unsigned int i = context->enemies->entities[k];
+		VECTOR pos = entityManagerGetPosition(manager, i);
+		VECTOR toward = VectorSubtract(context->playerPos, pos);
+		if ((VectorEqual(toward, VectorReplicate(0.0f)) & 0x7) == 0x7) {
+			entityManagerSetVelocity(manager, i, VectorReplicate(0.0f));
+		} else {
+			entityManagerSetVelocity(manager, i, VectorDivide(Vector4Normalize(toward), VectorReplicate(100.0f)));
+		}
+	}
+}
+
+void processVelocities(void *data, int start, int end) {
+	struct SystemContext *context = data;
+	entityManagerIntegrate(context->manager, start, end, context->dt);
+}
+
+void buildBroadphase(void *data, int start, int end) {
+	struct SystemContext *context = data;
+	spatialHashUpdate(context->broadphase, context->manager, context->colliders, context->dt);
+}
+
+/** Narrow phase for a neighbour of the player from the broadphase. */
+static void processCollisionPair(void *data, unsigned int a, unsigned int b) {
+	struct SystemContext *context = data;
+	struct EntityManager *manager = context->manager;
+	VECTOR pos0 = entityManagerGetPosition(manager, a), velocity0 = entityManagerGetVelocity(manager, a),
+		   pos1 = entityManagerGetPosition(manager, b), velocity1 = entityManagerGetVelocity(manager, b);
+	VECTOR movevec = VectorMultiply(VectorReplicate(context->dt), VectorSubtract(velocity0, velocity1));
+	if (isSphereCollision(pos0, pos1, manager->colliders[a].radius, manager->colliders[b].radius, movevec)
+			&& context->onPlayerHit) {
+		context->onPlayerHit(context->data);
+	}
+}
+
+void processCollisions(void *data, int start, int end) {
+	struct SystemContext *context = data;
+	// Only the player reacts to collisions, so only its neighbours need testing
+	spatialHashQuery(context->broadphase, context->player, processCollisionPair, data);
+}
@@ -0,0 +1,48 @@
+#ifndef SYSTEMS_H
+#define SYSTEMS_H
+
+#include <vmath.h>
+#include "entity.h"
+#include "spatialHash.h"
+
+#define ENEMY_SYSTEM_MASK (POSITION_COMPONENT_MASK | VELOCITY_COMPONENT_MASK | ENEMY_COMPONENT_MASK)
+#define COLLIDER_SYSTEM_MASK (POSITION_COMPONENT_MASK | VELOCITY_COMPONENT_MASK | COLLIDER_COMPONENT_MASK)
+
+/**
+ * State shared by the gameplay systems during one simulation step.
+ * The systems do not depend on SDL or GL so that they can be run headless.
+ */
+struct SystemContext {
+	struct EntityManager *manager;
+	struct SpatialHash *broadphase;
+	/** The slot index of the player. */
+	unsigned int player;
+	float dt;
+	VECTOR playerPos;
+	const struct EntityQuery *enemies, *colliders;
+	/** Called, possibly concurrently, by the collision system when the player was hit. */
+	void (*onPlayerHit)(void *data);
+	void *data;
+};
+
+/** Prepares the queries and player state for a step of \p dt milliseconds. */
+void systemContextInit(struct SystemContext *context, struct EntityManager *manager, struct SpatialHash *broadphase, Entity player, float dt);
+
+/*
+ * The systems have the signature of job functions, each processing the items in [start, end)
+ * of its range, so that they can be run as parallel-for jobs with the context as data.
+ */
+
+/** Steers the enemies in [start, end) of the enemy query toward the player. */
+void processEnemies(void *context, int start, int end);
+
+/** Updates the broadphase with the moved colliders. The range is ignored. */
+void buildBroadphase(void *context, int start, int end);
+
+/** Tests the player against its neighbours in the broadphase for collisions. The range is ignored. */
+void processCollisions(void *context, int start, int end);
+
+/** Integrates the positions of the batches in [start, end). */
+void processVelocities(void *context, int start, int end);
+
+#endif
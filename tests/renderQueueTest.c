@@ -0,0 +1,62 @@
+#include <stdio.h>
+#include "../renderQueue.h"
+
+#define CHECK(condition) do { \
+		if (!(condition)) { \
+			fprintf(stderr, "%s:%d: Check failed: %s\n", __FILE__, __LINE__, #condition); \
+			return 1; \
+		} \
+	} while (0)
+
+/** Draws of depth-only passes are sorted nearest first, whatever their models. */
+static int testDepthKeysSortNearestFirst() {
+	struct RenderQueue queue;
+	renderQueueInit(&queue);
+	// The far model has the lower id, so sorting by model first would draw it first
+	renderQueuePush(&queue, (struct RenderCommand) { renderDepthKey(0, 0, 0, 0.8f), 0, 0, 0, 1 });
+	renderQueuePush(&queue, (struct RenderCommand) { renderDepthKey(0, 0, 1, 0.2f), 0, 0, 1, 1 });
+	renderQueueSort(&queue);
+	CHECK(queue.count == 2);
+	CHECK(queue.commands[0].first == 1);
+	CHECK(queue.commands[1].first == 0);
+	renderQueueDestroy(&queue);
+	return 0;
+}
+
+/** Draws at equal depths are grouped by model. */
+static int testDepthKeysGroupModelsAtEqualDepth() {
+	struct RenderQueue queue;
+	renderQueueInit(&queue);
+	renderQueuePush(&queue, (struct RenderCommand) { renderDepthKey(0, 0, 1, 0.0f), 0, 0, 0, 1 });
+	renderQueuePush(&queue, (struct RenderCommand) { renderDepthKey(0, 0, 0, 0.0f), 0, 0, 1, 1 });
+	renderQueuePush(&queue, (struct RenderCommand) { renderDepthKey(0, 0, 1, 0.0f), 0, 0, 2, 1 });
+	renderQueueSort(&queue);
+	CHECK(queue.commands[0].first == 1);
+	CHECK(queue.commands[1].first == 0);
+	CHECK(queue.commands[2].first == 2);
+	renderQueueDestroy(&queue);
+	return 0;
+}
+
+/** Passes come out in order, and each is found by its pass. */
+static int testPassesSortInOrder() {
+	struct RenderQueue queue;
+	renderQueueInit(&queue);
+	renderQueuePush(&queue, (struct RenderCommand) { renderKey(2, 1, 0, 0, 0.5f), 0, 0, 0, 1 });
+	renderQueuePush(&queue, (struct RenderCommand) { renderDepthKey(1, 0, 3, 0.9f), 0, 0, 1, 1 });
+	renderQueuePush(&queue, (struct RenderCommand) { renderDepthKey(1, 0, 2, 0.1f), 0, 0, 2, 1 });
+	renderQueueSort(&queue);
+	unsigned int start, end = renderQueueFindPass(&queue, 1, &start);
+	CHECK(start == 0 && end == 2);
+	CHECK(queue.commands[0].first == 2);
+	end = renderQueueFindPass(&queue, 2, &start);
+	CHECK(start == 2 && end == 3);
+	renderQueueDestroy(&queue);
+	return 0;
+}
+
+int main(void) {
+	return testDepthKeysSortNearestFirst()
+		|| testDepthKeysGroupModelsAtEqualDepth()
+		|| testPassesSortInOrder();
+}